@@ -16,7 +16,7 @@ mkdir -p bin
 
 # Step 3: Compile the client code
 echo "Compiling DHCP client..."
-gcc -o bin/client ./src/client.c ./src/config/env.c ./src/data/message.c ./src/utils/utils.c ./src/data/ip_pool.c -lpthread
+gcc -o bin/client ./src/client.c ./src/config/env.c ./src/data/message.c ./src/utils/utils.c -lpthread
 
 # Step 4: Run the client
 echo "Running DHCP client..."
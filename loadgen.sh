@@ -0,0 +1,27 @@
+#!/bin/bash
+
+# Step 1: Load environment variables from .env.client file, the load generator talks to the server as the client does
+if [ -f .env.client ]; then
+    # Source the .env.client file to handle variables with spaces correctly
+    set -a    # Automatically export all variables
+    source .env.client
+    set +a    # Stop automatically exporting variables
+else
+    echo ".env.client file not found!"
+fi
+
+# Step 2: Create and navigate to the build directory
+echo "Setting up build directory..."
+mkdir -p bin
+
+# Step 3: Compile the load generator code
+echo "Compiling DHCP load generator..."
+gcc -O2 -o bin/loadgen ./src/loadgen.c ./src/config/env.c ./src/data/message.c ./src/utils/batch_io.c -lm
+
+# Step 4: Run the load generator
+echo "Running DHCP load generator..."
+echo ""
+./bin/loadgen
+
+# Step 5: Script end
+echo "Load generator execution completed."
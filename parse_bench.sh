@@ -0,0 +1,17 @@
+#!/bin/bash
+
+# Step 1: Create and navigate to the build directory, the benchmark needs no environment variables
+echo "Setting up build directory..."
+mkdir -p bin
+
+# Step 2: Compile the parse benchmark with the optimization of a release build
+echo "Compiling DHCP parse benchmark..."
+gcc -O2 -o bin/parse_bench ./src/parse_bench.c ./src/data/message.c
+
+# Step 3: Run the benchmark
+echo "Running DHCP parse benchmark..."
+echo ""
+./bin/parse_bench
+
+# Step 4: Script end
+echo "Parse benchmark execution completed."
@@ -0,0 +1,29 @@
+#!/bin/bash
+
+# Step 1: Load environment variables from .env file, the pool is built from the same scopes as the server
+if [ -f .env ]; then
+    # Source the .env file to handle variables with spaces correctly
+    set -a    # Automatically export all variables
+    source .env
+    set +a    # Stop automatically exporting variables
+else
+    echo ".env file not found!"
+fi
+
+# Step 2: Create and navigate to the build directory
+echo "Setting up build directory..."
+mkdir -p bin
+
+# Step 3: Compile the pool stress test
+echo "Compiling IP pool stress test..."
+gcc -O2 -o bin/pool_stress ./src/pool_stress.c ./src/config/env.c ./src/config/scope.c ./src/data/ip_pool.c ./src/data/timing_wheel.c ./src/data/lease_journal.c ./src/data/lease_replication.c ./src/utils/utils.c -lpthread
+
+# Step 4: Run the stress test, it exits with 1 if an address was held by two clients
+echo "Running IP pool stress test..."
+echo ""
+./bin/pool_stress
+status=$?
+
+# Step 5: Script end
+echo "Pool stress test execution completed."
+exit $status
@@ -16,7 +16,7 @@ mkdir -p bin
 
 # Step 3: Compile the server code
 echo "Compiling DHCP server..."
-gcc -o bin/relay ./src/relay.c ./src/config/env.c -lpthread
+gcc -o bin/relay ./src/relay.c ./src/config/env.c ./src/utils/batch_io.c ./src/data/message.c ./src/data/transaction_table.c ./src/data/upstream.c -lpthread
 
 # Step 4: Run the relay
 echo "Running DHCP relay..."
@@ -0,0 +1,17 @@
+#!/bin/bash
+
+# Step 1: Create and navigate to the build directory, the benchmark needs no environment variables
+echo "Setting up build directory..."
+mkdir -p bin
+
+# Step 2: Compile the reply benchmark with the optimization of a release build
+echo "Compiling DHCP reply benchmark..."
+gcc -O2 -o bin/reply_bench ./src/reply_bench.c ./src/data/reply.c ./src/config/scope.c ./src/config/env.c ./src/data/message.c
+
+# Step 3: Run the benchmark
+echo "Running DHCP reply benchmark..."
+echo ""
+./bin/reply_bench
+
+# Step 4: Script end
+echo "Reply benchmark execution completed."
@@ -16,7 +16,7 @@ mkdir -p bin
 
 # Step 3: Compile the server code
 echo "Compiling DHCP server..."
-gcc -o bin/server ./src/server.c ./src/config/env.c ./src/data/message.c  ./src/data/ip_pool.c -lpthread
+gcc $CFLAGS -o bin/server ./src/server.c ./src/config/env.c ./src/data/message.c ./src/config/scope.c ./src/config/reservation.c ./src/data/ip_pool.c ./src/data/request_queue.c ./src/data/timing_wheel.c ./src/data/lease_journal.c ./src/data/lease_replication.c ./src/data/load_balancing.c ./src/data/reply.c ./src/utils/utils.c ./src/utils/batch_io.c ./src/utils/uring.c ./src/utils/alloc_counter.c -lpthread
 
 # Step 4: Run the server
 echo "Running DHCP server..."
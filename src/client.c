@@ -30,9 +30,13 @@ void send_dhcp_release(int sockfd, struct sockaddr_in *server_addr) {
 
     // Update the DHCP options to indicate a DHCP_RELEASE message type
     set_dhcp_message_type(&assigned_values_msg, DHCP_RELEASE);
+    assigned_values_msg.op = 1; // BOOTREQUEST, the message started as the ACK of the server
+    assigned_values_msg.giaddr = 0; // Left for the relays, as in send_dhcp_request
 
-    // Send the DHCP_RELEASE message to the server
-    if (sendto(sockfd, &assigned_values_msg, sizeof(assigned_values_msg), 0, (struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
+    // Send the DHCP_RELEASE message to the server, serialized in network order
+    uint8_t buffer[BUFFER_SIZE];
+    int length = build_dhcp_message(&assigned_values_msg, buffer, sizeof(buffer));
+    if (sendto(sockfd, buffer, length, 0, (struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
         perror(RED "Error sending DHCP_RELEASE" RESET);
     } else {
         printf(CYAN "DHCP_RELEASE message sent to the server.\n" RESET);
@@ -67,9 +71,15 @@ void handle_signal_interrupt(int signal) {
 void send_dhcp_request(int sockfd, struct sockaddr_in *server_addr, dhcp_message_t *msg) {
     // Set the message type to DHCP_REQUEST
     set_dhcp_message_type(msg, DHCP_REQUEST);
+    msg->op = 1; // BOOTREQUEST, the message started as the reply of the server
 
-    // Send the DHCP Request message to the server
-    if (sendto(sockfd, msg, sizeof(*msg), 0, (struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
+    // The reply carried the gateway in giaddr, but it is left for the relays so the server picks the scope of the client from it
+    msg->giaddr = 0;
+
+    // Send the DHCP Request message to the server, serialized in network order
+    uint8_t buffer[BUFFER_SIZE];
+    int length = build_dhcp_message(msg, buffer, sizeof(buffer));
+    if (sendto(sockfd, buffer, length, 0, (struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
         perror(RED "Error sending DHCP_REQUEST" RESET);
     } else {
         printf(CYAN "DHCP_REQUEST message sent to the server.\n" RESET);
@@ -103,6 +113,7 @@ void *dhcp_listener(void *arg) {
     socklen_t addr_len = sizeof(server_addr);
     char buffer[BUFFER_SIZE];
     dhcp_message_t msg;
+    dhcp_option_index_t options;
 
     while (1) {
         // Clean the buffer
@@ -116,21 +127,15 @@ void *dhcp_listener(void *arg) {
 
         // Parse the incoming result
         int parse_result = parse_dhcp_message((uint8_t *)buffer, &msg);
-        if (parse_result != 0){
+        if (parse_result != 0 || index_dhcp_options(&msg, recv_len, &options) != 0){
             printf(RED "Failed to parse received message.\n" RESET);
             continue;
         }
 
         // Print the DHCP message with detailed formatting
-        print_dhcp_message(&msg, true);
+        print_dhcp_message(&msg, &options, true);
         
-        uint8_t dhcp_message_type = 0;
-        for (int i = 0; i < DHCP_OPTIONS_LENGTH; i++) {
-            if (msg.options[i] == 53) {
-                dhcp_message_type = msg.options[i + 2]; // Corregido: obtener el valor real del tipo de mensaje
-                break;
-            }
-        }
+        uint8_t dhcp_message_type = options.message_type;
 
         switch (dhcp_message_type) {
             case DHCP_OFFER:
@@ -262,11 +267,11 @@ int main() {
                 return -1;
             }
 
-            // Serialize the message to a buffer
-            build_dhcp_message(&msg, buffer, sizeof(buffer));
+            // Serialize the message to a buffer, only the bytes in use are sent
+            int length = build_dhcp_message(&msg, (uint8_t *)buffer, sizeof(buffer));
 
             // Send DHCP Discover message to the server
-            int sent_bytes = sendto(sockfd, buffer, sizeof(buffer), 0, (struct sockaddr *)&server_addr, addr_len);
+            int sent_bytes = sendto(sockfd, buffer, length, 0, (struct sockaddr *)&server_addr, addr_len);
             if (sent_bytes < 0) {
                 printf(RED "Failed to send message to server.\n" RESET);
                 close(sockfd);
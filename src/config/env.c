@@ -9,6 +9,27 @@ int port;
 char ip_range[MAX_CHARACTERS_PATH];
 char global_dns_ip[IP_ADDRESS_SIZE];
 char global_subnet_mask[IP_ADDRESS_SIZE];
+int worker_count = 0; // Number of worker threads of the server, 0 means one per CPU
+char io_mode[IO_MODE_SIZE] = "pool"; // How the server receives messages: "pool", "reuseport" or "uring"
+int batch_size = 16; // Maximum number of datagrams received or sent with one system call
+char lease_journal[MAX_CHARACTERS_PATH] = ""; // File where the server journals its leases, empty keeps them only in memory
+char pool_file[MAX_CHARACTERS_PATH] = ""; // File mapped as the working pool of the server, empty keeps the pool on the heap
+char scopes_file[MAX_CHARACTERS_PATH] = ""; // File with one scope per line, empty serves the single scope of IP_RANGE
+char reservations_file[MAX_CHARACTERS_PATH] = ""; // File with one reserved address per client and line, empty reserves none
+char failover_role[IO_MODE_SIZE] = ""; // "primary" or "standby" of a failover pair, empty runs the server alone
+char failover_address[MAX_CHARACTERS_IP] = ""; // ip:port the server replicates its leases from
+char failover_peer[MAX_CHARACTERS_IP] = ""; // ip:port of the other server of the pair
+char lb_peers[MAX_CHARACTERS_PATH] = ""; // ip:port of every load balanced server, this one included, separated by commas
+int lb_index = 0; // Place of this server in lb_peers
+int lb_server_count = 0; // Servers in lb_peers, 0 without load balancing
+char relay_ip[IP_ADDRESS_SIZE] = ""; // Address of the relay on the subnet of its clients, stamped in giaddr, empty takes the address of eth0
+char relay_servers[MAX_CHARACTERS_PATH] = ""; // ip:port of every server the relay forwards to, separated by commas, empty forwards to SERVER_IP
+char relay_mode[IO_MODE_SIZE] = "fastest"; // How the relay picks servers: "fastest" healthy one or "fanout" to every healthy one
+int relay_server_timeout = 2000; // Milliseconds a server may leave a request unanswered before the relay stops using it
+int loadgen_clients = 1000; // Synthetic clients of the load generator, each with its own MAC address
+int loadgen_rate = 1000; // Exchanges the load generator starts per second
+char loadgen_mode[IO_MODE_SIZE] = "open"; // "open" starts exchanges at loadgen_rate whatever the server does, "closed" restarts each client once it is done
+int loadgen_duration = 10; // Seconds the load generator starts new exchanges for
 
 void load_env_variables() {
     // Get the PORT, SERVER_IP, SUBNET, DNS, and IP_RANGE through environment variables
@@ -17,10 +38,30 @@ void load_env_variables() {
     const char *ip_range_env = getenv("IP_RANGE");  // Nueva variable de entorno
     const char *dns_env = getenv("DNS");
     const char *subnet_env = getenv("SUBNET");
+    const char *workers_env = getenv("WORKERS"); // Optional
+    const char *io_mode_env = getenv("IO_MODE"); // Optional
+    const char *batch_size_env = getenv("BATCH_SIZE"); // Optional
+    const char *lease_journal_env = getenv("LEASE_JOURNAL"); // Optional
+    const char *pool_file_env = getenv("POOL_FILE"); // Optional
+    const char *scopes_file_env = getenv("SCOPES_FILE"); // Optional, replaces IP_RANGE, DNS and SUBNET
+    const char *reservations_file_env = getenv("RESERVATIONS_FILE"); // Optional
+    const char *failover_role_env = getenv("FAILOVER_ROLE"); // Optional, needs FAILOVER_ADDRESS and FAILOVER_PEER
+    const char *failover_address_env = getenv("FAILOVER_ADDRESS");
+    const char *failover_peer_env = getenv("FAILOVER_PEER");
+    const char *lb_peers_env = getenv("LB_PEERS"); // Optional, needs LB_INDEX
+    const char *lb_index_env = getenv("LB_INDEX");
+    const char *relay_ip_env = getenv("RELAY_IP"); // Optional, only read by the relay
+    const char *relay_servers_env = getenv("RELAY_SERVERS"); // Optional, only read by the relay
+    const char *relay_mode_env = getenv("RELAY_MODE"); // Optional, only read by the relay
+    const char *relay_server_timeout_env = getenv("RELAY_SERVER_TIMEOUT"); // Optional, only read by the relay
+    const char *loadgen_clients_env = getenv("LOADGEN_CLIENTS"); // Optional, only read by the load generator
+    const char *loadgen_rate_env = getenv("LOADGEN_RATE"); // Optional, only read by the load generator
+    const char *loadgen_mode_env = getenv("LOADGEN_MODE"); // Optional, only read by the load generator
+    const char *loadgen_duration_env = getenv("LOADGEN_DURATION"); // Optional, only read by the load generator
 
 
-    if (!port_env || !ip_range_env || !dns_env || !subnet_env) {
-        printf("The PORT, IP_RANGE, DNS, and SUBNET environment variables are required.\n");
+    if (!port_env || (!scopes_file_env && (!ip_range_env || !dns_env || !subnet_env))) {
+        printf("The PORT environment variable and either SCOPES_FILE or IP_RANGE, DNS, and SUBNET are required.\n");
         exit(0);
     }
 
@@ -31,7 +72,91 @@ void load_env_variables() {
         strcpy(server_ip, server_ip_env);
     }
      // Copy the server_ip_env to the server_ip variable
-    strcpy(ip_range, ip_range_env);  // Copy the ip_range_env to the ip_range variable
-    strcpy(global_dns_ip, dns_env);  // Copy the dns_env to the global_dns_ip variable
-    strcpy(global_subnet_mask, subnet_env);  // Copy the subnet_env to the global_subnet_mask variable
+    strcpy(ip_range, ip_range_env ? ip_range_env : "");  // Copy the ip_range_env to the ip_range variable
+    strcpy(global_dns_ip, dns_env ? dns_env : "");  // Copy the dns_env to the global_dns_ip variable
+    strcpy(global_subnet_mask, subnet_env ? subnet_env : "");  // Copy the subnet_env to the global_subnet_mask variable
+
+    if (workers_env) {
+        worker_count = atoi(workers_env);  // Convert the number of workers to an integer
+    }
+
+    if (io_mode_env) {
+        strncpy(io_mode, io_mode_env, IO_MODE_SIZE - 1);  // Copy the io_mode_env to the io_mode variable
+    }
+
+    if (batch_size_env) {
+        batch_size = atoi(batch_size_env);  // Convert the batch size to an integer
+        if (batch_size < 1)
+            batch_size = 1;
+        if (batch_size > MAX_BATCH_SIZE)
+            batch_size = MAX_BATCH_SIZE;
+    }
+
+    if (lease_journal_env) {
+        strncpy(lease_journal, lease_journal_env, MAX_CHARACTERS_PATH - 1);  // Copy the lease_journal_env to the lease_journal variable
+    }
+
+    if (pool_file_env) {
+        strncpy(pool_file, pool_file_env, MAX_CHARACTERS_PATH - 1);  // Copy the pool_file_env to the pool_file variable
+    }
+
+    if (scopes_file_env) {
+        strncpy(scopes_file, scopes_file_env, MAX_CHARACTERS_PATH - 1);  // Copy the scopes_file_env to the scopes_file variable
+    }
+
+    if (reservations_file_env) {
+        strncpy(reservations_file, reservations_file_env, MAX_CHARACTERS_PATH - 1);  // Copy the reservations_file_env to the reservations_file variable
+    }
+
+    if (failover_role_env) {
+        strncpy(failover_role, failover_role_env, IO_MODE_SIZE - 1);
+        strncpy(failover_address, failover_address_env ? failover_address_env : "", MAX_CHARACTERS_IP - 1);
+        strncpy(failover_peer, failover_peer_env ? failover_peer_env : "", MAX_CHARACTERS_IP - 1);
+    }
+
+    if (lb_peers_env) {
+        strncpy(lb_peers, lb_peers_env, MAX_CHARACTERS_PATH - 1);
+        lb_server_count = 1;
+        for (const char *c = lb_peers; *c; c++)
+            lb_server_count += *c == ',';
+        lb_index = lb_index_env ? atoi(lb_index_env) : -1;
+        if (lb_index < 0 || lb_index >= lb_server_count) {
+            printf(RED "LB_INDEX must be the place of this server in LB_PEERS, from 0 to %d.\n" RESET, lb_server_count - 1);
+            exit(0);
+        }
+    }
+
+    if (relay_ip_env) {
+        strncpy(relay_ip, relay_ip_env, IP_ADDRESS_SIZE - 1);  // Copy the relay_ip_env to the relay_ip variable
+    }
+
+    if (relay_servers_env) {
+        strncpy(relay_servers, relay_servers_env, MAX_CHARACTERS_PATH - 1);  // Copy the relay_servers_env to the relay_servers variable
+    }
+
+    if (relay_mode_env) {
+        strncpy(relay_mode, relay_mode_env, IO_MODE_SIZE - 1);  // Copy the relay_mode_env to the relay_mode variable
+    }
+
+    if (relay_server_timeout_env) {
+        relay_server_timeout = atoi(relay_server_timeout_env);  // Convert the timeout to an integer
+        if (relay_server_timeout < 1)
+            relay_server_timeout = 1;
+    }
+
+    if (loadgen_clients_env) {
+        loadgen_clients = atoi(loadgen_clients_env);  // Convert the number of clients to an integer
+    }
+
+    if (loadgen_rate_env) {
+        loadgen_rate = atoi(loadgen_rate_env);  // Convert the rate to an integer
+    }
+
+    if (loadgen_mode_env) {
+        strncpy(loadgen_mode, loadgen_mode_env, IO_MODE_SIZE - 1);  // Copy the loadgen_mode_env to the loadgen_mode variable
+    }
+
+    if (loadgen_duration_env) {
+        loadgen_duration = atoi(loadgen_duration_env);  // Convert the duration to an integer
+    }
 }
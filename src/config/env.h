@@ -15,6 +15,8 @@
 #define IP_ADDRESS_SIZE 16  // Size of an IP address
 #define MAX_CHARACTERS_IP 360
 #define MAX_CHARACTERS_PATH 520
+#define IO_MODE_SIZE 16
+#define MAX_BATCH_SIZE 64 // Maximum number of datagrams moved by one recvmmsg/sendmmsg call
 
 
 extern char server_ip[];
@@ -22,6 +24,27 @@ extern int port;
 extern char ip_range[];
 extern char global_dns_ip[];
 extern char global_subnet_mask[];
+extern int worker_count;
+extern char io_mode[];
+extern int batch_size;
+extern char lease_journal[];
+extern char pool_file[];
+extern char scopes_file[];
+extern char reservations_file[];
+extern char failover_role[];
+extern char failover_address[];
+extern char failover_peer[];
+extern char lb_peers[];
+extern int lb_index;
+extern int lb_server_count;
+extern char relay_ip[];
+extern char relay_servers[];
+extern char relay_mode[];
+extern int relay_server_timeout;
+extern int loadgen_clients;
+extern int loadgen_rate;
+extern char loadgen_mode[];
+extern int loadgen_duration;
 
 
 // Function to load environment variables
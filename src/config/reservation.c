@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <arpa/inet.h> // For inet_pton()
+
+#include "./reservation.h"
+#include "./env.h"
+#include "../utils/utils.h"
+
+// Table in force, workers read it without a lock and a reload replaces it whole
+static _Atomic(reservation_table_t*) reservation_table = NULL;
+
+// Table replaced by the last reload, freed by the next reload once no worker can still be reading it
+static reservation_table_t* retired_table = NULL;
+
+
+// Function to hash a client identifier (FNV-1a, 64 bits), the high half picks the bucket
+static uint64_t hash_reservation_key(const uint8_t *client_id, int client_id_len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < client_id_len; i++) {
+        hash ^= client_id[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+// Function to get the bucket of a key
+static uint32_t reservation_bucket(uint64_t hash, uint32_t bucket_count) {
+    return (uint32_t)((hash >> 32) % bucket_count);
+}
+
+
+// Function to get the entry of a key for the seed of its bucket, the seed is mixed into the hash so the key is read only once
+static uint32_t reservation_entry(uint64_t hash, uint32_t seed, uint32_t count) {
+    uint64_t x = hash ^ ((uint64_t)seed * 0x9E3779B97F4A7C15ULL);
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return (uint32_t)(x % count);
+}
+
+
+// Function to parse a MAC address or client identifier written as hex bytes separated by ':' or '-', returns its length or -1
+static int parse_client_id(const char *text, uint8_t *client_id) {
+    int length = 0;
+    while (*text != '\0') {
+        unsigned int byte;
+        int consumed;
+        if (length == CLIENT_ID_SIZE || sscanf(text, "%2x%n", &byte, &consumed) != 1 || consumed != 2)
+            return -1;
+        client_id[length++] = (uint8_t)byte;
+
+        text += consumed;
+        if (*text == ':' || *text == '-')
+            text++;
+        else if (*text != '\0')
+            return -1;
+    }
+    return length > 0 ? length : -1;
+}
+
+
+// Function to compare two addresses for qsort
+static int compare_addresses(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+// Function to free a table and its arrays
+static void free_reservation_table(reservation_table_t *table) {
+    if (table == NULL)
+        return;
+    free(table->seeds);
+    free(table->entries);
+    free(table->addresses);
+    free(table);
+}
+
+
+// Function to check if a table reserves an address, its addresses are sorted
+static int table_reserves(const reservation_table_t *table, uint32_t ip) {
+    return table != NULL && bsearch(&ip, table->addresses, table->count, sizeof(uint32_t), compare_addresses) != NULL;
+}
+
+
+// Function to compare two buckets for qsort, the largest first
+static int compare_buckets(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x < y) - (x > y);
+}
+
+
+// Function to find a seed that sends every key of a bucket to an empty entry, marks the entries in taken and returns the seed or -1
+static int64_t place_bucket(const uint64_t *hashes, const uint32_t *keys, uint32_t size, uint32_t count, uint8_t *taken, uint32_t *placed) {
+    for (uint32_t seed = 0; seed < RESERVATION_MAX_SEED; seed++) {
+        uint32_t k;
+        for (k = 0; k < size; k++) {
+            uint32_t entry = reservation_entry(hashes[keys[k]], seed, count);
+            if (taken[entry])
+                break;
+            taken[entry] = 1;
+            placed[k] = entry;
+        }
+        if (k == size)
+            return seed;
+
+        while (k > 0)
+            taken[placed[--k]] = 0;
+    }
+    return -1;
+}
+
+
+// Function to build the perfect hash of a list of reservations, returns NULL if a client or an address is reserved twice
+// Buckets are placed from the largest down, each one tries seeds until all its keys land on entries still empty
+static reservation_table_t *build_reservation_table(const reservation_t *list, uint32_t count) {
+    reservation_table_t *table = (reservation_table_t *)calloc(1, sizeof(reservation_table_t));
+    if (table == NULL)
+        return NULL;
+    table->count = count;
+    table->bucket_count = count / RESERVATION_BUCKET_SIZE + 1;
+    table->seeds = (uint32_t *)calloc(table->bucket_count, sizeof(uint32_t));
+    table->entries = (reservation_t *)calloc(count + 1, sizeof(reservation_t));
+    table->addresses = (uint32_t *)calloc(count + 1, sizeof(uint32_t));
+
+    uint64_t *hashes = (uint64_t *)malloc((count + 1) * sizeof(uint64_t));
+    uint32_t *bucket_first = (uint32_t *)calloc(table->bucket_count + 1, sizeof(uint32_t));
+    uint32_t *bucket_fill = (uint32_t *)malloc(table->bucket_count * sizeof(uint32_t));
+    uint32_t *keys = (uint32_t *)malloc((count + 1) * sizeof(uint32_t));          // Keys grouped by bucket
+    uint64_t *order = (uint64_t *)malloc(table->bucket_count * sizeof(uint64_t)); // Size << 32 | bucket
+    uint8_t *taken = (uint8_t *)calloc(count + 1, 1);
+    uint32_t *placed = (uint32_t *)malloc((count + 1) * sizeof(uint32_t));
+    int failed = table->seeds == NULL || table->entries == NULL || table->addresses == NULL || hashes == NULL || bucket_first == NULL ||
+                 bucket_fill == NULL || keys == NULL || order == NULL || taken == NULL || placed == NULL;
+    if (failed)
+        printf(RED "Failed to allocate memory for the reservations.\n" RESET);
+
+    // Every address may be reserved once
+    if (!failed) {
+        for (uint32_t k = 0; k < count; k++)
+            table->addresses[k] = list[k].ip_address;
+        qsort(table->addresses, count, sizeof(uint32_t), compare_addresses);
+        for (uint32_t k = 1; k < count && !failed; k++) {
+            if (table->addresses[k] == table->addresses[k - 1]) {
+                char ip_buffer[IP_ADDRESS_SIZE];
+                int_to_ip(table->addresses[k], ip_buffer);
+                printf(RED "The address %s is reserved twice\n" RESET, ip_buffer);
+                failed = 1;
+            }
+        }
+    }
+
+    // Group the keys by bucket with a counting sort
+    if (!failed) {
+        for (uint32_t k = 0; k < count; k++) {
+            hashes[k] = hash_reservation_key(list[k].client_id, list[k].client_id_len);
+            bucket_first[reservation_bucket(hashes[k], table->bucket_count) + 1]++;
+        }
+        for (uint32_t b = 0; b < table->bucket_count; b++) {
+            order[b] = (uint64_t)bucket_first[b + 1] << 32 | b;
+            bucket_first[b + 1] += bucket_first[b];
+            bucket_fill[b] = bucket_first[b];
+        }
+        for (uint32_t k = 0; k < count; k++)
+            keys[bucket_fill[reservation_bucket(hashes[k], table->bucket_count)]++] = k;
+        qsort(order, table->bucket_count, sizeof(uint64_t), compare_buckets);
+    }
+
+    // The largest buckets go first, while most entries are still empty, a client reserved twice would never find a seed
+    for (uint32_t o = 0; o < table->bucket_count && !failed; o++) {
+        uint32_t bucket = (uint32_t)order[o];
+        uint32_t size = (uint32_t)(order[o] >> 32);
+        if (size == 0)
+            break;
+
+        const uint32_t *bucket_keys = &keys[bucket_first[bucket]];
+        for (uint32_t i = 1; i < size && !failed; i++) {
+            for (uint32_t j = 0; j < i && !failed; j++) {
+                const reservation_t *a = &list[bucket_keys[i]], *b = &list[bucket_keys[j]];
+                if (a->client_id_len == b->client_id_len && memcmp(a->client_id, b->client_id, a->client_id_len) == 0) {
+                    printf(RED "A client is reserved twice\n" RESET);
+                    failed = 1;
+                }
+            }
+        }
+
+        int64_t seed = failed ? -1 : place_bucket(hashes, bucket_keys, size, count, taken, placed);
+        if (seed < 0) {
+            if (!failed)
+                printf(RED "No seed places every key of a bucket of the reservations\n" RESET);
+            failed = 1;
+            break;
+        }
+
+        table->seeds[bucket] = (uint32_t)seed;
+        for (uint32_t k = 0; k < size; k++)
+            table->entries[placed[k]] = list[bucket_keys[k]];
+    }
+
+    free(hashes);
+    free(bucket_first);
+    free(bucket_fill);
+    free(keys);
+    free(order);
+    free(taken);
+    free(placed);
+    if (failed) {
+        free_reservation_table(table);
+        return NULL;
+    }
+    return table;
+}
+
+
+// Function to read the reservations file, one reservation per line: client_id ip_address
+// Returns the reservations in a new array and their number in count, or NULL on error
+static reservation_t *read_reservations_file(const char *path, uint32_t *count) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf(RED "Failed to open the reservations file %s\n" RESET, path);
+        return NULL;
+    }
+
+    uint32_t capacity = 64;
+    reservation_t *list = (reservation_t *)malloc(capacity * sizeof(reservation_t));
+    *count = 0;
+
+    char line[MAX_CHARACTERS_PATH];
+    int line_number = 0;
+    while (list != NULL && fgets(line, sizeof(line), file)) {
+        line_number++;
+
+        char *text = line + strspn(line, " \t");
+        if (*text == '#' || *text == '\n' || *text == '\0')
+            continue; // Comment or empty line
+
+        char client_id[4 * CLIENT_ID_SIZE], ip_text[IP_ADDRESS_SIZE];
+        struct in_addr address;
+        reservation_t reservation;
+        memset(&reservation, 0, sizeof(reservation));
+        int length = sscanf(text, "%63s %15s", client_id, ip_text) == 2 ? parse_client_id(client_id, reservation.client_id) : -1;
+        if (length < 0 || inet_pton(AF_INET, ip_text, &address) != 1 || *count == MAX_RESERVATIONS) {
+            printf(RED "Error in line %d of the reservations file %s\n" RESET, line_number, path);
+            free(list);
+            list = NULL;
+            break;
+        }
+        reservation.client_id_len = (uint8_t)length;
+        reservation.ip_address = ntohl(address.s_addr);
+
+        if (*count == capacity) {
+            capacity *= 2;
+            reservation_t *grown = (reservation_t *)realloc(list, capacity * sizeof(reservation_t));
+            if (grown == NULL) {
+                printf(RED "Failed to allocate memory for the reservations.\n" RESET);
+                free(list);
+                list = NULL;
+                break;
+            }
+            list = grown;
+        }
+        list[(*count)++] = reservation;
+    }
+
+    fclose(file);
+    return list;
+}
+
+
+// Function to load the reservations file, at startup and on every reload, returns -1 if the file is not valid
+// A file that fails to load leaves the reservations in force as they were
+int load_reservations() {
+    if (strlen(reservations_file) == 0)
+        return 0;
+
+    uint32_t count;
+    reservation_t *list = read_reservations_file(reservations_file, &count);
+    if (list == NULL)
+        return -1;
+    reservation_table_t *table = build_reservation_table(list, count);
+    free(list);
+    if (table == NULL) {
+        printf(RED "The reservations of %s were not loaded.\n" RESET, reservations_file);
+        return -1;
+    }
+
+    // The new addresses leave the pool before the new table is published, the addresses only the old table kept come back after
+    for (uint32_t e = 0; e < table->count; e++)
+        set_ip_reserved(table->entries[e].ip_address, 1);
+    reservation_table_t *old = atomic_exchange(&reservation_table, table);
+    for (uint32_t e = 0; old != NULL && e < old->count; e++) {
+        if (!table_reserves(table, old->entries[e].ip_address))
+            set_ip_reserved(old->entries[e].ip_address, 0);
+    }
+
+    free_reservation_table(retired_table);
+    retired_table = old;
+
+    printf(GREEN "Reservations loaded from %s: %u\n" RESET, reservations_file, table->count);
+    return 0;
+}
+
+
+// Function to find the address reserved for a client, returns 0 if the client has no reservation
+// One read of the seed of the bucket and one of the entry, the entry is then checked against the client
+uint32_t find_reservation(const uint8_t *client_id, int client_id_len) {
+    reservation_table_t *table = atomic_load(&reservation_table);
+    if (table == NULL || table->count == 0)
+        return 0;
+
+    uint64_t hash = hash_reservation_key(client_id, client_id_len);
+    uint32_t seed = table->seeds[reservation_bucket(hash, table->bucket_count)];
+    const reservation_t *entry = &table->entries[reservation_entry(hash, seed, table->count)];
+    if (entry->client_id_len != client_id_len || memcmp(entry->client_id, client_id, client_id_len) != 0)
+        return 0;
+    return entry->ip_address;
+}
@@ -0,0 +1,38 @@
+#ifndef RESERVATION_H
+#define RESERVATION_H
+
+#include <stdint.h>
+
+#include "../data/ip_pool.h" // For CLIENT_ID_SIZE
+
+#define MAX_RESERVATIONS 1000000  // Most reservations a reservations file may declare
+#define RESERVATION_BUCKET_SIZE 4  // Average keys per bucket of the perfect hash, fewer buckets take longer to build
+#define RESERVATION_MAX_SEED 1000000  // Seeds tried for a bucket before the build gives up
+
+
+// Address reserved for a client, given by its MAC address or client identifier
+typedef struct {
+    uint8_t client_id[CLIENT_ID_SIZE];
+    uint8_t client_id_len;
+    uint32_t ip_address;  // Host order
+} reservation_t;
+
+// Minimal perfect hash over the client identifiers of the reservations (hash and displace)
+// The hash of a client picks a bucket, the seed of the bucket moves every key of the bucket to its own entry
+typedef struct {
+    uint32_t count;
+    uint32_t bucket_count;
+    uint32_t* seeds;          // Seed of each bucket
+    reservation_t* entries;   // count entries, each reservation in the entry its seeded hash gives
+    uint32_t* addresses;      // The reserved addresses in ascending order
+} reservation_table_t;
+
+
+// Function to load the reservations file, at startup and on every reload, returns -1 if the file is not valid
+// A file that fails to load leaves the reservations in force as they were
+int load_reservations();
+
+// Function to find the address reserved for a client, returns 0 if the client has no reservation
+uint32_t find_reservation(const uint8_t *client_id, int client_id_len);
+
+#endif
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h> // For inet_pton()
+
+#include "./scope.h"
+#include "./env.h"
+#include "../data/ip_pool.h" // For the default LEASE_TIME
+
+scope_t* scopes = NULL;
+int scope_count = 0;
+scope_t* local_scope = NULL;
+
+// Prefix trie over the subnets of the scopes, node 0 is the root and covers the first octet
+static lpm_node_t* lpm_nodes = NULL;
+static int lpm_node_count = 0;
+static int lpm_node_capacity = 0;
+
+
+// Function to parse an address in text format, returns -1 if it is not valid
+static int parse_address(const char *text, uint32_t *address) {
+    struct in_addr parsed;
+    if (inet_pton(AF_INET, text, &parsed) != 1)
+        return -1;
+    *address = ntohl(parsed.s_addr);
+    return 0;
+}
+
+
+// Function to get the prefix length of a subnet mask, returns -1 if its bits are not contiguous
+static int mask_to_prefix(uint32_t mask) {
+    int length = __builtin_popcount(mask);
+    uint32_t expected = length == 0 ? 0 : ~0u << (32 - length);
+    return mask == expected ? length : -1;
+}
+
+
+// Function to add an empty node to the trie, returns its index or -1 if there is no memory
+static int new_lpm_node() {
+    if (lpm_node_count == lpm_node_capacity) {
+        int capacity = lpm_node_capacity ? lpm_node_capacity * 2 : 16;
+        lpm_node_t *nodes = (lpm_node_t*)realloc(lpm_nodes, capacity * sizeof(lpm_node_t));
+        if (nodes == NULL)
+            return -1;
+        lpm_nodes = nodes;
+        lpm_node_capacity = capacity;
+    }
+
+    lpm_node_t *node = &lpm_nodes[lpm_node_count];
+    for (int i = 0; i < LPM_FANOUT; i++) {
+        node->child[i] = -1;
+        node->scope[i] = -1;
+        node->length[i] = 0;
+    }
+    return lpm_node_count++;
+}
+
+
+// Function to add the subnet of a scope to the trie
+// A prefix that ends inside a level is expanded to every entry it covers, unless a longer prefix already owns the entry
+static int insert_lpm_prefix(uint32_t network, int length, int scope) {
+    int node = 0;
+    int level = length == 0 ? 0 : (length - 1) / LPM_STRIDE;
+
+    for (int l = 0; l < level; l++) {
+        int entry = (network >> (32 - LPM_STRIDE * (l + 1))) & (LPM_FANOUT - 1);
+        if (lpm_nodes[node].child[entry] < 0) {
+            int child = new_lpm_node();
+            if (child < 0)
+                return -1;
+            lpm_nodes[node].child[entry] = child;
+        }
+        node = lpm_nodes[node].child[entry];
+    }
+
+    int bits = length - LPM_STRIDE * level; // Bits of the prefix that fall in this level
+    int first = (network >> (32 - LPM_STRIDE * (level + 1))) & (LPM_FANOUT - 1) & ~((1 << (LPM_STRIDE - bits)) - 1);
+    for (int entry = first; entry < first + (1 << (LPM_STRIDE - bits)); entry++) {
+        if (lpm_nodes[node].scope[entry] < 0 || lpm_nodes[node].length[entry] <= length) {
+            lpm_nodes[node].scope[entry] = (int16_t)scope;
+            lpm_nodes[node].length[entry] = (uint8_t)length;
+        }
+    }
+    return 0;
+}
+
+
+// Function to find the scope whose subnet is the longest prefix of an address, returns NULL if none covers it
+// One memory access per octet of the address at most
+scope_t* find_scope(uint32_t address) {
+    if (lpm_nodes == NULL)
+        return NULL;
+
+    int best = -1;
+    int node = 0;
+    for (int level = 0; level < 32 / LPM_STRIDE && node >= 0; level++) {
+        int entry = (address >> (32 - LPM_STRIDE * (level + 1))) & (LPM_FANOUT - 1);
+        if (lpm_nodes[node].scope[entry] >= 0)
+            best = lpm_nodes[node].scope[entry];
+        node = lpm_nodes[node].child[entry];
+    }
+
+    return best >= 0 ? &scopes[best] : NULL;
+}
+
+
+// Function to check the fields of a scope and add it to the table
+static int add_scope(const char *range, const char *mask_text, const char *dns_text, int lease_time) {
+    char start_ip[IP_ADDRESS_SIZE], end_ip[IP_ADDRESS_SIZE];
+    uint32_t start, end, mask, dns;
+
+    if (sscanf(range, "%15[^-]-%15s", start_ip, end_ip) != 2 || parse_address(start_ip, &start) != 0 || parse_address(end_ip, &end) != 0 ||
+        parse_address(mask_text, &mask) != 0 || parse_address(dns_text, &dns) != 0) {
+        printf(RED "Invalid scope %s %s %s\n" RESET, range, mask_text, dns_text);
+        return -1;
+    }
+
+    int prefix_length = mask_to_prefix(mask);
+    if (prefix_length < 0 || start >= end || (start & mask) != (end & mask) || lease_time <= 0) {
+        printf(RED "Invalid scope %s: the range must lie in one subnet and the lease time must be positive\n" RESET, range);
+        return -1;
+    }
+
+    for (int i = 0; i < scope_count; i++) {
+        if (scopes[i].network == (start & mask) && scopes[i].prefix_length == prefix_length) {
+            printf(RED "Invalid scope %s: another scope already serves its subnet\n" RESET, range);
+            return -1;
+        }
+
+        // With nested subnets, the range of the wider one may not reach into the narrower one, its addresses would match the other scope
+        uint32_t last = (start & mask) | ~mask;
+        uint32_t other_last = scopes[i].network | ~scopes[i].subnet_mask;
+        if ((prefix_length < scopes[i].prefix_length && start <= other_last && end >= scopes[i].network) ||
+            (scopes[i].prefix_length < prefix_length && scopes[i].range_start <= last && scopes[i].range_end >= (start & mask))) {
+            printf(RED "Invalid scope %s: it overlaps another scope\n" RESET, range);
+            return -1;
+        }
+    }
+
+    if (scope_count == MAX_SCOPES) {
+        printf(RED "Too many scopes, at most %d are supported\n" RESET, MAX_SCOPES);
+        return -1;
+    }
+
+    scope_t *scope = &scopes[scope_count++];
+    memset(scope, 0, sizeof(*scope));
+    scope->range_start = start;
+    scope->range_end = end;
+    scope->network = start & mask;
+    scope->subnet_mask = mask;
+    scope->prefix_length = prefix_length;
+    scope->dns = dns;
+    scope->lease_time = lease_time;
+    return 0;
+}
+
+
+// Function to read the scopes file, one scope per line: range subnet_mask dns lease_time
+static int read_scopes_file(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf(RED "Failed to open the scopes file %s\n" RESET, path);
+        return -1;
+    }
+
+    char line[MAX_CHARACTERS_PATH];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+
+        char range[2 * IP_ADDRESS_SIZE], mask[IP_ADDRESS_SIZE], dns[IP_ADDRESS_SIZE];
+        int lease_time;
+        char *text = line + strspn(line, " \t");
+        if (*text == '#' || *text == '\n' || *text == '\0')
+            continue; // Comment or empty line
+
+        if (sscanf(text, "%31s %15s %15s %d", range, mask, dns, &lease_time) != 4 || add_scope(range, mask, dns, lease_time) != 0) {
+            printf(RED "Error in line %d of the scopes file %s\n" RESET, line_number, path);
+            fclose(file);
+            return -1;
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+
+// Function to load the scopes from SCOPES_FILE, or a single scope from IP_RANGE, SUBNET and DNS, returns -1 on error
+int load_scopes() {
+    scopes = (scope_t*)malloc(MAX_SCOPES * sizeof(scope_t));
+    if (scopes == NULL) {
+        printf(RED "Failed to allocate memory for the scopes.\n" RESET);
+        return -1;
+    }
+
+    int result = strlen(scopes_file) > 0 ? read_scopes_file(scopes_file) : add_scope(ip_range, global_subnet_mask, global_dns_ip, LEASE_TIME);
+    if (result != 0 || scope_count == 0) {
+        printf(RED "No scope to serve.\n" RESET);
+        return -1;
+    }
+
+    // The trie starts with its root, then every subnet goes in
+    if (new_lpm_node() < 0)
+        return -1;
+    for (int i = 0; i < scope_count; i++) {
+        if (insert_lpm_prefix(scopes[i].network, scopes[i].prefix_length, i) != 0) {
+            printf(RED "Failed to allocate memory for the scope trie.\n" RESET);
+            return -1;
+        }
+    }
+
+    // Clients without a relay belong to the subnet of the address the server listens on, or to the first scope
+    uint32_t listen_address;
+    if (strlen(server_ip) > 0 && parse_address(server_ip, &listen_address) == 0)
+        local_scope = find_scope(listen_address);
+    if (local_scope == NULL)
+        local_scope = &scopes[0];
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef SCOPE_H
+#define SCOPE_H
+
+#include <stdint.h>
+
+#define MAX_SCOPES 4096  // Most scopes a scopes file may declare
+#define LPM_STRIDE 8     // Bits of the address consumed by each level of the prefix trie
+#define LPM_FANOUT (1 << LPM_STRIDE)
+
+
+// Subnet served by the server, every address is in host order
+typedef struct {
+    uint32_t range_start;  // First address of the range, it is the gateway and is never leased
+    uint32_t range_end;    // Last address of the range
+    uint32_t network;      // Subnet the range belongs to, relays on it are matched against it
+    uint32_t subnet_mask;
+    int prefix_length;
+    uint32_t dns;
+    int lease_time;        // Seconds
+
+    // Place of the scope in the pool, filled by init_ip_pool
+    int first_index;       // Entry of ip_pool holding range_start, always a multiple of 64
+    int first_shard;
+    int shard_count;
+    int shard_entries;
+    int own_first;         // Entries own_first to own_end - 1 are the part of the range this server hands out, the whole range without load balancing
+    int own_end;
+    int own_first_shard;   // Shards holding that part, new clients are only placed in them
+    int own_shard_count;
+} scope_t;
+
+// Node of the multibit prefix trie, each level consumes LPM_STRIDE bits of the address
+typedef struct {
+    int32_t child[LPM_FANOUT];   // Next level, -1 if no longer prefix goes through this entry
+    int16_t scope[LPM_FANOUT];   // Longest prefix that ends at this level and covers this entry, -1 if none
+    uint8_t length[LPM_FANOUT];  // Length of that prefix, a longer prefix overwrites a shorter one
+} lpm_node_t;
+
+extern scope_t* scopes;
+extern int scope_count;
+extern scope_t* local_scope;  // Scope of the clients that reach the server without a relay
+
+
+// Function to load the scopes from SCOPES_FILE, or a single scope from IP_RANGE, SUBNET and DNS, returns -1 on error
+int load_scopes();
+
+// Function to find the scope whose subnet is the longest prefix of an address, returns NULL if none covers it
+scope_t* find_scope(uint32_t address);
+
+#endif
@@ -4,13 +4,385 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>    // Para usar time_t
+#include <pthread.h> // To protect the pool from concurrent workers
+#include <stdatomic.h> // For the free address bitmap
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h> // To use the pool file as the working pool
 
 #include "../config/env.h"
+#include "../utils/utils.h"
+#include "./timing_wheel.h"
+#include "./lease_journal.h"
+#include "./lease_replication.h"
 
-// Define the IP pool as a pointer so it can be dynamic
-ip_pool_entry_t* ip_pool = NULL;
+// Define the IP pool as arrays so it can be dynamic, the address of an entry follows from its scope and is never stored
+uint32_t* lease_expiry = NULL;
+uint32_t* client_slot = NULL;
 int pool_size = 0;
-char gateway_ip[16];  // Gateway IP address (it will be the first IP in the range)
+char gateway_ip[16];  // Gateway IP address of the local scope (the first IP of its range)
+
+// Free address bitmap, bit i of the bitmap is set while entry i is free, it is the state of every entry of the pool
+// Bit w of the summary is set while word w of the bitmap may have a free bit, so large pools skip full words quickly
+_Atomic uint64_t* free_bitmap = NULL;
+_Atomic uint64_t* free_summary = NULL;
+int bitmap_words = 0;
+
+// An entry taken out of the free bitmap is either offered or bound, bit i of offered_bitmap is set while entry i is only offered
+// Offers are held for OFFER_HOLD_TIME in the timing wheel of their shard, so a DISCOVER flood only holds addresses for a few seconds
+_Atomic uint64_t* offered_bitmap = NULL;
+uint32_t* offer_xid = NULL;  // Transaction of the offer of each entry, the REQUEST that binds it must carry the same one
+
+// Reserved entries stay out of the free bitmap and have no binding, their clients are served from the reservation table
+_Atomic uint64_t* reserved_bitmap = NULL;
+int summary_words = 0;
+
+// Every scope is split in shards of consecutive entries, each one behind its own lock
+// A client is served by the home shard of its scope, picked from the hash of its identifier, and only steals from the other shards of the scope when it is full
+pool_shard_t* pool_shards = NULL;
+int pool_shard_count = 0;
+int* word_shard = NULL;  // Shard owning each word of the bitmap, shards always own whole words
+uint32_t binding_total = 0;  // Slots reserved for the binding tables of every shard together
+uint32_t* binding_capacities = NULL;  // Slots in use of the binding table of each shard, in the pool file when there is one
+// A binding table starts small and doubles inside the slots reserved for it, so only the slots of the clients seen are ever touched
+// The bindings are moved through the scratch while a table grows, it is reserved at startup so growing never allocates
+client_binding_t* binding_scratch = NULL;
+pthread_mutex_t binding_scratch_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Bindings stored outside the home shard of their client, lookups only visit other shards while there are any
+// The count lives in the pool file when there is one, so it survives a restart that maps the file again
+static atomic_int heap_foreign_bindings = 0;
+atomic_int* foreign_bindings = &heap_foreign_bindings;
+
+// Mapping of the pool file when POOL_FILE is set, NULL when the pool lives on the heap
+uint8_t* pool_mapping = NULL;
+size_t pool_mapping_size = 0;
+
+
+// Function to get the shard that owns an entry of the pool
+static pool_shard_t *shard_of_index(int index) {
+    return &pool_shards[word_shard[index / 64]];
+}
+
+
+// Function to get the home shard of a client in a scope from the hash of its identifier, among the shards of the part of this server
+static int home_shard(const scope_t *scope, uint32_t hash) {
+    return scope->own_first_shard + (int)(((uint64_t)hash * (uint64_t)scope->own_shard_count) >> 32);
+}
+
+
+// Function to get the k-th shard of the part of a scope this server hands out counting from a given one, wrapping around inside it
+static pool_shard_t *scope_shard(const scope_t *scope, int from, int k) {
+    return &pool_shards[scope->own_first_shard + (from - scope->own_first_shard + k) % scope->own_shard_count];
+}
+
+
+// Function to mark an entry of the pool as free in the bitmap, whether it was offered or bound
+static void mark_ip_free(int index) {
+    int word = index / 64;
+    atomic_fetch_and(&offered_bitmap[word], ~(1ULL << (index % 64)));
+    atomic_fetch_or(&free_bitmap[word], 1ULL << (index % 64));
+    atomic_fetch_or(&free_summary[word / 64], 1ULL << (word % 64));
+}
+
+
+// Function to take a specific entry out of the bitmap, the summary bit is left for claim_free_ip to clear lazily
+static void mark_ip_used(int index) {
+    atomic_fetch_and(&free_bitmap[index / 64], ~(1ULL << (index % 64)));
+}
+
+
+// Function to check if an entry of the pool is leased, gateways and padding never have their bit set
+static int is_assigned(int index) {
+    return (atomic_load(&free_bitmap[index / 64]) & (1ULL << (index % 64))) == 0;
+}
+
+
+// Function to check if an entry of the pool is only offered to its client
+static int is_offered(int index) {
+    return (atomic_load(&offered_bitmap[index / 64]) & (1ULL << (index % 64))) != 0;
+}
+
+
+// Function to check if an entry of the pool is kept for a reservation
+static int is_reserved(int index) {
+    return (atomic_load(&reserved_bitmap[index / 64]) & (1ULL << (index % 64))) != 0;
+}
+
+
+// Function to check if an entry of the pool is bound to its client
+static int is_bound(int index) {
+    return is_assigned(index) && !is_offered(index);
+}
+
+
+// Function to mark the entries first to end - 1 as free, a word of the bitmap at a time
+static void mark_range_free(int first, int end) {
+    for (int i = first; i < end;) {
+        int word = i / 64;
+        int bits = end - i < 64 - i % 64 ? end - i : 64 - i % 64;
+        uint64_t mask = (bits == 64 ? ~0ULL : (1ULL << bits) - 1) << (i % 64);
+
+        atomic_fetch_or(&free_bitmap[word], mask);
+        atomic_fetch_or(&free_summary[word / 64], 1ULL << (word % 64));
+        i += bits;
+    }
+}
+
+
+// Function to get the address of an entry of the pool
+static uint32_t index_to_ip(int index) {
+    const scope_t *scope = shard_of_index(index)->scope;
+    return scope->range_start + (uint32_t)(index - scope->first_index);
+}
+
+
+// Function to fill the lease of an entry as the journal and for_each_binding see it
+// Only the expiry is kept, so the lease is described as one full lease time of the scope ending then
+static void describe_lease(int index, lease_info_t *lease) {
+    const scope_t *scope = shard_of_index(index)->scope;
+    lease->ip_address = index_to_ip(index);
+    lease->is_assigned = is_bound(index);
+    lease->lease_duration = scope->lease_time;
+    lease->lease_start = (time_t)LEASE_EPOCH + lease_expiry[index] - scope->lease_time;
+}
+
+
+// Function to take the first free entry of a shard out of the bitmap, returns its index or -1 if the shard is full
+// Summary words may be shared with the neighbouring shards, so the bitmap keeps its atomic updates
+static int claim_free_ip(pool_shard_t *shard) {
+    int first_word = shard->first / 64;
+    int end_word = (shard->end + 63) / 64;
+
+    for (int s = first_word / 64; s <= (end_word - 1) / 64; s++) {
+        uint64_t summary = atomic_load(&free_summary[s]);
+
+        // Ignore the words of the summary that belong to other shards
+        if (s == first_word / 64)
+            summary &= ~0ULL << (first_word % 64);
+        if (s == (end_word - 1) / 64 && end_word % 64 != 0)
+            summary &= ~(~0ULL << (end_word % 64));
+
+        while (summary) {
+            int word = s * 64 + __builtin_ctzll(summary);
+            uint64_t bits = atomic_load(&free_bitmap[word]);
+
+            while (bits) {
+                uint64_t bit = bits & -bits; // Lowest free bit of the word
+                bits = atomic_fetch_and(&free_bitmap[word], ~bit);
+
+                if (bits & bit) {
+                    // The word became full, take it out of the summary and check that no release slipped in meanwhile
+                    if ((bits & ~bit) == 0) {
+                        atomic_fetch_and(&free_summary[s], ~(1ULL << (word % 64)));
+                        if (atomic_load(&free_bitmap[word]) != 0)
+                            atomic_fetch_or(&free_summary[s], 1ULL << (word % 64));
+                    }
+                    return word * 64 + __builtin_ctzll(bit);
+                }
+
+                bits &= ~bit; // Someone else took it, try the next free bit of the same word
+            }
+
+            summary &= summary - 1; // The word had no free bit left, go on with the next one
+        }
+    }
+
+    return -1;
+}
+
+// Function to hash a client identifier (FNV-1a)
+static uint32_t hash_client_id(const uint8_t *client_id, int client_id_len) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < client_id_len; i++) {
+        hash ^= client_id[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+// Function to find the slot of a client in the binding table of a shard, returns -1 if the client has no binding there
+static int find_binding_slot(pool_shard_t *shard, const uint8_t *client_id, int client_id_len, uint32_t hash) {
+    uint32_t mask = shard->binding_capacity - 1;
+
+    for (uint32_t slot = hash & mask; shard->bindings[slot].lease_index != 0; slot = (slot + 1) & mask) {
+        client_binding_t *binding = &shard->bindings[slot];
+        if (binding->hash == hash && binding->client_id_len == client_id_len && memcmp(binding->client_id, client_id, client_id_len) == 0)
+            return (int)slot;
+    }
+
+    return -1;
+}
+
+
+// Function to empty a slot of the binding table, the entries after it are shifted back so probing never needs tombstones
+static void remove_binding_slot(pool_shard_t *shard, uint32_t slot) {
+    uint32_t mask = shard->binding_capacity - 1;
+    uint32_t hole = slot;
+
+    if (shard->bindings[slot].foreign)
+        atomic_fetch_sub(foreign_bindings, 1);
+
+    for (uint32_t next = (slot + 1) & mask; shard->bindings[next].lease_index != 0; next = (next + 1) & mask) {
+        uint32_t home = shard->bindings[next].hash & mask;
+
+        // The entry may fill the hole only if the hole lies between its home slot and where it is now
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            shard->bindings[hole] = shard->bindings[next];
+            client_slot[shard->bindings[hole].lease_index] = hole + 1;
+            hole = next;
+        }
+    }
+
+    shard->bindings[hole].lease_index = 0;
+    shard->binding_count--;
+}
+
+
+// Function to double the binding table of a shard, the shard must be locked
+// Every binding is moved out to the scratch and probed again with the new mask, within the slots reserved for the table
+static void grow_binding_table(pool_shard_t *shard) {
+    pthread_mutex_lock(&binding_scratch_mutex);
+
+    uint32_t moved = 0;
+    for (uint32_t slot = 0; slot < shard->binding_capacity; slot++) {
+        if (shard->bindings[slot].lease_index != 0) {
+            binding_scratch[moved++] = shard->bindings[slot];
+            shard->bindings[slot].lease_index = 0;
+        }
+    }
+
+    shard->binding_capacity <<= 1;
+    binding_capacities[shard - pool_shards] = shard->binding_capacity;
+
+    uint32_t mask = shard->binding_capacity - 1;
+    for (uint32_t m = 0; m < moved; m++) {
+        uint32_t slot = binding_scratch[m].hash & mask;
+        while (shard->bindings[slot].lease_index != 0)
+            slot = (slot + 1) & mask;
+        shard->bindings[slot] = binding_scratch[m];
+        client_slot[binding_scratch[m].lease_index] = slot + 1;
+    }
+
+    pthread_mutex_unlock(&binding_scratch_mutex);
+}
+
+
+// Function to bind a client to an entry of the shard, the previous client of that entry loses its binding
+static void bind_client(pool_shard_t *shard, int index, const uint8_t *client_id, int client_id_len, uint32_t hash) {
+    if (client_slot[index] != 0)
+        remove_binding_slot(shard, client_slot[index] - 1);
+
+    int slot = find_binding_slot(shard, client_id, client_id_len, hash);
+    if (slot >= 0) {
+        // The client moves to a new address, its old address keeps no client
+        client_slot[shard->bindings[slot].lease_index] = 0;
+    } else {
+        // The table is kept at most half full, the slots reserved for it are enough for a client on every address
+        if (2 * (shard->binding_count + 1) > shard->binding_capacity && shard->binding_capacity < shard->binding_limit)
+            grow_binding_table(shard);
+
+        uint32_t mask = shard->binding_capacity - 1;
+        slot = (int)(hash & mask);
+        while (shard->bindings[slot].lease_index != 0)
+            slot = (slot + 1) & mask;
+
+        client_binding_t *binding = &shard->bindings[slot];
+        binding->hash = hash;
+        binding->client_id_len = (uint8_t)client_id_len;
+        memcpy(binding->client_id, client_id, client_id_len);
+        binding->foreign = &pool_shards[home_shard(shard->scope, hash)] != shard;
+        if (binding->foreign)
+            atomic_fetch_add(foreign_bindings, 1);
+        shard->binding_count++;
+    }
+
+    shard->bindings[slot].lease_index = index;
+    client_slot[index] = (uint32_t)slot + 1;
+}
+
+
+// Function to find the shard of a scope holding the binding of a client, returns it locked with the slot in slot_out, or NULL if the client has no binding
+// The home shard is looked up first, the others only while some client had to steal an address
+static pool_shard_t *lock_client_binding(const scope_t *scope, const uint8_t *client_id, int client_id_len, uint32_t hash, int *slot_out) {
+    int home = home_shard(scope, hash);
+
+    for (int k = 0; k < scope->own_shard_count; k++) {
+        if (k > 0 && atomic_load(foreign_bindings) == 0)
+            break;
+
+        pool_shard_t *shard = scope_shard(scope, home, k);
+        pthread_mutex_lock(&shard->mutex);
+        int slot = find_binding_slot(shard, client_id, client_id_len, hash);
+        if (slot >= 0) {
+            *slot_out = slot;
+            return shard;
+        }
+        pthread_mutex_unlock(&shard->mutex);
+    }
+
+    return NULL;
+}
+
+
+// Function to drop the bindings a client left in the other shards of the scope of keep, so that its next lookup finds the current one
+static void drop_stale_bindings(const uint8_t *client_id, int client_id_len, uint32_t hash, pool_shard_t *keep) {
+    const scope_t *scope = keep->scope;
+    int home = home_shard(scope, hash);
+
+    for (int k = 0; k < scope->own_shard_count; k++) {
+        if (k > 0 && atomic_load(foreign_bindings) == 0)
+            break;
+
+        pool_shard_t *shard = scope_shard(scope, home, k);
+        if (shard == keep)
+            continue;
+
+        pthread_mutex_lock(&shard->mutex);
+        int slot = find_binding_slot(shard, client_id, client_id_len, hash);
+        if (slot >= 0) {
+            int index = shard->bindings[slot].lease_index;
+            if (!is_bound(index)) {
+                client_slot[index] = 0;
+                remove_binding_slot(shard, (uint32_t)slot);
+            }
+        }
+        pthread_mutex_unlock(&shard->mutex);
+    }
+}
+
+
+// Function to record a change of a lease in the journal and in the stream to the standby, neither waits for the disk or the network
+static void record_lease_change(lease_record_type_t type, uint32_t ip, const uint8_t *client_id, int client_id_len, time_t lease_start, int lease_duration) {
+    lease_journal_append(type, ip, client_id, client_id_len, lease_start, lease_duration);
+    lease_replication_append(type, ip, client_id, client_id_len, lease_start, lease_duration);
+}
+
+
+// Function to hold an entry taken out of the bitmap for the REQUEST of its client, the shard of the entry must be locked
+static void hold_offer(pool_shard_t *shard, int i, uint32_t xid) {
+    time_t expiry = time(NULL) + OFFER_HOLD_TIME;
+
+    atomic_fetch_or(&offered_bitmap[i / 64], 1ULL << (i % 64));
+    offer_xid[i] = xid;
+    lease_expiry[i] = (uint32_t)(expiry - LEASE_EPOCH);  // Record when the hold ends
+    timing_wheel_schedule(&shard->wheel, i - shard->first, (uint64_t)expiry);
+}
+
+
+// Function to start the lease of an entry taken out of the bitmap, the shard of the entry must be locked
+static time_t start_lease(pool_shard_t *shard, int i) {
+    // Assign IP in the DHCP Request/Ack phase
+    time_t current_time = time(NULL);  // Get the current time
+
+    time_t expiry = current_time + shard->scope->lease_time;
+    atomic_fetch_and(&offered_bitmap[i / 64], ~(1ULL << (i % 64)));
+    lease_expiry[i] = (uint32_t)(expiry - LEASE_EPOCH);  // Record when the lease ends
+    timing_wheel_schedule(&shard->wheel, i - shard->first, (uint64_t)expiry);
+    return current_time;
+}
+
 
 // Function to calculate the size of the IP pool based on the dynamic range
 int calculate_pool_size(char* start_ip, char* end_ip) {
@@ -19,61 +391,331 @@ int calculate_pool_size(char* start_ip, char* end_ip) {
     return (end - start + 1);  // The pool size is the difference between the start and end IP
 }
 
-// Function to convert an IP in text format to an integer
-unsigned int ip_to_int(const char* ip) {
-    unsigned int a, b, c, d;
-    sscanf(ip, "%u.%u.%u.%u", &a, &b, &c, &d);
-    return (a << 24) | (b << 16) | (c << 8) | d;
+// Function to round an offset of the pool file up to a cache line
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + 63) & ~(uint64_t)63;
+}
+
+
+// Function to hash the ranges of the scopes and the part this server hands out (FNV-1a), a pool file laid out for other ranges does not match it
+static uint32_t hash_scopes() {
+    uint32_t hash = 2166136261u;
+    for (int s = 0; s < scope_count; s++) {
+        uint32_t range[4] = { scopes[s].range_start, scopes[s].range_end, (uint32_t)lb_index, (uint32_t)lb_server_count };
+        const uint8_t *bytes = (const uint8_t *)range;
+        for (size_t i = 0; i < sizeof(range); i++) {
+            hash ^= bytes[i];
+            hash *= 16777619u;
+        }
+    }
+    return hash;
 }
 
-// Function to convert an integer to an IP in text format
-void int_to_ip(unsigned int ip, char* buffer) {
-    sprintf(buffer, "%u.%u.%u.%u", (ip >> 24) & 0xFF, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF);
+
+// Function to fill the header of the pool file with the layout of the current pool, file offsets included
+static void describe_pool_layout(pool_file_header_t *header) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, POOL_FILE_MAGIC, sizeof(header->magic));
+    header->version = POOL_FILE_VERSION;
+    header->header_size = sizeof(pool_file_header_t);
+    header->scopes_hash = hash_scopes();
+    header->pool_size = pool_size;
+    header->scope_count = scope_count;
+    header->shard_count = pool_shard_count;
+    header->binding_size = sizeof(client_binding_t);
+
+    header->shards_offset = align_offset(sizeof(pool_file_header_t));
+    header->expiries_offset = align_offset(header->shards_offset + (uint64_t)pool_shard_count * sizeof(pool_file_shard_t));
+    header->client_slots_offset = align_offset(header->expiries_offset + (uint64_t)pool_size * sizeof(uint32_t));
+    header->bitmap_offset = align_offset(header->client_slots_offset + (uint64_t)pool_size * sizeof(uint32_t));
+    header->summary_offset = align_offset(header->bitmap_offset + (uint64_t)bitmap_words * sizeof(uint64_t));
+    header->offered_offset = align_offset(header->summary_offset + (uint64_t)summary_words * sizeof(uint64_t));
+    header->reserved_offset = align_offset(header->offered_offset + (uint64_t)bitmap_words * sizeof(uint64_t));
+    header->bindings_offset = align_offset(header->reserved_offset + (uint64_t)bitmap_words * sizeof(uint64_t));
+    header->foreign_offset = align_offset(header->bindings_offset + (uint64_t)binding_total * sizeof(client_binding_t));
+    header->capacities_offset = align_offset(header->foreign_offset + sizeof(int32_t));
+    header->file_size = align_offset(header->capacities_offset + (uint64_t)pool_shard_count * sizeof(uint32_t));
 }
 
-// Function to initialize the IP pool based on the range
-void init_ip_pool() {
-    // Use the ip_range variable loaded from the .env file
-    if (strlen(ip_range) == 0) {
-        printf("No IP range specified in .env\n");
-        return;
+
+// Function to map the pool file as the working pool, sets *reused when it already held a pool with the same layout
+// Returns the start of the mapping or NULL on error
+static uint8_t *map_pool_file(const pool_file_header_t *layout, const pool_file_shard_t *shard_table, int *reused) {
+    int fd = open(pool_file, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        printf(RED "Failed to open the pool file %s: %s\n" RESET, pool_file, strerror(errno));
+        return NULL;
     }
 
-    // Split the start and end IP
-    char start_ip[16], end_ip[16];
-    sscanf(ip_range, "%[^-]-%s", start_ip, end_ip);
+    // A file written by this version for the same scopes and shards is used as it is, anything else is laid out again
+    pool_file_header_t header;
+    *reused = pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) && memcmp(&header, layout, sizeof(header)) == 0;
 
-    // Calculate the pool size
-    pool_size = calculate_pool_size(start_ip, end_ip);
+    size_t table_size = pool_shard_count * sizeof(pool_file_shard_t);
+    pool_file_shard_t *table = *reused ? (pool_file_shard_t *)malloc(table_size) : NULL;
+    if (table != NULL) {
+        *reused = pread(fd, table, table_size, (off_t)layout->shards_offset) == (ssize_t)table_size && memcmp(table, shard_table, table_size) == 0;
+        free(table);
+    }
 
-    // Allocate memory for the IP pool
-    ip_pool = (ip_pool_entry_t*)malloc(pool_size * sizeof(ip_pool_entry_t));
-    if (ip_pool == NULL) {
+    if (!*reused) {
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)layout->file_size) != 0) {
+            printf(RED "Failed to size the pool file %s: %s\n" RESET, pool_file, strerror(errno));
+            close(fd);
+            return NULL;
+        }
+    }
+
+    uint8_t *base = (uint8_t *)mmap(NULL, layout->file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        printf(RED "Failed to map the pool file %s: %s\n" RESET, pool_file, strerror(errno));
+        return NULL;
+    }
+
+    pool_mapping_size = layout->file_size;
+    return base;
+}
+
+
+// Function to split the scopes in shards, the scopes are laid out one after the other and each one starts on a new word of the bitmap
+// Returns the shard table of the pool file, or NULL if there is no memory
+static pool_file_shard_t *plan_pool_shards() {
+    pool_size = 0;
+    pool_shard_count = 0;
+    for (int s = 0; s < scope_count; s++) {
+        scope_t *scope = &scopes[s];
+        int words = (int)((scope->range_end - scope->range_start + 64) / 64);
+
+        // Small scopes get fewer shards, every shard owns whole words of the bitmap
+        scope->shard_count = words < POOL_SHARDS ? words : POOL_SHARDS;
+        int shard_words = (words + scope->shard_count - 1) / scope->shard_count;
+        scope->shard_count = (words + shard_words - 1) / shard_words;
+        scope->shard_entries = shard_words * 64;
+        scope->first_shard = pool_shard_count;
+        scope->first_index = pool_size;
+
+        // Load balanced servers split the addresses after the gateway in equal parts, server k hands out part k
+        int servers = lb_server_count > 0 ? lb_server_count : 1;
+        int64_t addresses = (int64_t)(scope->range_end - scope->range_start);
+        scope->own_first = scope->first_index + 1 + (int)(addresses * lb_index / servers);
+        scope->own_end = scope->first_index + 1 + (int)(addresses * (lb_index + 1) / servers);
+        int last_own = scope->own_end > scope->own_first ? scope->own_end - 1 : scope->own_first;
+        scope->own_first_shard = scope->first_shard + (scope->own_first - scope->first_index) / scope->shard_entries;
+        scope->own_shard_count = scope->first_shard + (last_own - scope->first_index) / scope->shard_entries - scope->own_first_shard + 1;
+
+        pool_shard_count += scope->shard_count;
+        pool_size += words * 64;
+    }
+
+    bitmap_words = pool_size / 64;
+    summary_words = (bitmap_words + 63) / 64;
+
+    word_shard = (int*)malloc(bitmap_words * sizeof(int));
+    pool_shards = (pool_shard_t*)aligned_alloc(_Alignof(pool_shard_t), pool_shard_count * sizeof(pool_shard_t));
+    pool_file_shard_t* shard_table = (pool_file_shard_t*)calloc(pool_shard_count, sizeof(pool_file_shard_t));
+    if (word_shard == NULL || pool_shards == NULL || shard_table == NULL) {
+        printf("Failed to allocate memory for the pool shards.\n");
+        free(shard_table);
+        return NULL;
+    }
+
+    binding_total = 0;
+    uint32_t largest_limit = 0;
+    for (int s = 0; s < scope_count; s++) {
+        scope_t *scope = &scopes[s];
+        int scope_end = scope->first_index + (int)(scope->range_end - scope->range_start + 1);
+
+        for (int k = 0; k < scope->shard_count; k++) {
+            int index = scope->first_shard + k;
+            pool_shard_t *shard = &pool_shards[index];
+            shard->first = scope->first_index + k * scope->shard_entries;
+            shard->end = shard->first + scope->shard_entries < scope_end ? shard->first + scope->shard_entries : scope_end;
+            shard->scope = scope;
+
+            // Every shard reserves two binding slots per address, its table starts with a few of them and grows with its clients
+            shard->binding_limit = 2;
+            while (shard->binding_limit < 2 * (uint32_t)(shard->end - shard->first))
+                shard->binding_limit <<= 1;
+            shard->binding_capacity = shard->binding_limit < BINDING_TABLE_MIN_CAPACITY ? shard->binding_limit : BINDING_TABLE_MIN_CAPACITY;
+            shard->binding_count = 0;
+            if (shard->binding_limit > largest_limit)
+                largest_limit = shard->binding_limit;
+
+            shard_table[index].first = shard->first;
+            shard_table[index].end = shard->end;
+            shard_table[index].binding_limit = shard->binding_limit;
+            shard_table[index].binding_first = binding_total;
+            binding_total += shard->binding_limit;
+
+            // The padding after the last address of the scope stays in its last word
+            for (int w = shard->first / 64; w < (shard->end + 63) / 64; w++)
+                word_shard[w] = index;
+        }
+    }
+
+    // A table grows when it is half full, so the scratch never holds more than half of the largest one
+    binding_scratch = (client_binding_t*)malloc((largest_limit / 2) * sizeof(client_binding_t));
+    if (binding_scratch == NULL) {
+        printf("Failed to allocate memory for the pool shards.\n");
+        free(shard_table);
+        return NULL;
+    }
+
+    return shard_table;
+}
+
+
+// Function to initialize the IP pool based on the scopes, returns -1 on error
+// The arrays start as zero pages, only the bitmap is written, so the startup does not grow with the size of the ranges
+int init_ip_pool() {
+    // The scopes come from SCOPES_FILE, or the ip_range variable loaded from the .env file
+    if (load_scopes() != 0)
+        return -1;
+
+    pool_file_shard_t* shard_table = plan_pool_shards();
+    if (shard_table == NULL)
+        return -1;
+
+    pool_file_header_t layout;
+    describe_pool_layout(&layout);
+
+    client_binding_t* bindings = NULL;
+    int reused = 0;
+    if (strlen(pool_file) > 0) {
+        // The arrays, the bitmap and the binding tables live in the pool file, laid out as its header says
+        pool_mapping = map_pool_file(&layout, shard_table, &reused);
+        if (pool_mapping == NULL) {
+            free(shard_table);
+            return -1;
+        }
+
+        lease_expiry = (uint32_t*)(pool_mapping + layout.expiries_offset);
+        client_slot = (uint32_t*)(pool_mapping + layout.client_slots_offset);
+        free_bitmap = (_Atomic uint64_t*)(pool_mapping + layout.bitmap_offset);
+        free_summary = (_Atomic uint64_t*)(pool_mapping + layout.summary_offset);
+        offered_bitmap = (_Atomic uint64_t*)(pool_mapping + layout.offered_offset);
+        reserved_bitmap = (_Atomic uint64_t*)(pool_mapping + layout.reserved_offset);
+        bindings = (client_binding_t*)(pool_mapping + layout.bindings_offset);
+        foreign_bindings = (atomic_int*)(pool_mapping + layout.foreign_offset);
+        binding_capacities = (uint32_t*)(pool_mapping + layout.capacities_offset);
+    } else {
+        // Allocate memory for the IP pool, the bitmap starts with every bit as used and every binding slot empty
+        lease_expiry = (uint32_t*)calloc(pool_size, sizeof(uint32_t));
+        client_slot = (uint32_t*)calloc(pool_size, sizeof(uint32_t));
+        free_bitmap = (_Atomic uint64_t*)calloc(bitmap_words, sizeof(uint64_t));
+        free_summary = (_Atomic uint64_t*)calloc(summary_words, sizeof(uint64_t));
+        offered_bitmap = (_Atomic uint64_t*)calloc(bitmap_words, sizeof(uint64_t));
+        reserved_bitmap = (_Atomic uint64_t*)calloc(bitmap_words, sizeof(uint64_t));
+        bindings = (client_binding_t*)calloc(binding_total, sizeof(client_binding_t));
+        binding_capacities = (uint32_t*)calloc(pool_shard_count, sizeof(uint32_t));
+        if (lease_expiry == NULL || client_slot == NULL || free_bitmap == NULL || free_summary == NULL || offered_bitmap == NULL || reserved_bitmap == NULL || bindings == NULL || binding_capacities == NULL) {
+            printf("Failed to allocate memory for IP pool.\n");
+            free(shard_table);
+            return -1;
+        }
+    }
+
+    // The transactions of the offers are not worth keeping across a restart, they stay on the heap
+    offer_xid = (uint32_t*)calloc(pool_size, sizeof(uint32_t));
+    if (offer_xid == NULL) {
         printf("Failed to allocate memory for IP pool.\n");
-        return;
+        free(shard_table);
+        return -1;
     }
 
-    // Assign the first IP in the range as the gateway
-    strncpy(gateway_ip, start_ip, sizeof(gateway_ip));
+    for (int s = 0; s < pool_shard_count; s++) {
+        pool_shard_t *shard = &pool_shards[s];
+        pthread_mutex_init(&shard->mutex, NULL);
+        shard->bindings = bindings + shard_table[s].binding_first;
 
-    // Change the gateway IP in the pool to assigned
-    strncpy(ip_pool[0].ip_address, gateway_ip, sizeof(ip_pool[0].ip_address));
-    ip_pool[0].is_assigned = 1;
+        // A mapped pool keeps the tables of the previous run as they had grown, their clients are counted again
+        if (reused) {
+            shard->binding_capacity = binding_capacities[s];
+            for (uint32_t slot = 0; slot < shard->binding_capacity; slot++)
+                shard->binding_count += shard->bindings[slot].lease_index != 0;
+        } else {
+            binding_capacities[s] = shard->binding_capacity;
+        }
 
-    // Convertir las IPs de inicio y fin a enteros
-    unsigned int start = ip_to_int(start_ip) + 1;  // Start from the second IP
-    unsigned int end = ip_to_int(end_ip);
+        // Leases are only visited by the expiry check when they fall due
+        if (timing_wheel_init(&shard->wheel, shard->end - shard->first, (uint64_t)time(NULL)) != 0) {
+            printf("Failed to allocate memory for the lease timing wheel.\n");
+            free(shard_table);
+            return -1;
+        }
+    }
 
-    int i = 1;
-    char ip_buffer[16];
+    // The gateway handed to clients without a relay is the one of the local scope
+    int_to_ip(local_scope->range_start, gateway_ip);
 
-    // Generate all the IPs within the range and store them in the pool
-    for (unsigned int ip = start; ip <= end && i < pool_size; ip++) {
-        int_to_ip(ip, ip_buffer);
-        strncpy(ip_pool[i].ip_address, ip_buffer, sizeof(ip_pool[i].ip_address));
-        ip_pool[i].is_assigned = 0;  // Mark as unassigned
-        i++;
+    if (reused) {
+        // The pool of the previous run is already in place, only the expiry of its leases has to be scheduled again
+        // The leased entries are found in the bitmap, gateways and padding are never leased and keep no expiry
+        // The transactions of the offers of the previous run are gone, those addresses are free again
+        // Reservations are loaded again after the pool, so the addresses they kept go back to the pool until then
+        for (int word = 0; word < bitmap_words; word++) {
+            uint64_t reserved = atomic_exchange(&reserved_bitmap[word], 0);
+            while (reserved) {
+                mark_ip_free(word * 64 + __builtin_ctzll(reserved));
+                reserved &= reserved - 1;
+            }
+        }
+
+        int leases = 0;
+        for (int word = 0; word < bitmap_words; word++) {
+            uint64_t used = ~atomic_load(&free_bitmap[word]);
+            while (used) {
+                int i = word * 64 + __builtin_ctzll(used);
+                used &= used - 1;
+                if (is_offered(i)) {
+                    mark_ip_free(i);
+                } else if (lease_expiry[i] != 0) {
+                    pool_shard_t *shard = shard_of_index(i);
+                    timing_wheel_schedule(&shard->wheel, i - shard->first, (uint64_t)LEASE_EPOCH + lease_expiry[i]);
+                    leases++;
+                }
+            }
+        }
+        printf(GREEN "Pool file %s mapped with %d leases.\n" RESET, pool_file, leases);
+        free(shard_table);
+        return 0;
+    }
+
+    // Every address of the part of a scope this server hands out starts free, the gateway, the padding up to the next scope
+    // and the parts of the other load balanced servers are never handed out
+    for (int s = 0; s < scope_count; s++) {
+        const scope_t *scope = &scopes[s];
+        mark_range_free(scope->own_first, scope->own_end);
+    }
+
+    // The header goes in last, a file whose initialization was cut short never passes the check
+    if (pool_mapping != NULL) {
+        memcpy(pool_mapping + layout.shards_offset, shard_table, pool_shard_count * sizeof(pool_file_shard_t));
+        msync(pool_mapping, pool_mapping_size, MS_SYNC);
+        memcpy(pool_mapping, &layout, sizeof(layout));
+        msync(pool_mapping, pool_mapping_size, MS_SYNC);
+        printf(GREEN "Pool file %s laid out for %d addresses in %d scopes.\n" RESET, pool_file, pool_size, scope_count);
     }
+    free(shard_table);
+    return 0;
+}
+
+
+// Function to release the memory of the pool, a mapped pool is written back to its file
+void close_ip_pool() {
+    if (pool_mapping != NULL) {
+        msync(pool_mapping, pool_mapping_size, MS_SYNC);
+        munmap(pool_mapping, pool_mapping_size);
+        pool_mapping = NULL;
+    } else {
+        free(lease_expiry);
+        free(client_slot);
+    }
+    free(offer_xid);
+    lease_expiry = NULL;
+    client_slot = NULL;
+    offer_xid = NULL;
 }
 
 char* get_gateway_ip() {
@@ -81,73 +723,345 @@ char* get_gateway_ip() {
 }
 
 
-char* assign_ip() {
-    for (int i = 0; i < pool_size; i++) {
-        if (ip_pool[i].is_assigned == 0) {
-            ip_pool[i].is_assigned = 1;     // Marks the IP as assigned
+// Function to get the entry of an address, returns -1 if no scope holds the address
+int ip_to_index(uint32_t ip) {
+    const scope_t *scope = find_scope(ip);
+    if (scope == NULL || ip < scope->range_start || ip > scope->range_end)
+        return -1;
+    return scope->first_index + (int)(ip - scope->range_start);
+}
+
+
+// Function to get the entry of an address that can be leased, returns -1 for the gateways, the addresses outside every scope
+// and the addresses of the other load balanced servers
+static int lease_index(uint32_t ip) {
+    int i = ip_to_index(ip);
+    if (i < 0)
+        return -1;
+    const scope_t *scope = shard_of_index(i)->scope;
+    if (i < scope->own_first || i >= scope->own_end)
+        return -1;
+    return i;
+}
+
+
+// Function to offer an address of the scope to a client, the address is held for OFFER_HOLD_TIME
+// Returns the address or 0 if the scope has no available IPs
+uint32_t assign_ip(const scope_t *scope, const uint8_t *client_id, int client_id_len, uint32_t xid) {
+    uint32_t hash = hash_client_id(client_id, client_id_len);
+
+    // A known client gets its current or last address back, a binding only survives while nobody else took the address
+    int slot;
+    pool_shard_t *shard = lock_client_binding(scope, client_id, client_id_len, hash, &slot);
+    if (shard != NULL) {
+        int i = shard->bindings[slot].lease_index;
+        if (!is_assigned(i))
+            mark_ip_used(i);
 
-            // Assign IP in the DHCP Offer/Ack phase
-            time_t current_time = time(NULL);  // Get the current time
+        // A bound client keeps its lease as it is until its REQUEST renews it
+        if (!is_bound(i))
+            hold_offer(shard, i, xid);
+        pthread_mutex_unlock(&shard->mutex);
+        return index_to_ip(i);   // Return the IP address
+    }
 
-            ip_pool[i].lease_start = current_time;  // Record lease start time
-            ip_pool[i].lease_duration = LEASE_TIME;  // Assign lease duration
+    // A new client takes the first free address of its home shard, or steals one from the next shards of the scope if it is full
+    int home = home_shard(scope, hash);
+    for (int k = 0; k < scope->own_shard_count; k++) {
+        shard = scope_shard(scope, home, k);
+        pthread_mutex_lock(&shard->mutex);
 
-            return ip_pool[i].ip_address;   // Return the IP address
+        // The bitmap gives the first free entry without walking the shard
+        int i = claim_free_ip(shard);
+        if (i >= 0) {
+            bind_client(shard, i, client_id, client_id_len, hash);
+            hold_offer(shard, i, xid);
+            pthread_mutex_unlock(&shard->mutex);
+            return index_to_ip(i);   // Return the IP address
         }
+
+        pthread_mutex_unlock(&shard->mutex);
+    }
+
+    return 0;  // Return 0 if the scope has no available IPs
+}
+
+
+// Function to free the address offered to a client, nothing happens if it is already bound
+void withdraw_offer(const scope_t *scope, const uint8_t *client_id, int client_id_len) {
+    uint32_t hash = hash_client_id(client_id, client_id_len);
+
+    int slot;
+    pool_shard_t *shard = lock_client_binding(scope, client_id, client_id_len, hash, &slot);
+    if (shard == NULL)
+        return;
+
+    int i = shard->bindings[slot].lease_index;
+    if (is_offered(i)) {
+        timing_wheel_cancel(&shard->wheel, i - shard->first);
+        mark_ip_free(i);
     }
-    return NULL;  // Return NULL if no available IPs
+    pthread_mutex_unlock(&shard->mutex);
 }
 
 
-void release_ip(const char* ip) {
-    for (int i = 0; i < pool_size; i++) {
-        if (strcmp(ip_pool[i].ip_address, ip) == 0) {
-            ip_pool[i].is_assigned = 0;  // Marks the IP as available
-            return;
+// Function to take an address out of the dynamic pool for a reservation, or give it back to the pool
+// A client holding the address dynamically loses it, its next REQUEST is refused and it starts over
+void set_ip_reserved(uint32_t ip, int reserved) {
+    int i = lease_index(ip);
+    if (i < 0)
+        return;  // Outside every range, the pool never hands it out anyway
+
+    pool_shard_t *shard = shard_of_index(i);
+    uint64_t bit = 1ULL << (i % 64);
+    pthread_mutex_lock(&shard->mutex);
+    if (reserved && !is_reserved(i)) {
+        if (client_slot[i] != 0) {
+            remove_binding_slot(shard, client_slot[i] - 1);
+            client_slot[i] = 0;
         }
+        if (is_assigned(i))
+            timing_wheel_cancel(&shard->wheel, i - shard->first);
+        else
+            mark_ip_used(i);
+        atomic_fetch_and(&offered_bitmap[i / 64], ~bit);
+        atomic_fetch_or(&reserved_bitmap[i / 64], bit);
+        lease_expiry[i] = 0;
+    } else if (!reserved && is_reserved(i)) {
+        atomic_fetch_and(&reserved_bitmap[i / 64], ~bit);
+        mark_ip_free(i);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+
+void release_ip(uint32_t ip) {
+    int i = lease_index(ip);
+    if (i < 0) {
+        char ip_buffer[IP_ADDRESS_SIZE];
+        int_to_ip(ip, ip_buffer);
+        printf("IP not found in pool: %s\n", ip_buffer);
+        return;
+    }
+
+    pool_shard_t *shard = shard_of_index(i);
+    pthread_mutex_lock(&shard->mutex);
+    if (is_reserved(i)) {
+        // The address of a reservation stays with its client
+        pthread_mutex_unlock(&shard->mutex);
+        return;
+    }
+    if (is_bound(i)) {
+        // The client keeps the address as its last binding after a restart
+        lease_info_t lease;
+        describe_lease(i, &lease);
+        client_binding_t *binding = client_slot[i] != 0 ? &shard->bindings[client_slot[i] - 1] : NULL;
+        record_lease_change(LEASE_RECORD_RELEASED, ip, binding ? binding->client_id : NULL, binding ? binding->client_id_len : 0, lease.lease_start, lease.lease_duration);
+    }
+    if (is_assigned(i)) {
+        timing_wheel_cancel(&shard->wheel, i - shard->first);
+        mark_ip_free(i);  // Marks the IP as available
+    }
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+// Function called by the timing wheel of a shard for each lease that reached its expiry
+static void expire_lease(int node, void *arg) {
+    pool_shard_t *shard = (pool_shard_t *)arg;
+    int i = shard->first + node;
+    if (!is_assigned(i))
+        return;
+
+    // Offers that were never requested go back silently, a DISCOVER flood would otherwise flood the log as well
+    if (is_offered(i)) {
+        mark_ip_free(i);
+        return;
     }
-    printf("IP not found in pool: %s\n", ip);
+
+    char ip_buffer[IP_ADDRESS_SIZE];
+    int_to_ip(index_to_ip(i), ip_buffer);
+    printf("Lease for IP %s has expired. Releasing IP...\n", ip_buffer);
+    mark_ip_free(i);  // Mark IP as free
 }
 
+
+// Function to release the expired leases, only the leases due since the last call are visited
 void check_leases() {
     time_t current_time = time(NULL);
-    
-    for (int i = 1; i < pool_size; i++) {
-        if (ip_pool[i].is_assigned) {
-            // Check if the lease has expired
-            if ((current_time - ip_pool[i].lease_start) >= ip_pool[i].lease_duration) {
-                printf("Lease for IP %s has expired. Releasing IP...\n", ip_pool[i].ip_address);
-                ip_pool[i].is_assigned = 0;  // Mark IP as free
+
+    // One shard at a time, so the workers are only held back on the shard being checked
+    for (int s = 0; s < pool_shard_count; s++) {
+        pool_shard_t *shard = &pool_shards[s];
+        pthread_mutex_lock(&shard->mutex);
+        timing_wheel_advance(&shard->wheel, (uint64_t)current_time, expire_lease, shard);
+        pthread_mutex_unlock(&shard->mutex);
+    }
+}
+
+
+// Function to bind an offered address to its client or renew the lease of an IP address, an address that expired meanwhile is taken again
+// An offered address is only bound by the REQUEST of the transaction that got the offer
+// Returns 0 on success and -1 if the address does not belong to the scope or is offered or bound to another client
+int renew_lease(const scope_t *scope, uint32_t ip, const uint8_t *client_id, int client_id_len, uint32_t xid)
+{
+    int i = lease_index(ip);
+    if (i < 0 || shard_of_index(i)->scope != scope)
+        return -1;
+
+    uint32_t hash = hash_client_id(client_id, client_id_len);
+
+    // A client that still holds an address in another shard may not take this one
+    int slot;
+    pool_shard_t *holder = lock_client_binding(scope, client_id, client_id_len, hash, &slot);
+    if (holder != NULL) {
+        int held = holder->bindings[slot].lease_index;
+        int refused = held != i && is_bound(held);
+        pthread_mutex_unlock(&holder->mutex);
+        if (refused)
+            return -1;
+    }
+
+    pool_shard_t *shard = shard_of_index(i);
+    pthread_mutex_lock(&shard->mutex);
+
+    slot = find_binding_slot(shard, client_id, client_id_len, hash);
+    int rebound = slot < 0 || shard->bindings[slot].lease_index != i;
+    if (rebound) {
+        // Another client holds the address, or the client asks for an address other than its own
+        if (is_assigned(i) || (slot >= 0 && is_bound(shard->bindings[slot].lease_index))) {
+            pthread_mutex_unlock(&shard->mutex);
+            return -1;
+        }
+        bind_client(shard, i, client_id, client_id_len, hash);
+    } else if (is_offered(i) && offer_xid[i] != xid) {
+        // The offer was made to another transaction of the client
+        pthread_mutex_unlock(&shard->mutex);
+        return -1;
+    }
+
+    if (!is_assigned(i))
+        mark_ip_used(i);
+    time_t lease_start = start_lease(shard, i);
+
+    // Only acknowledged leases are journaled, an offer that is lost in a restart is simply offered again
+    record_lease_change(LEASE_RECORD_BOUND, ip, client_id, client_id_len, lease_start, scope->lease_time);
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (rebound)
+        drop_stale_bindings(client_id, client_id_len, hash, shard);
+
+    char ip_buffer[IP_ADDRESS_SIZE];
+    int_to_ip(ip, ip_buffer);
+    printf(GREEN "Lease renewed for IP address %s\n" RESET, ip_buffer);
+    return 0;
+}
+
+
+// Function to put back a lease read from the lease journal, the change is not journaled again
+// An address whose lease ended while the server was down comes back free, still bound to its client
+void restore_lease(uint32_t ip, const uint8_t *client_id, int client_id_len, time_t lease_start, int lease_duration, int assigned) {
+    int i = lease_index(ip);
+    if (i < 0 || is_reserved(i))
+        return; // The scope of the address is no longer served, or the address is kept for a reservation
+
+    uint32_t hash = hash_client_id(client_id, client_id_len);
+    pool_shard_t *shard = shard_of_index(i);
+    pthread_mutex_lock(&shard->mutex);
+
+    if (client_id_len > 0)
+        bind_client(shard, i, client_id, client_id_len, hash);
+
+    if (assigned && lease_start + lease_duration > time(NULL)) {
+        if (!is_assigned(i))
+            mark_ip_used(i);
+        atomic_fetch_and(&offered_bitmap[i / 64], ~(1ULL << (i % 64)));
+        lease_expiry[i] = (uint32_t)(lease_start + lease_duration - LEASE_EPOCH);
+        timing_wheel_schedule(&shard->wheel, i - shard->first, (uint64_t)(lease_start + lease_duration));
+    } else if (is_assigned(i)) {
+        timing_wheel_cancel(&shard->wheel, i - shard->first);
+        mark_ip_free(i);
+    }
+
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (client_id_len > 0)
+        drop_stale_bindings(client_id, client_id_len, hash, shard);
+}
+
+
+// Function to free every lease and drop every binding, the reserved addresses stay out of the pool
+// A standby calls it before it copies the leases of the active server
+void clear_leases() {
+    for (int s = 0; s < pool_shard_count; s++) {
+        pool_shard_t *shard = &pool_shards[s];
+        const scope_t *scope = shard->scope;
+        pthread_mutex_lock(&shard->mutex);
+
+        for (int i = shard->first; i < shard->end; i++) {
+            if (i < scope->own_first || i >= scope->own_end || is_reserved(i))
+                continue;  // Gateways, padding and the addresses of other load balanced servers are never free
+            if (is_assigned(i)) {
+                timing_wheel_cancel(&shard->wheel, i - shard->first);
+                mark_ip_free(i);
             }
+            // Only entries in use are written, the untouched pages of the arrays stay zero pages
+            if (lease_expiry[i] != 0)
+                lease_expiry[i] = 0;
+            if (client_slot[i] != 0)
+                client_slot[i] = 0;
+        }
+
+        for (uint32_t slot = 0; slot < shard->binding_capacity; slot++) {
+            if (shard->bindings[slot].lease_index == 0)
+                continue;
+            if (shard->bindings[slot].foreign)
+                atomic_fetch_sub(foreign_bindings, 1);
+            shard->bindings[slot].lease_index = 0;
         }
+        shard->binding_count = 0;
+        pthread_mutex_unlock(&shard->mutex);
     }
 }
 
 
-// Function to renew the lease of an IP address
-void renew_lease(char *ip_address)
-{
-    for (int i = 0; i < pool_size; i++)
-    {
-        if (strcmp(ip_pool[i].ip_address, ip_address) == 0)
-        {
-            ip_pool[i].lease_start = time(NULL);
-            printf(GREEN "Lease renewed for IP address %s\n" RESET, ip_address);
-            break;
+// Function to call visit for every address of the pool bound to a client, one shard is locked at a time
+void for_each_binding(void (*visit)(const lease_info_t *lease, const client_binding_t *binding, void *arg), void *arg) {
+    for (int s = 0; s < pool_shard_count; s++) {
+        pool_shard_t *shard = &pool_shards[s];
+        pthread_mutex_lock(&shard->mutex);
+        for (int i = shard->first; i < shard->end; i++) {
+            if (client_slot[i] != 0) {
+                lease_info_t lease;
+                describe_lease(i, &lease);
+                visit(&lease, &shard->bindings[client_slot[i] - 1], arg);
+            }
         }
+        pthread_mutex_unlock(&shard->mutex);
     }
 }
 
 
+// Function to get the current or last address of a client in a scope, returns 0 if it has none
+uint32_t find_client_ip(const scope_t *scope, const uint8_t *client_id, int client_id_len) {
+    uint32_t hash = hash_client_id(client_id, client_id_len);
+    uint32_t ip = 0;
+
+    int slot;
+    pool_shard_t *shard = lock_client_binding(scope, client_id, client_id_len, hash, &slot);
+    if (shard != NULL) {
+        ip = index_to_ip(shard->bindings[slot].lease_index);
+        pthread_mutex_unlock(&shard->mutex);
+    }
+
+    return ip;
+}
+
+
 // Function to check if a requested IP is available
 int is_ip_available(uint32_t requested_ip) {
-    for (int i = 0; i < pool_size; i++) {
-        char ip_buffer[16];
-        int_to_ip(requested_ip, ip_buffer);
+    int i = lease_index(requested_ip);
+    if (i < 0)
+        return 0; // Outside every scope or a gateway, never available
 
-        if (strcmp(ip_pool[i].ip_address, ip_buffer) == 0 && ip_pool[i].is_assigned == 1) {
-            return 0; // IP is already assigned, not available
-        }
-    }
-    return 1;
+    return !is_assigned(i);  // The bitmap is read atomically, no lock is needed
 }
@@ -3,39 +3,122 @@
 
 #include <stdint.h>  // Para usar uint32_t
 #include <time.h>    // Para usar time_t
+#include <pthread.h> // For the lock of each shard
+
+#include "./timing_wheel.h"
+#include "../config/scope.h"
 
 
 #define IP_ADDRESS_SIZE 16  // Tamaño de una dirección IP
 // #define LEASE_TIME 1800     // Lease time in seconds (30 minutes)
-#define LEASE_TIME 60
-extern int pool_size;  // Declaración del tamaño del pool
+#define LEASE_TIME 60  // Lease time of the scope built from IP_RANGE, a scopes file gives each scope its own
+#define CLIENT_ID_SIZE 16  // Longest client identifier kept in the binding table (the size of chaddr)
+#define POOL_SHARDS 16  // Most shards a scope is split into, each shard owns whole words of the free bitmap
+#define BINDING_TABLE_MIN_CAPACITY 64  // Slots a binding table starts with, it doubles whenever half of them hold a client
+#define POOL_FILE_MAGIC "DHCPOOL"  // First bytes of a pool file
+#define POOL_FILE_VERSION 6
+#define OFFER_HOLD_TIME 5  // Seconds an offered address waits for the REQUEST of its client before it is free again
+#define LEASE_EPOCH 1577836800  // 2020-01-01, lease expiries are kept as 32-bit seconds since then
+extern int pool_size;  // Declaración del tamaño del pool, the entries of every scope together
 
 
-// Estructura para manejar las direcciones IP
+// Lease of an address as handed to for_each_binding, the pool keeps it split in arrays
 typedef struct {
-    char ip_address[IP_ADDRESS_SIZE];  // Ip address as a string
-    int is_assigned;      // Flag to indicate if the IP is assigned
+    uint32_t ip_address;  // Ip address in host order
+    int is_assigned;      // Flag to indicate if the IP is bound to its client, an address that is only offered is not
     time_t lease_start;   // Timestamp when the lease was assigned
     int lease_duration;   // Lease duration in seconds
-} ip_pool_entry_t;
+} lease_info_t;
+
+// Binding between a client (its MAC or client identifier) and the last address it was given
+typedef struct {
+    uint32_t hash;        // Hash of the client identifier, also picks the first slot to probe
+    int lease_index;      // Entry of the pool bound to the client, 0 marks an empty slot (entry 0 is a gateway and is never bound)
+    uint8_t client_id_len;
+    uint8_t foreign;      // The client was given an address outside its home shard
+    uint8_t client_id[CLIENT_ID_SIZE];
+} client_binding_t;
+
+// Slice of the pool with its own lock, the bindings of its addresses and the expiry of its leases
+typedef struct {
+    _Alignas(64) pthread_mutex_t mutex;  // Keeps the locks of different shards on different cache lines
+    int first;                 // First entry of ip_pool in the shard
+    int end;                   // One past the last entry of the shard
+    client_binding_t* bindings;  // Open addressing table of the clients bound to the addresses of the shard
+    uint32_t binding_capacity;   // Slots of the table in use, always a power of two
+    uint32_t binding_limit;      // Slots reserved for the table, two per address, so it never has to grow past them
+    uint32_t binding_count;      // Clients bound in the shard
+    timing_wheel_t wheel;        // Node n is the lease of entry first + n, one tick per second
+    const scope_t* scope;        // Scope the shard belongs to
+} pool_shard_t;
 
-// Declaration of the IP pool (size not specified here, it will be dynamic)
-extern ip_pool_entry_t* ip_pool;
+// Place of a shard in the pool file
+typedef struct {
+    int32_t first;
+    int32_t end;
+    uint32_t binding_limit;
+    uint32_t binding_first;   // Index of the first slot of its binding table in the bindings array
+} pool_file_shard_t;
+
+// Header at offset 0 of the pool file, the rest of the file is the working pool of the server
+// Other processes may map the file read only to inspect the leases, the server updates it in place while it runs
+// Every field is in the byte order of the server, and the arrays start at the given offsets:
+//   shards: shard_count pool_file_shard_t
+//   expiries: pool_size uint32_t, seconds since LEASE_EPOCH when the lease of each entry ends, the scopes follow each other
+//   client slots: pool_size uint32_t, slot + 1 of the client bound to each entry in the binding table of its shard, 0 if none
+//   bitmap: bit i set while entry i is free, summary: bit w set while word w of the bitmap may have a free bit
+//   offered: bit i set while entry i is only offered, its expiry is then the end of the hold
+//   reserved: bit i set while entry i is kept out of the dynamic pool for a reservation
+//   bindings: the slots reserved for the binding table of each shard one after the other, a table only uses the first of them
+//   capacities: shard_count uint32_t, slots of the binding table of each shard in use
+//   foreign: the int32 count of bindings stored outside the home shard of their client
+// Pages that were never touched stay holes of the file, so a large range costs disk and memory only for the addresses in use
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t scopes_hash;     // Of the ranges of every scope, a file laid out for other scopes is not reused
+    int32_t pool_size;
+    int32_t scope_count;
+    int32_t shard_count;
+    uint32_t binding_size;    // sizeof(client_binding_t)
+    uint32_t reserved;
+    uint64_t shards_offset;
+    uint64_t expiries_offset;
+    uint64_t client_slots_offset;
+    uint64_t bitmap_offset;
+    uint64_t summary_offset;
+    uint64_t offered_offset;
+    uint64_t reserved_offset;
+    uint64_t bindings_offset;
+    uint64_t foreign_offset;
+    uint64_t capacities_offset;
+    uint64_t file_size;
+} pool_file_header_t;
 
+// Declaration of the IP pool (size not specified here, it will be dynamic), entry i of the pool is element i of each array
+extern uint32_t* lease_expiry;  // Seconds since LEASE_EPOCH when the lease or the hold of the offer ends, 0 if the entry was never leased
+extern uint32_t* client_slot;   // Slot + 1 of the client bound to the entry in the binding table of its shard, 0 if none
+extern pool_shard_t* pool_shards;
+extern int pool_shard_count;
 
-// Funciones para manejar el pool de IPs
-int is_ip_available(uint32_t requested_ip);
-void init_ip_pool();  // Inicializa el pool de IPs
-char* assign_ip();    // Asigna una IP del pool disponible
-void release_ip(const char* ip);  // Libera una IP asignada
+
+// Funciones para manejar el pool de IPs, every address is in host order
+int init_ip_pool();  // Inicializa el pool de IPs, -1 on error
+void close_ip_pool();  // Free the pool, or write it back to the pool file
+int ip_to_index(uint32_t ip);  // Entry of an address in the pool, -1 if no scope holds it
+uint32_t assign_ip(const scope_t *scope, const uint8_t *client_id, int client_id_len, uint32_t xid);    // Offer an IP of the scope for OFFER_HOLD_TIME, reusing the client binding, 0 if the scope is full
+void withdraw_offer(const scope_t *scope, const uint8_t *client_id, int client_id_len);  // Free the address offered to a client that chose another server
+void release_ip(uint32_t ip);  // Libera una IP asignada
+void set_ip_reserved(uint32_t ip, int reserved);  // Take an address out of the dynamic pool for a reservation, or give it back
 char* get_gateway_ip();  // Nueva declaración
 int is_ip_available(uint32_t requested_ip); // Check if an IP is available
 void check_leases();  // Function to check and release expired leases
-void renew_lease(char *ip_address);  // Function to renew the lease of an IP address
-
-// Function declarations to convert IP to integer and vice versa
-unsigned int ip_to_int(const char* ip);
-void int_to_ip(unsigned int ip, char* buffer);
+int renew_lease(const scope_t *scope, uint32_t ip, const uint8_t *client_id, int client_id_len, uint32_t xid);  // Function to bind an offered address or renew the lease of an IP address, -1 if the client may not have it in this scope
+uint32_t find_client_ip(const scope_t *scope, const uint8_t *client_id, int client_id_len);  // Current or last address of a client in a scope, 0 if it has none
+void restore_lease(uint32_t ip, const uint8_t *client_id, int client_id_len, time_t lease_start, int lease_duration, int assigned);  // Put back a lease read from the lease journal
+void clear_leases();  // Free every lease and drop every binding, for a standby about to copy the leases of the active server
+void for_each_binding(void (*visit)(const lease_info_t *lease, const client_binding_t *binding, void *arg), void *arg);  // Visit every address bound to a client
 
 // Function to calculate the IP pool size based on the dynamic range
 int calculate_pool_size(char* start_ip, char* end_ip);
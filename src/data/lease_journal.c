@@ -0,0 +1,397 @@
+#include "./lease_journal.h"
+#include "../config/env.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define SNAPSHOT_BUFFER_RECORDS 256  // Records written to the snapshot with one write call
+
+
+// Journal file and the files derived from its path
+static int journal_fd = -1;
+static off_t journal_size = 0;
+static char journal_path[MAX_CHARACTERS_PATH];
+static char old_journal_path[MAX_CHARACTERS_PATH + 8];  // Journal being folded into the snapshot
+static char snapshot_path[MAX_CHARACTERS_PATH + 16];
+static char snapshot_tmp_path[MAX_CHARACTERS_PATH + 16];
+
+// Two batches of records, appenders fill one while the commit thread writes the other
+// The active batch grows instead of making appenders wait, they run with the lock of a pool shard held
+static lease_record_t *batches[2];
+static int batch_capacity[2];
+static int active_batch = 0;
+static int active_count = 0;
+
+// Every record gets a sequence number, a thread waits for the commit of the last one it appended
+static uint64_t appended_seq = 0;
+static uint64_t committed_seq = 0;
+static _Thread_local uint64_t thread_seq = 0;
+
+static pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t records_pending = PTHREAD_COND_INITIALIZER;   // Signaled when a record is appended
+static pthread_cond_t records_committed = PTHREAD_COND_INITIALIZER; // Broadcast after each group commit
+static pthread_cond_t compaction_due = PTHREAD_COND_INITIALIZER;    // Signaled when the journal was rotated
+static int compacting = 0;  // The rotated journal is being folded into the snapshot
+
+
+// Function to compute the checksum of a record (FNV-1a of everything after the checksum field)
+static uint32_t record_checksum(const lease_record_t *record) {
+    const uint8_t *bytes = (const uint8_t *)record + sizeof(record->checksum);
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(*record) - sizeof(record->checksum); i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+// Function to fill a record and seal it with its checksum
+static void fill_record(lease_record_t *record, lease_record_type_t type, uint32_t ip, const uint8_t *client_id, int client_id_len, time_t lease_start, int lease_duration) {
+    memset(record, 0, sizeof(*record));
+    record->type = (uint8_t)type;
+    record->client_id_len = (uint8_t)client_id_len;
+    record->ip = ip;
+    record->lease_duration = lease_duration;
+    record->lease_start = (int64_t)lease_start;
+    if (client_id_len > 0)
+        memcpy(record->client_id, client_id, client_id_len);
+    record->checksum = record_checksum(record);
+}
+
+
+// Function to write a whole buffer, returns -1 on error
+static int write_all(int fd, const void *data, size_t length) {
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        bytes += written;
+        length -= written;
+    }
+    return 0;
+}
+
+
+// Function to make a rename or a new file in the directory of the journal durable
+static void sync_journal_directory() {
+    char directory[MAX_CHARACTERS_PATH];
+    strncpy(directory, journal_path, sizeof(directory) - 1);
+    directory[sizeof(directory) - 1] = '\0';
+
+    int fd = open(dirname(directory), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+
+// Function to create a lease file with its header, returns the descriptor or -1
+static int create_lease_file(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0)
+        return -1;
+
+    lease_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LEASE_FILE_MAGIC, sizeof(header.magic));
+    header.version = LEASE_FILE_VERSION;
+    header.record_size = sizeof(lease_record_t);
+
+    if (write_all(fd, &header, sizeof(header)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+// Function to apply every valid record of a lease file to the pool, a missing file is not an error
+// Returns the number of records applied, reading stops at the first record torn by a crash
+static long replay_lease_file(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    lease_file_header_t header;
+    if (read(fd, &header, sizeof(header)) != (ssize_t)sizeof(header) || memcmp(header.magic, LEASE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != LEASE_FILE_VERSION || header.record_size != sizeof(lease_record_t)) {
+        printf(RED "Ignoring %s, it is not a lease file of this version.\n" RESET, path);
+        close(fd);
+        return 0;
+    }
+
+    long applied = 0;
+    lease_record_t records[SNAPSHOT_BUFFER_RECORDS];
+    ssize_t length;
+    while ((length = read(fd, records, sizeof(records))) > 0) {
+        int count = (int)(length / sizeof(lease_record_t));
+        for (int i = 0; i < count; i++) {
+            lease_record_t *record = &records[i];
+            if (record->checksum != record_checksum(record) || record->client_id_len > CLIENT_ID_SIZE) {
+                printf(YELLOW "Lease file %s ends with a torn record, the rest is ignored.\n" RESET, path);
+                close(fd);
+                return applied;
+            }
+
+            restore_lease(record->ip, record->client_id, record->client_id_len, (time_t)record->lease_start, record->lease_duration, record->type == LEASE_RECORD_BOUND);
+            applied++;
+        }
+    }
+
+    close(fd);
+    return applied;
+}
+
+
+// Snapshot being written, records are gathered in a buffer and written a block at a time
+typedef struct {
+    int fd;
+    int count;
+    int failed;
+    lease_record_t records[SNAPSHOT_BUFFER_RECORDS];
+} snapshot_writer_t;
+
+
+// Function called for each bound address of the pool while the snapshot is written
+static void snapshot_binding(const lease_info_t *lease, const client_binding_t *binding, void *arg) {
+    snapshot_writer_t *writer = (snapshot_writer_t *)arg;
+
+    lease_record_type_t type = lease->is_assigned ? LEASE_RECORD_BOUND : LEASE_RECORD_RELEASED;
+    fill_record(&writer->records[writer->count++], type, lease->ip_address, binding->client_id, binding->client_id_len, lease->lease_start, lease->lease_duration);
+
+    if (writer->count == SNAPSHOT_BUFFER_RECORDS) {
+        if (write_all(writer->fd, writer->records, writer->count * sizeof(lease_record_t)) != 0)
+            writer->failed = 1;
+        writer->count = 0;
+    }
+}
+
+
+// Function to write the state of the pool as a new snapshot, it replaces the old one only once it is on disk
+static int write_snapshot() {
+    static snapshot_writer_t writer;  // Too large for the stack of the compaction thread
+    writer.fd = create_lease_file(snapshot_tmp_path);
+    writer.count = 0;
+    writer.failed = writer.fd < 0;
+    if (writer.failed)
+        return -1;
+
+    for_each_binding(snapshot_binding, &writer);
+
+    if (writer.count > 0 && write_all(writer.fd, writer.records, writer.count * sizeof(lease_record_t)) != 0)
+        writer.failed = 1;
+    if (fsync(writer.fd) != 0)
+        writer.failed = 1;
+    close(writer.fd);
+
+    if (writer.failed || rename(snapshot_tmp_path, snapshot_path) != 0) {
+        unlink(snapshot_tmp_path);
+        return -1;
+    }
+
+    sync_journal_directory();
+    return 0;
+}
+
+
+// Function to start a new journal and hand the full one to the compaction thread, only the commit thread calls it
+static void rotate_journal() {
+    if (rename(journal_path, old_journal_path) != 0)
+        return;
+
+    int fd = create_lease_file(journal_path);
+    if (fd < 0 || fsync(fd) != 0) {
+        printf(RED "Failed to start a new lease journal: %s\n" RESET, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        rename(old_journal_path, journal_path);
+        return;
+    }
+    sync_journal_directory();
+
+    close(journal_fd);
+    journal_fd = fd;
+
+    pthread_mutex_lock(&journal_mutex);
+    journal_size = sizeof(lease_file_header_t);
+    compacting = 1;
+    pthread_cond_signal(&compaction_due);
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+
+// Function run by the commit thread, every batch of records costs one write and one fdatasync
+static void *commit_thread(void *arg) {
+    (void)arg;
+
+    while (1) {
+        pthread_mutex_lock(&journal_mutex);
+        while (active_count == 0)
+            pthread_cond_wait(&records_pending, &journal_mutex);
+
+        // Take the batch and let the appenders go on with the other one
+        int batch = active_batch;
+        int count = active_count;
+        uint64_t last_seq = appended_seq;
+        active_batch ^= 1;
+        active_count = 0;
+        pthread_mutex_unlock(&journal_mutex);
+
+        size_t length = count * sizeof(lease_record_t);
+        if (write_all(journal_fd, batches[batch], length) != 0 || fdatasync(journal_fd) != 0)
+            printf(RED "Failed to write the lease journal: %s\n" RESET, strerror(errno));
+
+        pthread_mutex_lock(&journal_mutex);
+        committed_seq = last_seq;
+        journal_size += length;
+        int rotate = journal_size >= LEASE_JOURNAL_COMPACT_SIZE && !compacting;
+        pthread_cond_broadcast(&records_committed);
+        pthread_mutex_unlock(&journal_mutex);
+
+        if (rotate)
+            rotate_journal();
+    }
+
+    return NULL;
+}
+
+
+// Function run by the compaction thread, it folds each rotated journal into the snapshot away from the commit path
+static void *compaction_thread(void *arg) {
+    (void)arg;
+
+    while (1) {
+        pthread_mutex_lock(&journal_mutex);
+        while (!compacting)
+            pthread_cond_wait(&compaction_due, &journal_mutex);
+        pthread_mutex_unlock(&journal_mutex);
+
+        // The snapshot holds everything in the rotated journal, so the rotated journal can go once the snapshot is durable
+        if (write_snapshot() == 0) {
+            unlink(old_journal_path);
+            sync_journal_directory();
+        } else {
+            printf(RED "Failed to write the lease snapshot, the rotated journal is kept.\n" RESET);
+        }
+
+        pthread_mutex_lock(&journal_mutex);
+        compacting = 0;
+        pthread_mutex_unlock(&journal_mutex);
+    }
+
+    return NULL;
+}
+
+
+// Function to replay the snapshot and the journal into the pool and start journaling, path is the journal file
+int lease_journal_open(const char *path) {
+    strncpy(journal_path, path, sizeof(journal_path) - 1);
+    snprintf(old_journal_path, sizeof(old_journal_path), "%s.old", journal_path);
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s.snapshot", journal_path);
+    snprintf(snapshot_tmp_path, sizeof(snapshot_tmp_path), "%s.snapshot.tmp", journal_path);
+
+    // The snapshot comes first, then a journal left by a compaction that did not finish, then the live journal
+    long records = replay_lease_file(snapshot_path);
+    records += replay_lease_file(old_journal_path);
+    records += replay_lease_file(journal_path);
+    printf(GREEN "Lease journal %s replayed: %ld records.\n" RESET, journal_path, records);
+
+    // Start from a clean snapshot and an empty journal, which also drops any torn record at the tail
+    if (write_snapshot() != 0) {
+        printf(RED "Failed to write the lease snapshot.\n" RESET);
+        return -1;
+    }
+    unlink(old_journal_path);
+
+    journal_fd = create_lease_file(journal_path);
+    if (journal_fd < 0 || fsync(journal_fd) != 0) {
+        printf(RED "Failed to open the lease journal: %s\n" RESET, strerror(errno));
+        return -1;
+    }
+    sync_journal_directory();
+    journal_size = sizeof(lease_file_header_t);
+
+    for (int b = 0; b < 2; b++) {
+        batches[b] = (lease_record_t *)malloc(LEASE_JOURNAL_BATCH * sizeof(lease_record_t));
+        batch_capacity[b] = LEASE_JOURNAL_BATCH;
+        if (batches[b] == NULL) {
+            printf(RED "Failed to allocate memory for the lease journal.\n" RESET);
+            return -1;
+        }
+    }
+
+    pthread_t commit_id, compaction_id;
+    if (pthread_create(&commit_id, NULL, commit_thread, NULL) != 0 || pthread_create(&compaction_id, NULL, compaction_thread, NULL) != 0) {
+        printf(RED "Failed to start the lease journal threads.\n" RESET);
+        return -1;
+    }
+    pthread_detach(commit_id);
+    pthread_detach(compaction_id);
+
+    return 0;
+}
+
+
+// Function to queue a record, it reaches the disk with the next group commit
+// It never waits for the commit in progress, the batch being filled doubles when it is full
+void lease_journal_append(lease_record_type_t type, uint32_t ip, const uint8_t *client_id, int client_id_len, time_t lease_start, int lease_duration) {
+    if (journal_fd < 0)
+        return;
+
+    pthread_mutex_lock(&journal_mutex);
+
+    if (active_count == batch_capacity[active_batch]) {
+        lease_record_t *grown = (lease_record_t *)realloc(batches[active_batch], 2 * batch_capacity[active_batch] * sizeof(lease_record_t));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&journal_mutex);
+            printf(RED "Failed to allocate memory for the lease journal, a lease change is not journaled.\n" RESET);
+            return;
+        }
+        batches[active_batch] = grown;
+        batch_capacity[active_batch] *= 2;
+    }
+
+    fill_record(&batches[active_batch][active_count++], type, ip, client_id, client_id_len, lease_start, lease_duration);
+    thread_seq = ++appended_seq;
+
+    pthread_cond_signal(&records_pending);
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+
+// Function to wait until every record queued by the calling thread is on disk
+void lease_journal_flush() {
+    if (journal_fd < 0 || thread_seq == 0)
+        return;
+
+    pthread_mutex_lock(&journal_mutex);
+    while (committed_seq < thread_seq)
+        pthread_cond_wait(&records_committed, &journal_mutex);
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+
+// Function to write the pending records and close the journal
+void lease_journal_close() {
+    if (journal_fd < 0)
+        return;
+
+    pthread_mutex_lock(&journal_mutex);
+    while (committed_seq < appended_seq)
+        pthread_cond_wait(&records_committed, &journal_mutex);
+    pthread_mutex_unlock(&journal_mutex);
+
+    printf(GREEN "Lease journal closed, %lu records written.\n" RESET, (unsigned long)committed_seq);
+}
@@ -0,0 +1,53 @@
+#ifndef LEASE_JOURNAL_H
+#define LEASE_JOURNAL_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "./ip_pool.h"
+
+#define LEASE_FILE_MAGIC "DHCPLOG"  // First bytes of the journal and of the snapshot
+#define LEASE_FILE_VERSION 1
+#define LEASE_JOURNAL_BATCH 4096  // Records a batch holds before it grows, usually the most written and synced by one group commit
+#define LEASE_JOURNAL_COMPACT_SIZE (4 << 20)  // Size of the journal that makes it fold into a new snapshot
+
+
+// Kind of change carried by a record
+typedef enum {
+    LEASE_RECORD_BOUND = 1,     // The client holds the address until lease_start + lease_duration
+    LEASE_RECORD_RELEASED = 2   // The address is free again, the client keeps it as its last binding
+} lease_record_type_t;
+
+// Header at the start of the journal and of the snapshot
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} lease_file_header_t;
+
+// Fixed size record, the last record of an address wins when the files are replayed
+typedef struct {
+    uint32_t checksum;        // Of the rest of the record, a write torn by a crash fails it
+    uint8_t type;             // lease_record_type_t
+    uint8_t client_id_len;
+    uint16_t reserved;
+    uint32_t ip;              // Host order
+    int32_t lease_duration;
+    int64_t lease_start;
+    uint8_t client_id[CLIENT_ID_SIZE];
+} lease_record_t;
+
+
+// Function to replay the snapshot and the journal into the pool and start journaling, path is the journal file
+int lease_journal_open(const char *path);
+
+// Function to queue a record without waiting, it reaches the disk with the next group commit
+void lease_journal_append(lease_record_type_t type, uint32_t ip, const uint8_t *client_id, int client_id_len, time_t lease_start, int lease_duration);
+
+// Function to wait until every record queued by the calling thread is on disk
+void lease_journal_flush();
+
+// Function to write the pending records and close the journal
+void lease_journal_close();
+
+#endif
@@ -0,0 +1,455 @@
+#include "./lease_replication.h"
+#include "../config/env.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+// Both byte orders of the 64-bit sequence numbers
+#define hton64(x) (((uint64_t)htonl((uint32_t)(x)) << 32) | htonl((uint32_t)((x) >> 32)))
+#define ntoh64(x) hton64(x)
+
+
+// Socket shared with the peer, and the role the configuration gives this server
+static int replication_fd = -1;
+static struct sockaddr_in peer_address;
+static int is_primary = 0;
+static _Atomic int replication_state = REPLICATION_ACTIVE;  // A server without a peer is always active
+
+// Changes not acked yet by the standby, change seq lives in ring[seq % REPLICATION_WINDOW]
+static replication_record_t ring[REPLICATION_WINDOW];
+static uint64_t head_seq = 0;   // Sequence number of the next change
+static uint64_t acked_seq = 0;  // The standby has every change before it
+static int overflowed = 0;      // Changes were overwritten before the standby acked them, only a full sync brings it up to date
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// State of the replication thread, no other thread touches it
+static uint32_t session = 0;          // Session of this server while it is active
+static uint64_t sent_seq = 0;         // Next change to send
+static uint64_t last_progress = 0;    // When the acks last moved, or when changes were sent with none in flight
+static uint64_t last_sent = 0;
+static uint64_t last_sync = 0;
+static uint64_t peer_heard = 0;       // Last message from the peer
+static int sync_requested = 0;
+static uint32_t stream_session = 0;   // Session of the stream the standby copies, 0 before the first full sync
+static uint64_t expected_seq = 0;     // Next change the standby needs
+static int need_sync = 1;
+static int syncing = 0;
+static uint32_t sync_received = 0;
+static int ack_due = 0;
+
+// Replication thread, stopped before the pool is closed
+static pthread_t replication_id;
+static int replication_started = 0;
+static _Atomic int replication_stopping = 0;
+
+
+// Function to get a monotonic clock in milliseconds
+static uint64_t now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+
+// Function to parse an address written as ip:port, returns -1 if it is not valid
+static int parse_endpoint(const char *text, struct sockaddr_in *address) {
+    char ip[IP_ADDRESS_SIZE];
+    int endpoint_port;
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    if (sscanf(text, "%15[^:]:%d", ip, &endpoint_port) != 2 || endpoint_port <= 0 || endpoint_port > 65535 || inet_pton(AF_INET, ip, &address->sin_addr) != 1)
+        return -1;
+    address->sin_port = htons((uint16_t)endpoint_port);
+    return 0;
+}
+
+
+// Function to fill a record in the format of the wire
+static void fill_replication_record(replication_record_t *record, lease_record_type_t type, uint32_t ip, const uint8_t *client_id, int client_id_len, time_t lease_start, int lease_duration) {
+    memset(record, 0, sizeof(*record));
+    record->type = (uint8_t)type;
+    record->client_id_len = (uint8_t)client_id_len;
+    record->ip = htonl(ip);
+    record->lease_start = htonl((uint32_t)(lease_start - LEASE_EPOCH));
+    record->lease_duration = htonl((uint32_t)lease_duration);
+    if (client_id_len > 0)
+        memcpy(record->client_id, client_id, client_id_len);
+}
+
+
+// Function to apply a change received from the active server, the standby journals it as its own
+static void apply_replication_record(const replication_record_t *record) {
+    int client_id_len = record->client_id_len < CLIENT_ID_SIZE ? record->client_id_len : CLIENT_ID_SIZE;
+    uint32_t ip = ntohl(record->ip);
+    time_t lease_start = (time_t)LEASE_EPOCH + ntohl(record->lease_start);
+    int lease_duration = (int)ntohl(record->lease_duration);
+    lease_record_type_t type = record->type == LEASE_RECORD_BOUND ? LEASE_RECORD_BOUND : LEASE_RECORD_RELEASED;
+
+    restore_lease(ip, record->client_id, client_id_len, lease_start, lease_duration, type == LEASE_RECORD_BOUND);
+    lease_journal_append(type, ip, record->client_id, client_id_len, lease_start, lease_duration);
+}
+
+
+// Function to send a message to the peer, the records are already in the format of the wire
+static void send_replication_message(uint8_t type, uint8_t flags, uint32_t message_session, uint64_t seq, uint32_t total, const replication_record_t *records, int count) {
+    uint8_t buffer[REPLICATION_MESSAGE_SIZE];
+    replication_header_t *header = (replication_header_t *)buffer;
+    header->magic = htonl(REPLICATION_MAGIC);
+    header->type = type;
+    header->count = (uint8_t)count;
+    header->flags = flags;
+    header->state = (uint8_t)atomic_load(&replication_state);
+    header->session = htonl(message_session);
+    header->total = htonl(total);
+    header->seq = hton64(seq);
+    if (count > 0)
+        memcpy(buffer + sizeof(*header), records, count * sizeof(replication_record_t));
+
+    if (sendto(replication_fd, buffer, sizeof(*header) + count * sizeof(replication_record_t), 0, (struct sockaddr *)&peer_address, sizeof(peer_address)) < 0 && errno != EAGAIN)
+        printf(RED "Failed to send to the failover peer: %s\n" RESET, strerror(errno));
+    last_sent = now_ms();
+}
+
+
+// Function to start serving clients, the stream starts a new session the peer syncs to
+static void become_active(const char *reason) {
+    do {
+        session = (uint32_t)rand() ^ (uint32_t)getpid();
+    } while (session == 0 || session == stream_session);
+
+    pthread_mutex_lock(&ring_mutex);
+    head_seq = acked_seq = 0;
+    overflowed = 0;
+    pthread_mutex_unlock(&ring_mutex);
+    sent_seq = 0;
+    sync_requested = 0;
+
+    atomic_store(&replication_state, REPLICATION_ACTIVE);
+    printf(YELLOW "%s, this server is now the active one.\n" RESET, reason);
+}
+
+
+// Function to stop serving clients when the peer is active as well, the standby of the configuration gives way
+static void become_standby() {
+    atomic_store(&replication_state, REPLICATION_STANDBY);
+    need_sync = 1;
+    syncing = 0;
+    stream_session = 0;
+    printf(YELLOW "The failover peer is active, this server is now its standby.\n" RESET);
+}
+
+
+// Copy of the leases gathered for a full sync, it is sent once no shard is locked
+typedef struct {
+    replication_record_t *records;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t dropped;  // Records that did not fit, counted in the total so the standby asks for another copy
+} sync_copy_t;
+
+
+// Function called for each address of the pool bound to a client during a full sync
+static void sync_binding(const lease_info_t *lease, const client_binding_t *binding, void *arg) {
+    sync_copy_t *copy = (sync_copy_t *)arg;
+    if (copy->count == copy->capacity) {
+        uint32_t capacity = copy->capacity ? copy->capacity * 2 : 4096;
+        replication_record_t *records = (replication_record_t *)realloc(copy->records, capacity * sizeof(replication_record_t));
+        if (records == NULL) {
+            copy->dropped++;
+            return;
+        }
+        copy->records = records;
+        copy->capacity = capacity;
+    }
+
+    lease_record_type_t type = lease->is_assigned ? LEASE_RECORD_BOUND : LEASE_RECORD_RELEASED;
+    fill_replication_record(&copy->records[copy->count++], type, lease->ip_address, binding->client_id, binding->client_id_len, lease->lease_start, lease->lease_duration);
+}
+
+
+// Function to send a full copy of the leases, the stream goes on from the first change after the copy started
+// Every change before it is already in the pool when the copy reads its shard, later ones are sent again by the stream
+static void send_full_sync() {
+    pthread_mutex_lock(&ring_mutex);
+    uint64_t seq = head_seq;
+    acked_seq = head_seq;
+    overflowed = 0;
+    pthread_mutex_unlock(&ring_mutex);
+
+    sync_copy_t copy = { NULL, 0, 0, 0 };
+    for_each_binding(sync_binding, &copy);
+
+    // The copy goes out in bursts, with a pause after each so the standby keeps up
+    send_replication_message(REPLICATION_SYNC_BEGIN, 0, session, seq, 0, NULL, 0);
+    for (uint32_t sent = 0, messages = 0; sent < copy.count; sent += REPLICATION_BATCH) {
+        int count = copy.count - sent < REPLICATION_BATCH ? (int)(copy.count - sent) : REPLICATION_BATCH;
+        send_replication_message(REPLICATION_SYNC, 0, session, seq, 0, &copy.records[sent], count);
+        if (++messages % REPLICATION_SYNC_BURST == 0)
+            usleep(1000);
+    }
+    send_replication_message(REPLICATION_SYNC_END, 0, session, seq, copy.count + copy.dropped, NULL, 0);
+    free(copy.records);
+
+    sent_seq = seq;
+    sync_requested = 0;
+    last_sync = last_progress = now_ms();
+    printf(CYAN "Full sync of %u leases sent to the failover peer.\n" RESET, copy.count);
+}
+
+
+// Function to handle a message of the peer
+static void handle_replication_message(const uint8_t *buffer, ssize_t length) {
+    const replication_header_t *header = (const replication_header_t *)buffer;
+    if (length < (ssize_t)sizeof(*header) || ntohl(header->magic) != REPLICATION_MAGIC || header->count > REPLICATION_BATCH ||
+        length < (ssize_t)(sizeof(*header) + header->count * sizeof(replication_record_t)))
+        return;
+
+    const replication_record_t *records = (const replication_record_t *)(buffer + sizeof(*header));
+    uint32_t message_session = ntohl(header->session);
+    uint64_t seq = ntoh64(header->seq);
+    uint64_t now = now_ms();
+    peer_heard = now;
+
+    int state = atomic_load(&replication_state);
+    if (header->state == REPLICATION_ACTIVE) {
+        if (state == REPLICATION_STARTING || (state == REPLICATION_ACTIVE && !is_primary))
+            become_standby();
+        state = atomic_load(&replication_state);
+    }
+
+    if (state == REPLICATION_ACTIVE) {
+        if (header->type != REPLICATION_ACK)
+            return;
+        // The last ack says whether the standby still needs a full copy
+        sync_requested = (header->flags & REPLICATION_NEED_SYNC) || message_session != session;
+        if (sync_requested)
+            return;
+
+        pthread_mutex_lock(&ring_mutex);
+        if (seq > acked_seq && seq <= head_seq) {
+            acked_seq = seq;
+            last_progress = now;
+        }
+        pthread_mutex_unlock(&ring_mutex);
+        return;
+    }
+
+    if (state != REPLICATION_STANDBY || header->state != REPLICATION_ACTIVE)
+        return;
+
+    switch (header->type) {
+    case REPLICATION_DATA:
+        if (need_sync || message_session != stream_session) {
+            need_sync = 1;
+        } else if (seq <= expected_seq && expected_seq < seq + header->count) {
+            // Changes already applied are skipped, a gap is left for the retransmission
+            for (uint64_t s = expected_seq; s < seq + header->count; s++)
+                apply_replication_record(&records[s - seq]);
+            expected_seq = seq + header->count;
+        }
+        ack_due = 1;
+        break;
+
+    case REPLICATION_HEARTBEAT:
+        if (message_session != stream_session)
+            need_sync = 1;
+        ack_due = 1;
+        break;
+
+    case REPLICATION_SYNC_BEGIN:
+        clear_leases();
+        stream_session = message_session;
+        syncing = 1;
+        sync_received = 0;
+        break;
+
+    case REPLICATION_SYNC:
+        if (syncing && message_session == stream_session) {
+            for (int i = 0; i < header->count; i++)
+                apply_replication_record(&records[i]);
+            sync_received += header->count;
+        }
+        break;
+
+    case REPLICATION_SYNC_END:
+        if (syncing && message_session == stream_session && sync_received == ntohl(header->total)) {
+            need_sync = 0;
+            expected_seq = seq;
+            printf(CYAN "Full sync of %u leases received from the active server.\n" RESET, sync_received);
+        } else {
+            printf(RED "The full sync from the active server lost records, asking for another one.\n" RESET);
+        }
+        syncing = 0;
+        ack_due = 1;
+        break;
+    }
+}
+
+
+// Function to send the changes the standby has not acked, or a heartbeat when there are none
+static void stream_changes(uint64_t now) {
+    pthread_mutex_lock(&ring_mutex);
+    int must_sync = overflowed;
+    pthread_mutex_unlock(&ring_mutex);
+
+    // A standby that is alive but lost changes gets a full copy, a silent one gets it once it asks
+    int peer_alive = peer_heard != 0 && now - peer_heard < REPLICATION_DEADLINE_MS;
+    if ((sync_requested || (must_sync && peer_alive)) && now - last_sync >= REPLICATION_DEADLINE_MS)
+        send_full_sync();
+
+    pthread_mutex_lock(&ring_mutex);
+    uint64_t head = head_seq;
+    uint64_t acked = acked_seq;
+    if (!overflowed) {
+        if (sent_seq < acked)
+            sent_seq = acked;
+        if (acked < sent_seq && now - last_progress >= REPLICATION_RETRANSMIT_MS) {
+            sent_seq = acked;  // Go back to the first change without an ack
+            last_progress = now;
+        }
+        if (acked == sent_seq && sent_seq < head)
+            last_progress = now;
+    }
+
+    while (!overflowed && sent_seq < head) {
+        replication_record_t records[REPLICATION_BATCH];
+        int count = head - sent_seq < REPLICATION_BATCH ? (int)(head - sent_seq) : REPLICATION_BATCH;
+        for (int i = 0; i < count; i++)
+            records[i] = ring[(sent_seq + i) % REPLICATION_WINDOW];
+        uint64_t seq = sent_seq;
+        sent_seq += count;
+
+        pthread_mutex_unlock(&ring_mutex);
+        send_replication_message(REPLICATION_DATA, 0, session, seq, 0, records, count);
+        pthread_mutex_lock(&ring_mutex);
+    }
+    pthread_mutex_unlock(&ring_mutex);
+
+    if (now - last_sent >= REPLICATION_HEARTBEAT_MS)
+        send_replication_message(REPLICATION_HEARTBEAT, 0, session, head, 0, NULL, 0);
+}
+
+
+// Function run by the replication thread, it sends and receives every message of the pair so the workers never wait on the peer
+static void *replication_thread(void *arg) {
+    (void)arg;
+    uint8_t buffer[REPLICATION_MESSAGE_SIZE];
+    uint64_t started = now_ms();
+
+    while (!atomic_load(&replication_stopping)) {
+        struct pollfd descriptor = { .fd = replication_fd, .events = POLLIN };
+        if (poll(&descriptor, 1, REPLICATION_TICK_MS) > 0) {
+            struct sockaddr_in from;
+            socklen_t from_length = sizeof(from);
+            ssize_t length;
+            while ((length = recvfrom(replication_fd, buffer, sizeof(buffer), MSG_DONTWAIT, (struct sockaddr *)&from, &from_length)) >= 0) {
+                if (from.sin_addr.s_addr == peer_address.sin_addr.s_addr && from.sin_port == peer_address.sin_port)
+                    handle_replication_message(buffer, length);
+                from_length = sizeof(from);
+            }
+        }
+
+        uint64_t now = now_ms();
+        switch (atomic_load(&replication_state)) {
+        case REPLICATION_ACTIVE:
+            stream_changes(now);
+            break;
+
+        case REPLICATION_STARTING:
+            if (now - started >= REPLICATION_DEADLINE_MS)
+                become_active("No active failover peer");
+            break;
+
+        case REPLICATION_STANDBY:
+            // The standby waits twice as long at startup, so a primary starting at the same time comes up first
+            if (now >= (peer_heard != 0 ? peer_heard : started + REPLICATION_DEADLINE_MS) + REPLICATION_DEADLINE_MS) {
+                become_active("The active server stopped answering");
+                break;
+            }
+            if (ack_due || now - last_sent >= REPLICATION_HEARTBEAT_MS) {
+                send_replication_message(REPLICATION_ACK, need_sync ? REPLICATION_NEED_SYNC : 0, stream_session, expected_seq, 0, NULL, 0);
+                ack_due = 0;
+            }
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+// Function to open the replication socket and start the replication thread, with FAILOVER_ROLE unset it does nothing
+int lease_replication_start() {
+    if (strlen(failover_role) == 0)
+        return 0;
+
+    struct sockaddr_in local_address;
+    is_primary = strcmp(failover_role, "primary") == 0;
+    if ((!is_primary && strcmp(failover_role, "standby") != 0) || parse_endpoint(failover_address, &local_address) != 0 ||
+        parse_endpoint(failover_peer, &peer_address) != 0) {
+        printf(RED "FAILOVER_ROLE must be primary or standby, and FAILOVER_ADDRESS and FAILOVER_PEER addresses as ip:port.\n" RESET);
+        return -1;
+    }
+
+    replication_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (replication_fd < 0 || bind(replication_fd, (struct sockaddr *)&local_address, sizeof(local_address)) < 0) {
+        printf(RED "Failed to open the failover socket on %s: %s\n" RESET, failover_address, strerror(errno));
+        return -1;
+    }
+
+    // A full sync arrives in a burst, the buffer holds a few thousand messages of it
+    int buffer_size = 4 << 20;
+    setsockopt(replication_fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    setsockopt(replication_fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+
+    // Neither server answers clients before it knows whether its peer is active
+    atomic_store(&replication_state, is_primary ? REPLICATION_STARTING : REPLICATION_STANDBY);
+
+    if (pthread_create(&replication_id, NULL, replication_thread, NULL) != 0) {
+        printf(RED "Failed to start the replication thread.\n" RESET);
+        return -1;
+    }
+    replication_started = 1;
+
+    printf(GREEN "Failover %s on %s, peer %s\n" RESET, failover_role, failover_address, failover_peer);
+    return 0;
+}
+
+
+// Function to queue a lease change for the standby, it never waits for the network
+void lease_replication_append(lease_record_type_t type, uint32_t ip, const uint8_t *client_id, int client_id_len, time_t lease_start, int lease_duration) {
+    if (replication_fd < 0 || atomic_load(&replication_state) != REPLICATION_ACTIVE)
+        return;
+
+    pthread_mutex_lock(&ring_mutex);
+    if (head_seq - acked_seq >= REPLICATION_WINDOW)
+        overflowed = 1;
+    fill_replication_record(&ring[head_seq % REPLICATION_WINDOW], type, ip, client_id, client_id_len, lease_start, lease_duration);
+    head_seq++;
+    pthread_mutex_unlock(&ring_mutex);
+}
+
+
+// Function to check if this server answers clients
+int lease_replication_is_active() {
+    return atomic_load(&replication_state) == REPLICATION_ACTIVE;
+}
+
+
+// Function to stop the replication thread and wait for it, so it no longer applies changes to the pool
+void lease_replication_stop() {
+    if (!replication_started)
+        return;
+
+    atomic_store(&replication_stopping, 1);
+    pthread_join(replication_id, NULL);
+    replication_started = 0;
+}
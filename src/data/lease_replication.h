@@ -0,0 +1,76 @@
+#ifndef LEASE_REPLICATION_H
+#define LEASE_REPLICATION_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "./lease_journal.h" // For lease_record_type_t
+
+#define REPLICATION_MAGIC 0x44485250  // "DHRP", first bytes of every replication message
+#define REPLICATION_BATCH 44          // Most records in one message, it stays below the MTU of Ethernet
+#define REPLICATION_WINDOW 65536      // Changes kept until the standby acks them, a standby further behind gets a full sync
+#define REPLICATION_TICK_MS 5         // Longest a change waits before it is sent, changes of the same tick share messages
+#define REPLICATION_HEARTBEAT_MS 200  // An idle active server sends a heartbeat this often, and the standby an ack
+#define REPLICATION_RETRANSMIT_MS 100 // Unacked changes are sent again after this long
+#define REPLICATION_DEADLINE_MS 1000  // A standby that hears nothing from the active server for this long takes over
+#define REPLICATION_SYNC_BURST 32     // Messages of a full sync sent before pausing for a millisecond
+
+
+// Role of this server in the pair, only the active one answers clients
+typedef enum {
+    REPLICATION_ACTIVE = 0,    // Also the state of a server without a peer
+    REPLICATION_STANDBY = 1,   // Keeps a copy of the leases of the active server
+    REPLICATION_STARTING = 2   // A primary listens for an active peer before it serves
+} replication_state_t;
+
+// Kind of replication message
+typedef enum {
+    REPLICATION_DATA = 1,        // Changes seq to seq + count - 1
+    REPLICATION_ACK = 2,         // The standby has every change before seq
+    REPLICATION_HEARTBEAT = 3,   // The active server is alive, seq is its next change
+    REPLICATION_SYNC_BEGIN = 4,  // The standby drops its leases, a full copy follows and the stream goes on at seq
+    REPLICATION_SYNC = 5,        // Part of the full copy
+    REPLICATION_SYNC_END = 6     // End of the full copy, total records were sent
+} replication_message_type_t;
+
+#define REPLICATION_NEED_SYNC 1  // Flag of an ack, the standby has no usable copy
+
+// Header of every message, each field in network order
+typedef struct {
+    uint32_t magic;
+    uint8_t type;       // replication_message_type_t
+    uint8_t count;      // Records after the header
+    uint8_t flags;
+    uint8_t state;      // replication_state_t of the sender
+    uint32_t session;   // Run of the active server the stream comes from, a new session needs a full sync
+    uint32_t total;     // Records of a full copy, in REPLICATION_SYNC_END
+    uint64_t seq;
+} replication_header_t;
+
+// Lease change as sent to the standby, each field in network order
+typedef struct {
+    uint8_t type;              // lease_record_type_t
+    uint8_t client_id_len;
+    uint16_t reserved;
+    uint32_t ip;
+    uint32_t lease_start;      // Seconds since LEASE_EPOCH
+    uint32_t lease_duration;
+    uint8_t client_id[CLIENT_ID_SIZE];
+} replication_record_t;
+
+#define REPLICATION_MESSAGE_SIZE (sizeof(replication_header_t) + REPLICATION_BATCH * sizeof(replication_record_t))
+
+
+// Function to open the replication socket and start the replication thread, with FAILOVER_ROLE unset it does nothing
+int lease_replication_start();
+
+// Function to queue a lease change for the standby, it never waits for the network
+void lease_replication_append(lease_record_type_t type, uint32_t ip, const uint8_t *client_id, int client_id_len, time_t lease_start, int lease_duration);
+
+// Function to check if this server answers clients
+int lease_replication_is_active();
+
+// Function to stop the replication thread and wait for it, so it no longer applies changes to the pool
+void lease_replication_stop();
+
+#endif
@@ -0,0 +1,212 @@
+#include "./load_balancing.h"
+#include "../config/env.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+
+// Permutation of 0-255 of the hash of RFC 3074 (Pearson's hash), every server must use the same one
+static const uint8_t lb_permutation[256] = {
+    251, 175, 119, 215,  81,  14,  79, 191, 103,  49, 181, 143, 186, 157,   0, 232,
+     31,  32,  55,  60, 152,  58,  17, 237, 174,  70, 160, 144, 220,  90,  57, 223,
+     59,   3,  18, 140, 111, 166, 203, 196, 134, 243, 124,  95, 222, 179, 197,  65,
+    180,  48,  36,  15, 107,  46, 233, 130, 165,  30, 123, 161, 209,  23,  97,  16,
+     40,  91, 219,  61, 100,  10, 210, 109, 250, 127,  22, 138,  29, 108, 244,  67,
+    207,   9, 178, 204,  74,  98, 126, 249, 167, 116,  34,  77, 193, 200, 121,   5,
+     20, 113,  71,  35, 128,  13, 182,  94,  25, 226, 227, 199,  75,  27,  41, 245,
+    230, 224,  43, 225, 177,  26, 155, 150, 212, 142, 218, 115, 241,  73,  88, 105,
+     39, 114,  62, 255, 192, 201, 145, 214, 168, 158, 221, 148, 154, 122,  12,  84,
+     82, 163,  44, 139, 228, 236, 205, 242, 217,  11, 187, 146, 159,  64,  86, 239,
+    195,  42, 106, 198, 118, 112, 184, 172,  87,   2, 173, 117, 176, 229, 247, 253,
+    137, 185,  99, 164, 102, 147,  45,  66, 231,  52, 141, 211, 194, 206, 246, 238,
+     56, 110,  78, 248,  63, 240, 189,  93,  92,  51,  53, 183,  19, 171,  72,  50,
+     33, 104, 101,  69,   8, 252,  83, 120,  76, 135,  85,  54, 202, 125, 188, 213,
+     96, 235, 136, 208, 162, 129, 190, 132, 156,  38,  47,   1,   7, 254,  24,   4,
+    216, 131,  89,  21,  28, 133,  37, 153, 149,  80, 170,  68,   6, 169, 234, 151
+};
+
+// Servers of LB_PEERS and when each one was last heard, written only by the load balancing thread
+static struct sockaddr_in lb_addresses[LB_MAX_SERVERS];
+static uint64_t lb_heard[LB_MAX_SERVERS];
+static uint32_t lb_live = 0;  // Bit s set while server s is live, this server always is
+static int lb_fd = -1;
+
+// Bit b set while this server answers the clients of bucket b, read by the workers without a lock
+static _Atomic uint64_t owned_buckets[LB_BUCKETS / 64];
+
+
+// Function to get a monotonic clock in milliseconds
+static uint64_t now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+
+// Function to parse an address written as ip:port, returns -1 if it is not valid
+static int parse_endpoint(const char *text, struct sockaddr_in *address) {
+    char ip[16];
+    int endpoint_port;
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    if (sscanf(text, " %15[^:]:%d", ip, &endpoint_port) != 2 || endpoint_port <= 0 || endpoint_port > 65535 || inet_pton(AF_INET, ip, &address->sin_addr) != 1)
+        return -1;
+    address->sin_port = htons((uint16_t)endpoint_port);
+    return 0;
+}
+
+
+// Function to hash a client identifier to its bucket, the hash of RFC 3074 section 6
+static uint8_t lb_hash(const uint8_t *client_id, int client_id_len) {
+    uint8_t hash = (uint8_t)client_id_len;
+    for (int i = client_id_len; i > 0;)
+        hash = lb_permutation[hash ^ client_id[--i]];
+    return hash;
+}
+
+
+// Function to score a server for a bucket, the live server with the highest score owns the bucket
+// A server that goes down only moves its own buckets, each one to the server that scores next for it
+static uint32_t lb_score(int bucket, int server) {
+    uint32_t x = (uint32_t)bucket * 0x9e3779b1u ^ (uint32_t)(server + 1) * 0x85ebca6bu;
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+
+// Function to give every bucket to a live server, the workers see the new buckets of this server at once
+static void assign_buckets() {
+    uint64_t owned[LB_BUCKETS / 64] = { 0 };
+    int count = 0;
+
+    for (int bucket = 0; bucket < LB_BUCKETS; bucket++) {
+        int owner = lb_index;
+        for (int s = 0; s < lb_server_count; s++) {
+            if ((lb_live & (1u << s)) && lb_score(bucket, s) > lb_score(bucket, owner))
+                owner = s;
+        }
+        if (owner == lb_index) {
+            owned[bucket / 64] |= 1ULL << (bucket % 64);
+            count++;
+        }
+    }
+
+    for (int w = 0; w < LB_BUCKETS / 64; w++)
+        atomic_store(&owned_buckets[w], owned[w]);
+    printf(YELLOW "Load balancing: %d of %d servers live, this server answers %d of %d buckets.\n" RESET,
+        __builtin_popcount(lb_live), lb_server_count, count, LB_BUCKETS);
+}
+
+
+// Function of the load balancing thread, it sends the heartbeats and notices peers that go down or come back
+static void *load_balancing_thread(void *arg) {
+    (void)arg;
+    uint64_t last_sent = 0;
+
+    while (1) {
+        struct pollfd descriptor = { .fd = lb_fd, .events = POLLIN };
+        if (poll(&descriptor, 1, LB_HEARTBEAT_MS / 2) > 0) {
+            lb_heartbeat_t heartbeat;
+            struct sockaddr_in from;
+            socklen_t from_length = sizeof(from);
+            while (recvfrom(lb_fd, &heartbeat, sizeof(heartbeat), MSG_DONTWAIT, (struct sockaddr *)&from, &from_length) == (ssize_t)sizeof(heartbeat)) {
+                uint32_t index = ntohl(heartbeat.index);
+                if (ntohl(heartbeat.magic) == LB_MAGIC && index < (uint32_t)lb_server_count &&
+                    from.sin_addr.s_addr == lb_addresses[index].sin_addr.s_addr && from.sin_port == lb_addresses[index].sin_port)
+                    lb_heard[index] = now_ms();
+                from_length = sizeof(from);
+            }
+        }
+
+        uint64_t now = now_ms();
+        if (now - last_sent >= LB_HEARTBEAT_MS) {
+            lb_heartbeat_t heartbeat = { htonl(LB_MAGIC), htonl((uint32_t)lb_index) };
+            for (int s = 0; s < lb_server_count; s++) {
+                if (s != lb_index)
+                    sendto(lb_fd, &heartbeat, sizeof(heartbeat), 0, (struct sockaddr *)&lb_addresses[s], sizeof(lb_addresses[s]));
+            }
+            last_sent = now;
+        }
+
+        uint32_t live = 1u << lb_index;
+        for (int s = 0; s < lb_server_count; s++) {
+            if (now - lb_heard[s] < LB_DEADLINE_MS)
+                live |= 1u << s;
+        }
+        if (live != lb_live) {
+            lb_live = live;
+            assign_buckets();
+        }
+    }
+
+    return NULL;
+}
+
+
+// Function to open the heartbeat socket and start the load balancing thread, with LB_PEERS unset it does nothing
+int load_balancing_start() {
+    if (lb_server_count == 0)
+        return 0;
+
+    if (lb_server_count > LB_MAX_SERVERS) {
+        printf(RED "LB_PEERS may list at most %d servers.\n" RESET, LB_MAX_SERVERS);
+        return -1;
+    }
+
+    const char *peer = lb_peers;
+    for (int s = 0; s < lb_server_count; s++) {
+        if (parse_endpoint(peer, &lb_addresses[s]) != 0) {
+            printf(RED "LB_PEERS must list the servers as ip:port, separated by commas.\n" RESET);
+            return -1;
+        }
+        const char *comma = strchr(peer, ',');
+        if (comma != NULL)
+            peer = comma + 1;
+    }
+
+    lb_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (lb_fd < 0 || bind(lb_fd, (struct sockaddr *)&lb_addresses[lb_index], sizeof(lb_addresses[lb_index])) < 0) {
+        printf(RED "Failed to open the load balancing socket: %s\n" RESET, strerror(errno));
+        return -1;
+    }
+
+    // Every peer counts as live until it misses its first deadline, so the servers of a group starting together split the buckets at once
+    uint64_t now = now_ms();
+    for (int s = 0; s < lb_server_count; s++)
+        lb_heard[s] = now;
+    lb_live = lb_server_count == 32 ? ~0u : (1u << lb_server_count) - 1;
+    assign_buckets();
+
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, load_balancing_thread, NULL) != 0) {
+        printf(RED "Failed to start the load balancing thread.\n" RESET);
+        return -1;
+    }
+    pthread_detach(thread_id);
+
+    printf(GREEN "Load balancing as server %d of %d\n" RESET, lb_index, lb_server_count);
+    return 0;
+}
+
+
+// Function to check if this server answers a client, with the hash of RFC 3074 over its identifier (chaddr)
+int load_balancing_owns(const uint8_t *client_id, int client_id_len) {
+    if (lb_fd < 0)
+        return 1;  // A server alone answers everyone
+
+    uint8_t bucket = lb_hash(client_id, client_id_len);
+    return (atomic_load(&owned_buckets[bucket / 64]) & (1ULL << (bucket % 64))) != 0;
+}
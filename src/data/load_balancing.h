@@ -0,0 +1,26 @@
+#ifndef LOAD_BALANCING_H
+#define LOAD_BALANCING_H
+
+#include <stdint.h>
+
+#define LB_MAGIC 0x44484c42        // "DHLB", first bytes of every heartbeat between load balanced servers
+#define LB_BUCKETS 256             // Hash buckets of RFC 3074, each one served by a single live server
+#define LB_MAX_SERVERS 32          // Most servers LB_PEERS may list
+#define LB_HEARTBEAT_MS 200        // Each server tells every peer it is alive this often
+#define LB_DEADLINE_MS 1000        // A peer silent for this long is down, its buckets go to the live servers
+
+
+// Heartbeat sent to every peer, each field in network order
+typedef struct {
+    uint32_t magic;
+    uint32_t index;     // Place of the sender in LB_PEERS
+} lb_heartbeat_t;
+
+
+// Function to open the heartbeat socket and start the load balancing thread, with LB_PEERS unset it does nothing
+int load_balancing_start();
+
+// Function to check if this server answers a client, with the hash of RFC 3074 over its identifier (chaddr)
+int load_balancing_owns(const uint8_t *client_id, int client_id_len);
+
+#endif
@@ -9,6 +9,13 @@
 
 #include <arpa/inet.h> // For htonl, ntohl, htons, ntohs
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h> // To check several datagrams of a batch at once
+#endif
+
+#define CLASSIFY_LANES 8 // Datagrams whose headers are checked together, one 32-bit lane each
+#define CLASSIFY_CLIENT_SLOTS 128 // Open addressing table of the clients of a batch, a power of two at least twice MAX_BATCH_SIZE
+
 
 // Function to initialize a DHCP message structure with default values
 void init_dhcp_message(dhcp_message_t *msg)
@@ -26,10 +33,11 @@ void init_dhcp_message(dhcp_message_t *msg)
     // Use a random transaction ID
     msg->xid = rand();
     msg->secs = 0;              // No seconds elapsed
-    msg->flags = htons(0x8000); // Broadcast flag set
+    msg->flags = 0x8000;        // Broadcast flag set, in host order like the other fields until the message is built
+    msg->magic_cookie = htonl(DHCP_MAGIC_COOKIE);
 }
 
-// Function to parse raw data into a dhcp_message_t structure
+// Function to parse raw data into a dhcp_message_t structure, the fields end up in host order and the magic cookie as it came
 int parse_dhcp_message(const uint8_t *buffer, dhcp_message_t *msg)
 {
     if (!buffer || !msg)
@@ -50,6 +58,251 @@ int parse_dhcp_message(const uint8_t *buffer, dhcp_message_t *msg)
     return 0; // Success
 }
 
+// Function to validate a received message in place, returns a view over the buffer (fields in network order) or NULL
+const dhcp_message_t *view_dhcp_message(const uint8_t *buffer, size_t length)
+{
+    if (!buffer || length < DHCP_MIN_MESSAGE_LENGTH)
+        return NULL; // Too short to hold the header and the message type
+
+    if ((uintptr_t)buffer % _Alignof(dhcp_message_t) != 0)
+        return NULL; // The fields could not be read in place
+
+    return (const dhcp_message_t *)buffer;
+}
+
+// Function to check the magic cookie and index the options of a message of length bytes, returns -1 if it is not a valid DHCP message
+// The options are walked once, an option running past the end of the datagram makes the whole message invalid
+// An option that appears twice keeps its first value, a missing end option is tolerated
+int index_dhcp_options(const dhcp_message_t *msg, size_t length, dhcp_option_index_t *index)
+{
+    memset(index->present, 0, sizeof(index->present));
+    index->options = msg->options;
+    index->message_type = 0;
+
+    if (length < offsetof(dhcp_message_t, options) || ntohl(msg->magic_cookie) != DHCP_MAGIC_COOKIE)
+        return -1; // Not a DHCP message
+
+    size_t end = length - offsetof(dhcp_message_t, options);
+    if (end > DHCP_OPTIONS_LENGTH)
+        end = DHCP_OPTIONS_LENGTH;
+
+    const uint8_t *options = msg->options;
+    size_t i = 0;
+    while (i < end)
+    {
+        uint8_t option = options[i++];
+        if (option == 255)
+            break; // Fin de las opciones
+        if (option == 0)
+            continue; // Pad
+        if (i >= end || i + 1 + options[i] > end)
+            return -1; // The option runs past the end of the datagram
+
+        uint64_t bit = 1ULL << (option % 64);
+        if (!(index->present[option / 64] & bit))
+        {
+            index->present[option / 64] |= bit; // The first value of a repeated option is kept
+            index->position[option] = (uint16_t)i;
+        }
+        i += 1 + options[i];
+    }
+
+    uint8_t type_length;
+    const uint8_t *type = find_dhcp_option(index, 53, &type_length);
+    if (type != NULL && type_length == 1)
+        index->message_type = *type;
+    return 0;
+}
+
+// Function to find an option of an indexed message, returns its value and sets *length, or NULL if the message does not carry it
+const uint8_t *find_dhcp_option(const dhcp_option_index_t *index, uint8_t code, uint8_t *length)
+{
+    if (!(index->present[code / 64] & (1ULL << (code % 64))))
+        return NULL;
+
+    uint16_t position = index->position[code];
+    *length = index->options[position];
+    return &index->options[position + 1];
+}
+
+// Function to check the headers of up to CLASSIFY_LANES datagrams, gathered one per lane
+// Bit k of the result is set if datagram k is a BOOTREQUEST with a valid hardware address, the magic cookie and room for the message type
+// Bit k + 8 is set if its first option is the message type, as every client puts it, first_option holds its code and length
+static uint32_t check_dhcp_headers(const uint32_t *header, const uint32_t *cookie, const uint32_t *length, const uint32_t *first_option, int count)
+{
+    uint32_t result = 0;
+    int k = 0;
+
+#if defined(__AVX2__)
+    if (count == CLASSIFY_LANES)
+    {
+        // header holds op, htype, hlen and hops from the lowest byte up
+        __m256i headers = _mm256_loadu_si256((const __m256i *)header);
+        __m256i op = _mm256_and_si256(headers, _mm256_set1_epi32(0xff));
+        __m256i htype = _mm256_and_si256(_mm256_srli_epi32(headers, 8), _mm256_set1_epi32(0xff));
+        __m256i hlen = _mm256_and_si256(_mm256_srli_epi32(headers, 16), _mm256_set1_epi32(0xff));
+
+        __m256i valid = _mm256_cmpeq_epi32(op, _mm256_set1_epi32(1));
+        valid = _mm256_and_si256(valid, _mm256_cmpgt_epi32(_mm256_set1_epi32(HARDWARE_ADDR_LEN + 1), hlen));
+        valid = _mm256_andnot_si256(_mm256_andnot_si256(_mm256_cmpeq_epi32(hlen, _mm256_set1_epi32(6)), _mm256_cmpeq_epi32(htype, _mm256_set1_epi32(1))), valid);
+        valid = _mm256_and_si256(valid, _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)cookie), _mm256_set1_epi32((int)htonl(DHCP_MAGIC_COOKIE))));
+        valid = _mm256_and_si256(valid, _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i *)length), _mm256_set1_epi32(DHCP_MIN_MESSAGE_LENGTH - 1)));
+
+        // first_option holds the code and the length of the first option
+        __m256i first = _mm256_loadu_si256((const __m256i *)first_option);
+        __m256i typed = _mm256_and_si256(valid, _mm256_cmpeq_epi32(first, _mm256_set1_epi32(53 | 1 << 8)));
+
+        return (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(valid)) | (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(typed)) << 8;
+    }
+#elif defined(__SSE2__)
+    for (; k + 4 <= count; k += 4)
+    {
+        __m128i headers = _mm_loadu_si128((const __m128i *)&header[k]);
+        __m128i op = _mm_and_si128(headers, _mm_set1_epi32(0xff));
+        __m128i htype = _mm_and_si128(_mm_srli_epi32(headers, 8), _mm_set1_epi32(0xff));
+        __m128i hlen = _mm_and_si128(_mm_srli_epi32(headers, 16), _mm_set1_epi32(0xff));
+
+        __m128i valid = _mm_cmpeq_epi32(op, _mm_set1_epi32(1));
+        valid = _mm_and_si128(valid, _mm_cmplt_epi32(hlen, _mm_set1_epi32(HARDWARE_ADDR_LEN + 1)));
+        valid = _mm_andnot_si128(_mm_andnot_si128(_mm_cmpeq_epi32(hlen, _mm_set1_epi32(6)), _mm_cmpeq_epi32(htype, _mm_set1_epi32(1))), valid);
+        valid = _mm_and_si128(valid, _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)&cookie[k]), _mm_set1_epi32((int)htonl(DHCP_MAGIC_COOKIE))));
+        valid = _mm_and_si128(valid, _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *)&length[k]), _mm_set1_epi32(DHCP_MIN_MESSAGE_LENGTH - 1)));
+
+        __m128i first = _mm_loadu_si128((const __m128i *)&first_option[k]);
+        __m128i typed = _mm_and_si128(valid, _mm_cmpeq_epi32(first, _mm_set1_epi32(53 | 1 << 8)));
+
+        result |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(valid)) << k | (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(typed)) << (k + 8);
+    }
+#endif
+
+    // Scalar fallback, for the lanes left over and for compilers without vector extensions
+    for (; k < count; k++)
+    {
+        uint32_t op = header[k] & 0xff, htype = header[k] >> 8 & 0xff, hlen = header[k] >> 16 & 0xff;
+        int valid = op == 1 && hlen <= HARDWARE_ADDR_LEN && (htype != 1 || hlen == 6) &&
+                    cookie[k] == htonl(DHCP_MAGIC_COOKIE) && length[k] >= DHCP_MIN_MESSAGE_LENGTH;
+        if (valid)
+            result |= 1u << k;
+        if (valid && first_option[k] == (53 | 1 << 8))
+            result |= 1u << (k + 8);
+    }
+    return result;
+}
+
+// Function to get the group of a message type in a classified batch, DISCOVERs first, then REQUESTs and RELEASEs
+static int class_group(uint8_t type)
+{
+    return type == DHCP_DISCOVER ? 0 : type == DHCP_REQUEST ? 1 : 2;
+}
+
+// Function to number the messages of each client in a classified batch, round[c] is how many messages of the client of class c come before it
+// Returns the highest round
+static int number_client_rounds(const dhcp_packet_class_t *classes, int count, uint8_t *round)
+{
+    int16_t clients[CLASSIFY_CLIENT_SLOTS]; // Class + 1 of the last message of each client, 0 for an empty slot
+    memset(clients, 0, sizeof(clients));
+    int highest = 0;
+
+    for (int c = 0; c < count; c++)
+    {
+        // FNV-1a of the hardware address, the same bytes the pool identifies the client by
+        uint32_t hash = 2166136261u;
+        for (int i = 0; i < classes[c].hlen; i++)
+            hash = (hash ^ classes[c].chaddr[i]) * 16777619u;
+
+        uint32_t slot = hash & (CLASSIFY_CLIENT_SLOTS - 1);
+        round[c] = 0;
+        while (clients[slot] != 0)
+        {
+            const dhcp_packet_class_t *last = &classes[clients[slot] - 1];
+            if (last->hlen == classes[c].hlen && memcmp(last->chaddr, classes[c].chaddr, classes[c].hlen) == 0)
+            {
+                round[c] = round[clients[slot] - 1] + 1;
+                break;
+            }
+            slot = (slot + 1) & (CLASSIFY_CLIENT_SLOTS - 1);
+        }
+        clients[slot] = (int16_t)(c + 1);
+        if (round[c] > highest)
+            highest = round[c];
+    }
+    return highest;
+}
+
+// Function to validate a batch of at most MAX_BATCH_SIZE received datagrams and group the DHCP requests the server handles by message type
+// The headers of the batch are gathered and checked several at a time, only a message whose type is not its first option is walked
+// Returns how many classes were written, DISCOVERs first, then REQUESTs and RELEASEs, every other datagram is left out
+// The n-th message of a client goes in round n and each round is grouped on its own, so a client is answered in the order it sent its messages
+int classify_dhcp_batch(const uint8_t *const *buffers, const size_t *lengths, int count, dhcp_packet_class_t *classes)
+{
+    int group_count[3] = { 0, 0, 0 }; // DISCOVER, REQUEST, RELEASE
+    int valid_count = 0;
+
+    for (int base = 0; base < count; base += CLASSIFY_LANES)
+    {
+        int lanes = count - base < CLASSIFY_LANES ? count - base : CLASSIFY_LANES;
+        uint32_t header[CLASSIFY_LANES], cookie[CLASSIFY_LANES], length[CLASSIFY_LANES], first_option[CLASSIFY_LANES];
+        for (int k = 0; k < lanes; k++)
+        {
+            const uint8_t *buffer = buffers[base + k];
+            memcpy(&header[k], buffer, 4);
+            memcpy(&cookie[k], buffer + offsetof(dhcp_message_t, magic_cookie), 4);
+            first_option[k] = buffer[offsetof(dhcp_message_t, options)] | buffer[offsetof(dhcp_message_t, options) + 1] << 8;
+            length[k] = lengths[base + k] < 0x7fffffff ? (uint32_t)lengths[base + k] : 0x7fffffff;
+        }
+
+        uint32_t checked = check_dhcp_headers(header, cookie, length, first_option, lanes);
+        for (int k = 0; k < lanes; k++)
+        {
+            if (!(checked & 1u << k))
+                continue; // Not a DHCP request
+
+            const dhcp_message_t *msg = (const dhcp_message_t *)buffers[base + k];
+            uint8_t type = msg->options[2];
+            if (!(checked & 1u << (k + 8)))
+            {
+                // The message type is further in, the options are walked to find it
+                dhcp_option_index_t index;
+                type = index_dhcp_options(msg, lengths[base + k], &index) == 0 ? index.message_type : 0;
+            }
+
+            if (type != DHCP_DISCOVER && type != DHCP_REQUEST && type != DHCP_RELEASE)
+                continue; // A message type the server does not answer
+
+            dhcp_packet_class_t *entry = &classes[valid_count++];
+            entry->slot = (uint16_t)(base + k);
+            entry->type = type;
+            entry->hlen = msg->hlen;
+            memcpy(entry->chaddr, msg->chaddr, HARDWARE_ADDR_LEN);
+            group_count[class_group(type)]++;
+        }
+    }
+
+    // A batch of a single type is already in order
+    if (valid_count < 2 || group_count[0] == valid_count || group_count[1] == valid_count || group_count[2] == valid_count)
+        return valid_count;
+
+    // Counting sort of the classes by round and then by group, the order of the datagrams of a key is kept
+    uint8_t round[MAX_BATCH_SIZE];
+    int keys = 3 * (number_client_rounds(classes, valid_count, round) + 1);
+    int next[3 * MAX_BATCH_SIZE];
+    memset(next, 0, keys * sizeof(int));
+    for (int c = 0; c < valid_count; c++)
+        next[3 * round[c] + class_group(classes[c].type)]++;
+    for (int key = 0, start = 0; key < keys; key++)
+    {
+        int size = next[key];
+        next[key] = start;
+        start += size;
+    }
+
+    dhcp_packet_class_t sorted[MAX_BATCH_SIZE];
+    for (int c = 0; c < valid_count; c++)
+        sorted[next[3 * round[c] + class_group(classes[c].type)]++] = classes[c];
+    memcpy(classes, sorted, valid_count * sizeof(dhcp_packet_class_t));
+    return valid_count;
+}
+
 const char *get_dhcp_message_type_name(uint8_t type)
 {
     switch (type)
@@ -73,30 +326,77 @@ const char *get_dhcp_message_type_name(uint8_t type)
     }
 }
 
-// Function to serialize a dhcp_message_t structure into a raw byte buffer
+// Function to find where the options of a message end, returns their length with the end option and sets *has_end
+// Without an end option it returns the length up to the last complete option, trailing pads left out
+static size_t dhcp_options_end(const uint8_t *options, int *has_end)
+{
+    size_t i = 0, end = 0;
+    *has_end = 0;
+    while (i < DHCP_OPTIONS_LENGTH)
+    {
+        uint8_t option = options[i];
+        if (option == 255)
+        {
+            *has_end = 1;
+            return i + 1; // Fin de las opciones
+        }
+        if (option == 0)
+        {
+            i++; // Pad
+            continue;
+        }
+        if (i + 1 >= DHCP_OPTIONS_LENGTH || i + 2 + options[i + 1] > DHCP_OPTIONS_LENGTH)
+            break; // The option runs past the end of the field
+
+        i += 2 + options[i + 1];
+        end = i;
+    }
+    return end;
+}
+
+// Function to serialize a message with its fields in host order into a raw byte buffer in network order
+// Returns the length to send, the options up to the end option and the padding to the BOOTP minimum, or -1 if the buffer is too small
 int build_dhcp_message(const dhcp_message_t *msg, uint8_t *buffer, size_t buffer_size)
 {
     if (buffer_size < sizeof(dhcp_message_t))
         return -1; // Ensure the buffer is large enough
 
-    // Clear buffer and copy DHCP message
-    memset(buffer, 0, buffer_size);
-    memcpy(buffer, msg, sizeof(dhcp_message_t));
+    dhcp_message_t *wire = (dhcp_message_t *)buffer;
+    memcpy(wire, msg, offsetof(dhcp_message_t, magic_cookie));
 
     // Perform necessary byte-order conversions
-    uint32_t *xid_ptr = (uint32_t *)(buffer + offsetof(dhcp_message_t, xid));
-    *xid_ptr = htonl(msg->xid);
-
-    uint16_t *secs_ptr = (uint16_t *)(buffer + offsetof(dhcp_message_t, secs));
-    *secs_ptr = htons(msg->secs);
-
-    uint16_t *flags_ptr = (uint16_t *)(buffer + offsetof(dhcp_message_t, flags));
-    *flags_ptr = htons(msg->flags);
-
-    // Add end option marker to the options field
-    buffer[offsetof(dhcp_message_t, options) + 3] = 255; // Option 255 marks the end
+    wire->xid = htonl(msg->xid);
+    wire->secs = htons(msg->secs);
+    wire->flags = htons(msg->flags);
+    wire->ciaddr = htonl(msg->ciaddr);
+    wire->yiaddr = htonl(msg->yiaddr);
+    wire->siaddr = htonl(msg->siaddr);
+    wire->giaddr = htonl(msg->giaddr);
+    wire->magic_cookie = htonl(DHCP_MAGIC_COOKIE);
+
+    // Only the options up to the end option are sent, a message without one gets it after its last option
+    int has_end;
+    size_t options_length = dhcp_options_end(msg->options, &has_end);
+    memcpy(wire->options, msg->options, options_length);
+    if (!has_end && options_length < DHCP_OPTIONS_LENGTH)
+        wire->options[options_length++] = 255; // Option 255 marks the end
+
+    size_t length = offsetof(dhcp_message_t, options) + options_length;
+    if (length < BOOTP_MIN_MESSAGE_LENGTH)
+    {
+        memset(buffer + length, 0, BOOTP_MIN_MESSAGE_LENGTH - length);
+        length = BOOTP_MIN_MESSAGE_LENGTH;
+    }
+    return (int)length;
+}
 
-    return 0;
+// Function to get the length to send of a message already in network order, up to its end option and at least the BOOTP minimum
+// The bytes after the end option must already be zero
+size_t dhcp_message_length(const dhcp_message_t *msg)
+{
+    int has_end;
+    size_t length = offsetof(dhcp_message_t, options) + dhcp_options_end(msg->options, &has_end);
+    return length < BOOTP_MIN_MESSAGE_LENGTH ? BOOTP_MIN_MESSAGE_LENGTH : length;
 }
 
 // Function to set the DHCP message type in the options field
@@ -116,11 +416,11 @@ int set_dhcp_message_type(dhcp_message_t *msg, uint8_t type)
     return 0; // Success
 }
 
-void print_dhcp_message(const dhcp_message_t *msg, bool is_client){
+void print_dhcp_message(const dhcp_message_t *msg, const dhcp_option_index_t *index, bool is_client){
     printf(BOLD BLUE "\n==================== DHCP MESSAGE ====================\n" RESET);
 
     printf(BOLD CYAN "Operation Code (op)     " RESET ": " GREEN "%d\n" RESET, msg->op);
-    printf(BOLD CYAN "Transaction ID (xid)    " RESET ": " GREEN "0x%08X\n" RESET, msg->xid);
+    printf(BOLD CYAN "Transaction ID (xid)    " RESET ": " GREEN "0x%08X\n" RESET, is_client ? msg->xid : ntohl(msg->xid));
 
     // Imprimir Client IP (ciaddr)
     struct in_addr client_ip;
@@ -151,76 +451,39 @@ void print_dhcp_message(const dhcp_message_t *msg, bool is_client){
     }
     printf("\n");
 
-    // Parsear las opciones para obtener la submáscara de red antes de imprimir las demás opciones
-    const uint8_t *options = msg->options;
-    size_t options_length = sizeof(msg->options);
-    size_t i = 0;
-    int subnet_mask_found = 0;
-    int dns_server_found = 0;
-    int counter = 0;
-
-    // Buscar la submáscara de red (opción 1)
-    while (i < options_length) {
-        uint8_t option = options[i++];
-        if (option == 255)
-            break; // Fin de las opciones
-        uint8_t length = options[i++];
-
-        if (option == 1 && length == 4) { // Opción 1 es la Subnet Mask
-            printf(BOLD CYAN "Subnet Mask             " RESET ": " GREEN "%d.%d.%d.%d\n" RESET,
-                   options[i], options[i + 1], options[i + 2], options[i + 3]);
-            subnet_mask_found = 1;
-        }
-
-        if (option == 6 && length == 4) { // Opción 6 es el DNS Server
-            printf(BOLD CYAN "DNS Server              " RESET ": " GREEN "%d.%d.%d.%d\n" RESET,
-                   options[i], options[i + 1], options[i + 2], options[i + 3]);
-            dns_server_found = 1;
-        }
-        i += length; // Avanzar al siguiente
-    }
-
-    // Si no se encuentra la submáscara de red, imprimir un valor por defecto o un mensaje
-    if (!subnet_mask_found)
-    {
+    // Las opciones ya están indexadas, cada una se lee directamente
+    uint8_t length;
+    const uint8_t *subnet_mask = find_dhcp_option(index, 1, &length);
+    if (subnet_mask != NULL && length == 4) // Opción 1 es la Subnet Mask
+        printf(BOLD CYAN "Subnet Mask             " RESET ": " GREEN "%d.%d.%d.%d\n" RESET, subnet_mask[0], subnet_mask[1], subnet_mask[2], subnet_mask[3]);
+    else
         printf(BOLD CYAN "Subnet Mask             " RESET ": " RED "Not specified\n" RESET);
-    }
-    if (!dns_server_found)
-    {
+
+    const uint8_t *dns_server = find_dhcp_option(index, 6, &length);
+    if (dns_server != NULL && length == 4) // Opción 6 es el DNS Server
+        printf(BOLD CYAN "DNS Server              " RESET ": " GREEN "%d.%d.%d.%d\n" RESET, dns_server[0], dns_server[1], dns_server[2], dns_server[3]);
+    else
         printf(BOLD CYAN "DNS Server              " RESET ": " RED "Not specified\n" RESET);
-    }
 
     printf(BOLD YELLOW "\n==================== DHCP TYPE ====================\n" RESET);
     printf("\n");
 
-    // Imprimir el resto de las opciones, excluyendo la submáscara de red (opción 1)
-    i = 0;
-    while (i < options_length)
-    {
-        uint8_t option = options[i++];
-        if (option == 255)
-            break; // Fin de las opciones
-        uint8_t length = options[i++];
-
-        switch (option)
-        {
-        case 1: 
-            break;
-
-        case 51: // Lease Time
-            printf(YELLOW "IP Address Lease Time" RESET ": " GREEN "%d seconds\n" RESET, ntohl(*(uint32_t *)&options[i]));
-            break;
-
-        case 53: // DHCP Message Type
-            printf(YELLOW "DHCP Message Type    " RESET ": " RED "%d (%s)\n" RESET, options[i], get_dhcp_message_type_name(options[i]));
-            break;
+    // DHCP Message Type
+    if (find_dhcp_option(index, 53, &length) != NULL)
+        printf(YELLOW "DHCP Message Type    " RESET ": " RED "%d (%s)\n" RESET, index->message_type, get_dhcp_message_type_name(index->message_type));
 
-        default:
-            break;
-        }
-
-        i += length; // Avanzar al siguiente
+    // Lease Time
+    const uint8_t *lease_time = find_dhcp_option(index, 51, &length);
+    if (lease_time != NULL && length == 4) {
+        uint32_t seconds;
+        memcpy(&seconds, lease_time, 4);
+        printf(YELLOW "IP Address Lease Time" RESET ": " GREEN "%u seconds\n" RESET, ntohl(seconds));
     }
 
+    // Server Identifier
+    const uint8_t *server_identifier = find_dhcp_option(index, 54, &length);
+    if (server_identifier != NULL && length == 4)
+        printf(YELLOW "Server Identifier    " RESET ": " GREEN "%d.%d.%d.%d\n" RESET, server_identifier[0], server_identifier[1], server_identifier[2], server_identifier[3]);
+
     printf(BOLD YELLOW "\n======================================================\n" RESET);
 }
@@ -5,7 +5,7 @@
 #include <stddef.h>
 #include <stdbool.h> // For boolean types
 
-#define DHCP_OPTIONS_LENGTH 312 // Maximum length of DHCP options field
+#define DHCP_OPTIONS_LENGTH 308 // Maximum length of DHCP options field, the 312 bytes of RFC 2131 less the magic cookie
 #define HARDWARE_ADDR_LEN 16 // Maximum length of hardware address (MAC address)
 
 #define DHCP_DISCOVER 1
@@ -16,7 +16,9 @@
 #define DHCP_NAK 6
 #define DHCP_RELEASE 7 
 
-#define DHCP_MAGIC_COOKIE 0x63825363
+#define DHCP_MAGIC_COOKIE 0x63825363 // First four bytes of the options field of RFC 2131, kept in its own field of the message
+#define DHCP_MIN_MESSAGE_LENGTH (offsetof(dhcp_message_t, options) + 3) // BOOTP header plus the message type option
+#define BOOTP_MIN_MESSAGE_LENGTH 300 // Messages are padded to the size of a BOOTP message, some relays drop shorter ones
 
 
 // DHCP message structure
@@ -39,22 +41,58 @@ typedef struct {
     uint8_t sname[64];            // Optional server host name
     uint8_t file[128];            // Boot file name
 
+    uint32_t magic_cookie;        // DHCP_MAGIC_COOKIE in network order, a BOOTP message without it carries no DHCP options
     uint8_t options[DHCP_OPTIONS_LENGTH]; // Optional parameters field (e.g., message type, lease time)
 } dhcp_message_t;
 
+// Options of a message indexed by code, built in one pass so that every lookup is a single read
+typedef struct {
+    const uint8_t *options;   // Options field of the indexed message
+    uint64_t present[4];      // Bit c set if the message carries option c, only these bits are cleared for each message
+    uint16_t position[256];   // Place of the length byte of each present option in options
+    uint8_t message_type;     // Value of option 53, 0 if the message has none
+} dhcp_option_index_t;
+
+// Received datagram that passed the batch validation, with what the server needs to pick its handler
+typedef struct {
+    uint16_t slot;                       // Place of the datagram in its batch
+    uint8_t type;                        // DHCP message type
+    uint8_t hlen;                        // Length of the client hardware address, at most HARDWARE_ADDR_LEN
+    uint8_t chaddr[HARDWARE_ADDR_LEN];   // Client hardware address (MAC address)
+} dhcp_packet_class_t;
+
 // Function to initialize a DHCP message structure
 void init_dhcp_message(dhcp_message_t *msg);
 
 // Function to parse raw data into a dhcp_message_t structure
 int parse_dhcp_message(const uint8_t *buffer, dhcp_message_t *msg);
 
-// Function to serialize a dhcp_message_t structure into a raw byte buffer
+// Function to validate a received message in place, returns a view over the buffer (fields in network order) or NULL
+const dhcp_message_t *view_dhcp_message(const uint8_t *buffer, size_t length);
+
+// Function to serialize a message with its fields in host order into a raw byte buffer in network order
+// Returns the length to send, the options up to the end option and the padding to the BOOTP minimum, or -1 if the buffer is too small
 int build_dhcp_message(const dhcp_message_t *msg, uint8_t *buffer, size_t buffer_size);
 
+// Function to get the length to send of a message already in network order, up to its end option and at least the BOOTP minimum
+size_t dhcp_message_length(const dhcp_message_t *msg);
+
 // Function to set the DHCP message type in the options field
 int set_dhcp_message_type(dhcp_message_t *msg, uint8_t type);
 
-// Function to print the contents of a DHCP message
-void print_dhcp_message(const dhcp_message_t *msg, bool is_client);
+// Function to check the magic cookie and index the options of a message of length bytes, returns -1 if it is not a valid DHCP message
+int index_dhcp_options(const dhcp_message_t *msg, size_t length, dhcp_option_index_t *index);
+
+// Function to find an option of an indexed message, returns its value and sets *length, or NULL if the message does not carry it
+const uint8_t *find_dhcp_option(const dhcp_option_index_t *index, uint8_t code, uint8_t *length);
+
+// Function to validate a batch of at most MAX_BATCH_SIZE received datagrams and group the DHCP requests the server handles by message type
+// The buffers must have room for a whole dhcp_message_t whatever the length received
+// Returns how many classes were written, DISCOVERs first, then REQUESTs and RELEASEs, every other datagram is left out
+// Messages of the same client stay in the order they arrived
+int classify_dhcp_batch(const uint8_t *const *buffers, const size_t *lengths, int count, dhcp_packet_class_t *classes);
+
+// Function to print the contents of a DHCP message with the index of its options
+void print_dhcp_message(const dhcp_message_t *msg, const dhcp_option_index_t *index, bool is_client);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "./reply.h"
+#include "../config/env.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+uint32_t server_identifier = 0; // Option 54 of the replies in network order, the address the server listens on, 0 if it listens on every address
+dhcp_message_t *reply_templates = NULL; // Reply of each scope with the fields and options that are the same for every client, built once at startup
+size_t reply_template_length = 0; // Bytes of a template that are sent, every template has the same options so the same length
+
+
+// Function to start an answer in its transmit slot from the header of the request, without copying the request
+void begin_dhcp_reply(dhcp_message_t *reply, const dhcp_message_t *request) {
+    memset(reply, 0, sizeof(*reply));
+
+    reply->op = 2;                    // BOOTREPLY (server to client)
+    reply->htype = request->htype;
+    reply->hlen = request->hlen;
+    reply->xid = request->xid;        // Same transaction as the request
+    reply->flags = htons(0x8000);     // Broadcast flag set
+    reply->magic_cookie = htonl(DHCP_MAGIC_COOKIE);
+    memcpy(reply->chaddr, request->chaddr, HARDWARE_ADDR_LEN);
+    reply->options[3] = 255;          // End of options, after the message type the caller sets
+}
+
+
+// Function to build the reply template of every scope, returns -1 if there is no memory
+// Only the fields of the client are left to fill, so no option is encoded and no address is parsed per packet
+int build_reply_templates() {
+    reply_templates = (dhcp_message_t *)calloc(scope_count, sizeof(dhcp_message_t));
+    if (reply_templates == NULL) {
+        printf(RED "Failed to allocate memory for the reply templates.\n" RESET);
+        return -1;
+    }
+
+    uint32_t siaddr = 0;
+    inet_pton(AF_INET, server_ip, &siaddr);
+
+    for (int s = 0; s < scope_count; s++) {
+        dhcp_message_t *template = &reply_templates[s];
+        template->op = 2;                    // BOOTREPLY (server to client)
+        template->flags = htons(0x8000);     // Broadcast flag set
+        template->magic_cookie = htonl(DHCP_MAGIC_COOKIE);
+        template->siaddr = siaddr;
+        set_dhcp_message_type(template, DHCP_OFFER);
+        add_lease_options(template, &scopes[s]);
+        reply_template_length = dhcp_message_length(template);
+    }
+    return 0;
+}
+
+
+// Function to start an OFFER or ACK of a scope in its transmit slot, a copy of the template of the scope with the fields of the client
+// Only the bytes that are sent are copied, what the slot holds after them is never read
+void begin_scope_reply(dhcp_message_t *reply, const dhcp_message_t *request, const scope_t *scope, uint8_t type) {
+    memcpy(reply, &reply_templates[scope - scopes], reply_template_length);
+
+    reply->htype = request->htype;
+    reply->hlen = request->hlen;
+    reply->xid = request->xid;        // Same transaction as the request
+    memcpy(reply->chaddr, request->chaddr, HARDWARE_ADDR_LEN);
+    reply->options[2] = type;         // Value of the message type option, the first option of the template
+}
+
+
+// Function to add the subnet mask, DNS and lease time options of the scope after the message type
+void add_lease_options(dhcp_message_t *reply, const scope_t *scope) {
+    // Add subnet mask (option 1)
+    reply->options[3] = 1;
+    reply->options[4] = 4;
+    uint32_t subnet_mask = htonl(scope->subnet_mask);
+    memcpy(&reply->options[5], &subnet_mask, 4);
+
+    // Add DNS (option 6)
+    reply->options[9] = 6;
+    reply->options[10] = 4;
+    uint32_t dns = htonl(scope->dns);
+    memcpy(&reply->options[11], &dns, 4);
+
+    // Add lease time (option 51)
+    reply->options[15] = 51;
+    reply->options[16] = 4;
+    uint32_t lease_time = htonl(scope->lease_time);
+    memcpy(&reply->options[17], &lease_time, 4);
+
+    // Add server identifier (option 54), the client sends it back in the REQUEST that takes the offer
+    if (server_identifier != 0) {
+        reply->options[21] = 54;
+        reply->options[22] = 4;
+        memcpy(&reply->options[23], &server_identifier, 4);
+
+        // End of options
+        reply->options[27] = 255;
+    } else {
+        // End of options
+        reply->options[21] = 255;
+    }
+}
+
+
+// Function to set giaddr of a reply, a relayed request keeps the address of its relay and any other gets the gateway of its scope
+void set_reply_gateway(dhcp_message_t *reply, const dhcp_message_t *request, const scope_t *scope) {
+    reply->giaddr = request->giaddr != 0 ? request->giaddr : htonl(scope->range_start);
+}
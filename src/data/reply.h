@@ -0,0 +1,30 @@
+#ifndef REPLY_H
+#define REPLY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "./message.h"
+#include "../config/scope.h"
+
+extern uint32_t server_identifier;       // Option 54 of the replies in network order, 0 if the server listens on every address
+extern dhcp_message_t *reply_templates;  // One per scope, in the order of scopes
+extern size_t reply_template_length;     // Bytes of a template that are sent
+
+
+// Function to start an answer in its transmit slot from the header of the request, without copying the request
+void begin_dhcp_reply(dhcp_message_t *reply, const dhcp_message_t *request);
+
+// Function to build the reply template of every scope, returns -1 if there is no memory
+int build_reply_templates();
+
+// Function to start an OFFER or ACK of a scope in its transmit slot, a copy of the template of the scope with the fields of the client
+void begin_scope_reply(dhcp_message_t *reply, const dhcp_message_t *request, const scope_t *scope, uint8_t type);
+
+// Function to add the subnet mask, DNS and lease time options of the scope after the message type
+void add_lease_options(dhcp_message_t *reply, const scope_t *scope);
+
+// Function to set giaddr of a reply, a relayed request keeps the address of its relay and any other gets the gateway of its scope
+void set_reply_gateway(dhcp_message_t *reply, const dhcp_message_t *request, const scope_t *scope);
+
+#endif
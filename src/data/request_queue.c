@@ -0,0 +1,88 @@
+#include "./request_queue.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+
+
+// Function to initialize a queue, the capacity is rounded up to the next power of two
+int request_queue_init(request_queue_t *queue, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+
+    queue->cells = (request_queue_cell_t *)malloc(size * sizeof(request_queue_cell_t));
+    if (queue->cells == NULL)
+        return -1;
+
+    // Each cell starts waiting for the producer with the same position
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&queue->cells[i].sequence, i);
+        queue->cells[i].item = NULL;
+    }
+
+    queue->mask = size - 1;
+    atomic_init(&queue->enqueue_pos, 0);
+    atomic_init(&queue->dequeue_pos, 0);
+    return 0;
+}
+
+
+// Function to free the memory used by a queue
+void request_queue_destroy(request_queue_t *queue) {
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+
+// Function to add an item to the queue, returns false if the queue is full
+bool request_queue_push(request_queue_t *queue, void *item) {
+    request_queue_cell_t *cell;
+    size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+
+    while (1) {
+        cell = &queue->cells[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+        if (diff == 0) {
+            // The cell is free, try to claim it
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return false; // The cell still holds an item from the previous lap, the queue is full
+        } else {
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->item = item;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release); // Publish the item to consumers
+    return true;
+}
+
+
+// Function to take an item from the queue, returns NULL if the queue is empty
+void *request_queue_pop(request_queue_t *queue) {
+    request_queue_cell_t *cell;
+    size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+
+    while (1) {
+        cell = &queue->cells[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            // The cell holds an item, try to claim it
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return NULL; // Nothing published yet, the queue is empty
+        } else {
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    void *item = cell->item;
+    atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release); // Hand the cell back to producers for the next lap
+    return item;
+}
@@ -0,0 +1,38 @@
+#ifndef REQUEST_QUEUE_H
+#define REQUEST_QUEUE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define CACHE_LINE_SIZE 64 // Size of a cache line, used to keep the producer and consumer counters apart
+
+
+// Cell of the queue, the sequence number tells producers and consumers whose turn it is
+typedef struct {
+    atomic_size_t sequence;
+    void *item;
+} request_queue_cell_t;
+
+// Bounded lock-free multi-producer multi-consumer queue of pointers
+typedef struct {
+    request_queue_cell_t *cells;
+    size_t mask; // Capacity - 1, the capacity is always a power of two
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t enqueue_pos;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t dequeue_pos;
+} request_queue_t;
+
+
+// Function to initialize a queue, the capacity is rounded up to the next power of two
+int request_queue_init(request_queue_t *queue, size_t capacity);
+
+// Function to free the memory used by a queue
+void request_queue_destroy(request_queue_t *queue);
+
+// Function to add an item to the queue, returns false if the queue is full
+bool request_queue_push(request_queue_t *queue, void *item);
+
+// Function to take an item from the queue, returns NULL if the queue is empty
+void *request_queue_pop(request_queue_t *queue);
+
+#endif
@@ -0,0 +1,172 @@
+#include "./timing_wheel.h"
+
+#include <stdlib.h>
+
+#define ROOT_SIZE (1 << TIMING_WHEEL_ROOT_BITS)
+#define LEVEL_SIZE (1 << TIMING_WHEEL_LEVEL_BITS)
+#define MAX_DISTANCE (1ULL << (TIMING_WHEEL_ROOT_BITS + (TIMING_WHEEL_LEVELS - 1) * TIMING_WHEEL_LEVEL_BITS))
+
+
+// Function to get the first slot of a level in the heads array
+static int level_base(int level) {
+    return level == 0 ? 0 : ROOT_SIZE + (level - 1) * LEVEL_SIZE;
+}
+
+
+// Function to get the bit where the ticks of a level start
+static int level_shift(int level) {
+    return level == 0 ? 0 : TIMING_WHEEL_ROOT_BITS + (level - 1) * TIMING_WHEEL_LEVEL_BITS;
+}
+
+
+// Function to link a node at the slot that matches its deadline
+static void place_node(timing_wheel_t *wheel, int node) {
+    uint64_t deadline = wheel->deadline[node];
+    int slot;
+
+    if (deadline < wheel->current) {
+        // Already late, it goes to the slot processed next
+        slot = (int)(wheel->current & (ROOT_SIZE - 1));
+    } else {
+        // Deadlines beyond the last level wait at its far end and are placed again when they come down
+        if (deadline - wheel->current >= MAX_DISTANCE)
+            deadline = wheel->current + MAX_DISTANCE - 1;
+
+        uint64_t distance = deadline - wheel->current;
+        int level = 0;
+        while (level < TIMING_WHEEL_LEVELS - 1 && distance >= (1ULL << level_shift(level + 1)))
+            level++;
+
+        int mask = level == 0 ? ROOT_SIZE - 1 : LEVEL_SIZE - 1;
+        slot = level_base(level) + (int)((deadline >> level_shift(level)) & mask);
+    }
+
+    wheel->slot[node] = slot + 1;
+    wheel->prev[node] = -1;
+    wheel->next[node] = wheel->heads[slot];
+    if (wheel->heads[slot] >= 0)
+        wheel->prev[wheel->heads[slot]] = node;
+    wheel->heads[slot] = node;
+}
+
+
+// Function to unlink a node from its slot
+static void unlink_node(timing_wheel_t *wheel, int node) {
+    int slot = wheel->slot[node] - 1;
+
+    if (wheel->prev[node] >= 0)
+        wheel->next[wheel->prev[node]] = wheel->next[node];
+    else
+        wheel->heads[slot] = wheel->next[node];
+    if (wheel->next[node] >= 0)
+        wheel->prev[wheel->next[node]] = wheel->prev[node];
+
+    wheel->slot[node] = 0;
+}
+
+
+// Function to move the nodes of a slot of an upper level down to the levels below
+static void cascade(timing_wheel_t *wheel, int level) {
+    int slot = level_base(level) + (int)((wheel->current >> level_shift(level)) & (LEVEL_SIZE - 1));
+    int node = wheel->heads[slot];
+    wheel->heads[slot] = -1;
+
+    while (node >= 0) {
+        int next = wheel->next[node];
+        place_node(wheel, node);
+        node = next;
+    }
+}
+
+
+// Function to initialize a wheel for capacity nodes, start is the first tick it will process
+int timing_wheel_init(timing_wheel_t *wheel, int capacity, uint64_t start) {
+    wheel->next = (int32_t *)malloc(capacity * sizeof(int32_t));
+    wheel->prev = (int32_t *)malloc(capacity * sizeof(int32_t));
+    wheel->slot = (int32_t *)calloc(capacity, sizeof(int32_t));  // Zero pages, nothing is touched until a node is scheduled
+    wheel->deadline = (uint64_t *)malloc(capacity * sizeof(uint64_t));
+    if (wheel->next == NULL || wheel->prev == NULL || wheel->slot == NULL || wheel->deadline == NULL) {
+        timing_wheel_destroy(wheel);
+        return -1;
+    }
+
+    for (int i = 0; i < TIMING_WHEEL_SLOTS; i++)
+        wheel->heads[i] = -1;
+
+    wheel->current = start;
+    wheel->capacity = capacity;
+    wheel->scheduled = 0;
+    return 0;
+}
+
+
+// Function to free the memory used by a wheel
+void timing_wheel_destroy(timing_wheel_t *wheel) {
+    free(wheel->next);
+    free(wheel->prev);
+    free(wheel->slot);
+    free(wheel->deadline);
+    wheel->next = wheel->prev = wheel->slot = NULL;
+    wheel->deadline = NULL;
+    wheel->capacity = 0;
+}
+
+
+// Function to make a node due at the given tick, a node that was already scheduled is moved
+void timing_wheel_schedule(timing_wheel_t *wheel, int node, uint64_t deadline) {
+    if (wheel->slot[node] != 0)
+        unlink_node(wheel, node);
+    else
+        wheel->scheduled++;
+
+    wheel->deadline[node] = deadline;
+    place_node(wheel, node);
+}
+
+
+// Function to take a node out of the wheel, nothing happens if it was not scheduled
+void timing_wheel_cancel(timing_wheel_t *wheel, int node) {
+    if (wheel->slot[node] == 0)
+        return;
+
+    unlink_node(wheel, node);
+    wheel->scheduled--;
+}
+
+
+// Function to process every tick up to now, expire is called once for each node that became due
+// Returns how many nodes expired
+int timing_wheel_advance(timing_wheel_t *wheel, uint64_t now, void (*expire)(int node, void *arg), void *arg) {
+    int expired = 0;
+
+    // With nothing scheduled every slot is empty, jump straight to now
+    if (wheel->scheduled == 0) {
+        if (now >= wheel->current)
+            wheel->current = now + 1;
+        return 0;
+    }
+
+    while (wheel->current <= now) {
+        // At the start of each turn of a level, its parent slot for the new turn comes down
+        int index = (int)(wheel->current & (ROOT_SIZE - 1));
+        for (int level = 1; index == 0 && level < TIMING_WHEEL_LEVELS; level++) {
+            cascade(wheel, level);
+            index = (int)((wheel->current >> level_shift(level)) & (LEVEL_SIZE - 1));
+        }
+
+        int slot = (int)(wheel->current & (ROOT_SIZE - 1));
+        while (wheel->heads[slot] >= 0) {
+            int node = wheel->heads[slot];
+            unlink_node(wheel, node);
+            wheel->scheduled--;
+            expired++;
+
+            // The callback may schedule the node again, it is already out of the wheel
+            expire(node, arg);
+        }
+
+        wheel->current++;
+    }
+
+    return expired;
+}
@@ -0,0 +1,42 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <stdint.h>
+
+#define TIMING_WHEEL_ROOT_BITS 8   // The first level has one slot per tick for the next 256 ticks
+#define TIMING_WHEEL_LEVEL_BITS 6  // Every other level has 64 slots, each covering a full turn of the level below
+#define TIMING_WHEEL_LEVELS 4      // Deadlines up to 2^26 ticks away (more than two years of seconds)
+#define TIMING_WHEEL_SLOTS ((1 << TIMING_WHEEL_ROOT_BITS) + (TIMING_WHEEL_LEVELS - 1) * (1 << TIMING_WHEEL_LEVEL_BITS))
+
+
+// Hierarchical timing wheel over nodes numbered 0..capacity-1, every node holds at most one deadline
+// The links live in arrays indexed by node so scheduling never allocates, and only the pages of nodes ever scheduled are touched
+typedef struct {
+    int32_t *next;      // Next node in the same slot, -1 at the end
+    int32_t *prev;      // Previous node in the same slot, -1 at the head
+    int32_t *slot;      // Slot holding the node plus one, 0 while it is not scheduled
+    uint64_t *deadline; // Tick at which the node is due
+    int32_t heads[TIMING_WHEEL_SLOTS];
+    uint64_t current;   // Next tick to process
+    int capacity;
+    int scheduled;      // Nodes waiting in the wheel
+} timing_wheel_t;
+
+
+// Function to initialize a wheel for capacity nodes, start is the first tick it will process
+int timing_wheel_init(timing_wheel_t *wheel, int capacity, uint64_t start);
+
+// Function to free the memory used by a wheel
+void timing_wheel_destroy(timing_wheel_t *wheel);
+
+// Function to make a node due at the given tick, a node that was already scheduled is moved
+void timing_wheel_schedule(timing_wheel_t *wheel, int node, uint64_t deadline);
+
+// Function to take a node out of the wheel, nothing happens if it was not scheduled
+void timing_wheel_cancel(timing_wheel_t *wheel, int node);
+
+// Function to process every tick up to now, expire is called once for each node that became due
+// Returns how many nodes expired
+int timing_wheel_advance(timing_wheel_t *wheel, uint64_t now, void (*expire)(int node, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,105 @@
+#include "./transaction_table.h"
+
+#include <string.h>
+#include <time.h>
+
+
+static transaction_bucket_t transaction_buckets[TRANSACTION_BUCKETS];
+
+
+// Function to get a monotonic clock in milliseconds, the coarse clock is enough for timeouts of seconds
+static uint64_t now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+
+// Function to pick the bucket of a transaction, mixing xid with every byte of chaddr
+static transaction_bucket_t *transaction_bucket(uint32_t xid, const uint8_t *chaddr, uint8_t hlen) {
+    uint32_t hash = 2166136261u ^ xid;
+    for (int i = 0; i < hlen; i++)
+        hash = (hash ^ chaddr[i]) * 16777619u;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    return &transaction_buckets[hash & (TRANSACTION_BUCKETS - 1)];
+}
+
+
+// Function to check if a slot holds a given transaction
+static int transaction_matches(const transaction_t *slot, uint32_t xid, const uint8_t *chaddr, uint8_t hlen) {
+    return slot->xid == xid && slot->hlen == hlen && memcmp(slot->chaddr, chaddr, hlen) == 0;
+}
+
+
+// Function to initialize the locks of the table
+void transaction_table_init() {
+    for (int b = 0; b < TRANSACTION_BUCKETS; b++)
+        pthread_mutex_init(&transaction_buckets[b].mutex, NULL);
+}
+
+
+// Function to remember the client endpoint of a transaction, or refresh it if the transaction is known
+// Returns the server that answered the transaction last, -1 for a new transaction or one no server answered
+int transaction_table_insert(uint32_t xid, const uint8_t *chaddr, uint8_t hlen, const struct sockaddr_in *client, uint64_t sent_us) {
+    if (hlen > HARDWARE_ADDR_LEN)
+        hlen = HARDWARE_ADDR_LEN;
+
+    transaction_bucket_t *bucket = transaction_bucket(xid, chaddr, hlen);
+    uint64_t now = now_ms();
+
+    pthread_mutex_lock(&bucket->mutex);
+
+    // The same transaction if it is there, else the slot that expires first, free and expired slots first of all
+    transaction_t *target = &bucket->slots[0];
+    int upstream = -1;
+    for (int s = 0; s < TRANSACTION_BUCKET_SLOTS; s++) {
+        transaction_t *slot = &bucket->slots[s];
+        if (slot->expires > now && transaction_matches(slot, xid, chaddr, hlen)) {
+            target = slot;
+            upstream = slot->upstream;
+            break;
+        }
+        if (slot->expires < target->expires)
+            target = slot;
+    }
+
+    target->expires = now + TRANSACTION_TIMEOUT_MS;
+    target->xid = xid;
+    target->hlen = hlen;
+    memcpy(target->chaddr, chaddr, hlen);
+    target->client = *client;
+    target->sent_us = sent_us;
+    target->upstream = upstream;
+
+    pthread_mutex_unlock(&bucket->mutex);
+    return upstream;
+}
+
+
+// Function to find the client endpoint of a transaction and note which server answered it, returns -1 if it is unknown or expired
+// The entry stays until it expires, since several replies may answer one request
+int transaction_table_find(uint32_t xid, const uint8_t *chaddr, uint8_t hlen, int upstream, struct sockaddr_in *client, uint64_t *sent_us) {
+    if (hlen > HARDWARE_ADDR_LEN)
+        hlen = HARDWARE_ADDR_LEN;
+
+    transaction_bucket_t *bucket = transaction_bucket(xid, chaddr, hlen);
+    uint64_t now = now_ms();
+    int found = -1;
+
+    pthread_mutex_lock(&bucket->mutex);
+    for (int s = 0; s < TRANSACTION_BUCKET_SLOTS; s++) {
+        transaction_t *slot = &bucket->slots[s];
+        if (slot->expires > now && transaction_matches(slot, xid, chaddr, hlen)) {
+            *client = slot->client;
+            *sent_us = slot->sent_us;
+            slot->upstream = upstream;
+            found = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&bucket->mutex);
+
+    return found;
+}
@@ -0,0 +1,42 @@
+#ifndef TRANSACTION_TABLE_H
+#define TRANSACTION_TABLE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "./message.h" // For HARDWARE_ADDR_LEN
+
+#define TRANSACTION_BUCKETS 16384        // Buckets of the table, a power of two, each one locked on its own
+#define TRANSACTION_BUCKET_SLOTS 4       // Transactions per bucket, a full bucket replaces the one closest to expiring
+#define TRANSACTION_TIMEOUT_MS 10000     // A transaction with no new request for this long is forgotten
+
+
+// Client endpoint of a transaction relayed to the server, keyed by xid and chaddr
+typedef struct {
+    uint64_t expires;                    // Monotonic time in milliseconds when the entry stops counting, 0 if the slot is free
+    uint32_t xid;                        // Transaction ID in network order, as on the wire
+    uint8_t hlen;                        // Length of chaddr, at most HARDWARE_ADDR_LEN
+    uint8_t chaddr[HARDWARE_ADDR_LEN];
+    struct sockaddr_in client;           // Where the request came from, where the replies go
+    uint64_t sent_us;                    // When the last request was forwarded, to measure the round trip of the replies
+    int upstream;                        // Server that answered the transaction last, -1 if none has yet
+} transaction_t;
+
+typedef struct {
+    _Alignas(64) pthread_mutex_t mutex;  // Keeps the locks of different buckets on different cache lines
+    transaction_t slots[TRANSACTION_BUCKET_SLOTS];
+} transaction_bucket_t;
+
+
+// Function to initialize the locks of the table
+void transaction_table_init();
+
+// Function to remember the client endpoint of a transaction, or refresh it if the transaction is known
+// Returns the server that answered the transaction last, -1 for a new transaction or one no server answered
+int transaction_table_insert(uint32_t xid, const uint8_t *chaddr, uint8_t hlen, const struct sockaddr_in *client, uint64_t sent_us);
+
+// Function to find the client endpoint of a transaction and note which server answered it, returns -1 if it is unknown or expired
+int transaction_table_find(uint32_t xid, const uint8_t *chaddr, uint8_t hlen, int upstream, struct sockaddr_in *client, uint64_t *sent_us);
+
+#endif
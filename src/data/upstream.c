@@ -0,0 +1,199 @@
+#include "./upstream.h"
+#include "../config/env.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+
+upstream_t upstreams[MAX_UPSTREAMS];
+int upstream_count = 0;
+static int upstream_fanout = 0;  // 1 with RELAY_MODE="fanout"
+
+
+// Function to get a monotonic clock in microseconds, the clock of every time kept by the upstreams
+uint64_t upstream_clock_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+
+// Function to parse an address written as ip:port, returns -1 if it is not valid
+static int parse_endpoint(const char *text, struct sockaddr_in *address) {
+    char ip[16];
+    int endpoint_port;
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    if (sscanf(text, " %15[^:]:%d", ip, &endpoint_port) != 2 || endpoint_port <= 0 || endpoint_port > 65535 || inet_pton(AF_INET, ip, &address->sin_addr) != 1)
+        return -1;
+    address->sin_port = htons((uint16_t)endpoint_port);
+    return 0;
+}
+
+
+// Function to read the servers of RELAY_SERVERS, or SERVER_IP alone if it is unset, returns -1 if the list is not valid
+int upstream_init() {
+    if (strcmp(relay_mode, "fastest") != 0 && strcmp(relay_mode, "fanout") != 0) {
+        printf(RED "RELAY_MODE must be \"fastest\" or \"fanout\".\n" RESET);
+        return -1;
+    }
+    upstream_fanout = strcmp(relay_mode, "fanout") == 0;
+
+    if (relay_servers[0] == '\0') {
+        // An empty SERVER_IP gives the broadcast address, as it always did
+        memset(&upstreams[0].address, 0, sizeof(upstreams[0].address));
+        upstreams[0].address.sin_family = AF_INET;
+        upstreams[0].address.sin_port = htons(port);
+        upstreams[0].address.sin_addr.s_addr = inet_addr(server_ip);
+        upstream_count = 1;
+    } else {
+        const char *server = relay_servers;
+        while (server != NULL) {
+            if (upstream_count == MAX_UPSTREAMS || parse_endpoint(server, &upstreams[upstream_count].address) != 0) {
+                printf(RED "RELAY_SERVERS must list at most %d servers as ip:port, separated by commas.\n" RESET, MAX_UPSTREAMS);
+                return -1;
+            }
+            upstream_count++;
+            server = strchr(server, ',');
+            if (server != NULL)
+                server++;
+        }
+    }
+
+    for (int s = 0; s < upstream_count; s++) {
+        atomic_store(&upstreams[s].healthy, 1);
+        printf(GREEN "Forwarding to server %s:%d\n" RESET, inet_ntoa(upstreams[s].address.sin_addr), ntohs(upstreams[s].address.sin_port));
+    }
+    return 0;
+}
+
+
+// Function to find the server a reply came from, returns -1 if it is none of them
+// Replies to a request broadcast to the servers come from the address of whichever server answered
+int upstream_find(const struct sockaddr_in *source) {
+    int broadcast = -1;
+    for (int s = 0; s < upstream_count; s++) {
+        if (upstreams[s].address.sin_port != source->sin_port)
+            continue;
+        if (upstreams[s].address.sin_addr.s_addr == source->sin_addr.s_addr)
+            return s;
+        if (upstreams[s].address.sin_addr.s_addr == htonl(INADDR_BROADCAST))
+            broadcast = s;
+    }
+    return broadcast;
+}
+
+
+// Function to find the server whose address a client named in its server identifier (option 54), returns -1 if none has it
+int upstream_find_address(uint32_t address) {
+    for (int s = 0; s < upstream_count; s++) {
+        if (upstreams[s].address.sin_addr.s_addr == address)
+            return s;
+    }
+    return -1;
+}
+
+
+// Function to check if a server answers in time, a server that leaves a request unanswered for RELAY_SERVER_TIMEOUT is dead
+int upstream_is_healthy(int server, uint64_t now) {
+    upstream_t *upstream = &upstreams[server];
+    uint64_t since = atomic_load(&upstream->waiting_since_us);
+
+    // Another worker may have sent a request after this one read the clock
+    if (since != 0 && now > since && now - since > (uint64_t)relay_server_timeout * 1000) {
+        if (atomic_exchange(&upstream->healthy, 0))
+            printf(RED "Server %s:%d left a request unanswered for %d ms, it is no longer used.\n" RESET,
+                inet_ntoa(upstream->address.sin_addr), ntohs(upstream->address.sin_port), relay_server_timeout);
+        return 0;
+    }
+    return atomic_load(&upstream->healthy);
+}
+
+
+// Function to pick the servers of a request: the preferred server if it is healthy, else the fastest healthy one,
+// or every healthy one with RELAY_MODE="fanout". Dead servers due for a probe are added, and with no healthy server every server gets the request
+// In fanout mode every server also sees the REQUEST of a client, so the servers it did not pick withdraw their offers
+// awaited is set to the targets that must answer: in fanout mode only the preferred server, since the others stay silent
+// about clients they did not pick or do not own in a load balanced group, and none if there is no preferred server
+uint32_t upstream_targets(int preferred, uint64_t now, uint32_t *awaited) {
+    uint32_t healthy = 0;
+    int fastest = -1;
+    uint32_t fastest_rtt = 0;
+
+    for (int s = 0; s < upstream_count; s++) {
+        if (!upstream_is_healthy(s, now))
+            continue;
+        healthy |= 1u << s;
+        uint32_t rtt = atomic_load(&upstreams[s].srtt_us);
+        if (fastest < 0 || rtt < fastest_rtt) {  // A server not measured yet counts as the fastest, so it gets measured
+            fastest = s;
+            fastest_rtt = rtt;
+        }
+    }
+
+    if (healthy == 0) {
+        *awaited = upstream_count == 32 ? ~0u : (1u << upstream_count) - 1;
+        return *awaited;
+    }
+
+    if (preferred >= 0 && (healthy & (1u << preferred)))
+        fastest = preferred;
+
+    uint32_t targets = upstream_fanout ? healthy : 1u << fastest;
+    for (int s = 0; s < upstream_count; s++) {
+        if (healthy & (1u << s))
+            continue;
+        uint64_t next_probe = atomic_load(&upstreams[s].next_probe_us);
+        if (now >= next_probe && atomic_compare_exchange_strong(&upstreams[s].next_probe_us, &next_probe, now + (uint64_t)relay_server_timeout * 1000))
+            targets |= 1u << s;
+    }
+
+    if (!upstream_fanout)
+        *awaited = targets;
+    else
+        *awaited = preferred >= 0 ? targets & (1u << preferred) : 0;
+    return targets;
+}
+
+
+// Function to count a request sent to a server, expects_reply is false for messages the server will not answer
+void upstream_sent(int server, int expects_reply, uint64_t now) {
+    upstream_t *upstream = &upstreams[server];
+    atomic_fetch_add_explicit(&upstream->requests, 1, memory_order_relaxed);
+
+    uint64_t idle = 0;
+    if (expects_reply)
+        atomic_compare_exchange_strong(&upstream->waiting_since_us, &idle, now);
+}
+
+
+// Function to count a reply of a server, with the round trip of its request or 0 if it could not be paired
+void upstream_answered(int server, uint64_t rtt_us) {
+    upstream_t *upstream = &upstreams[server];
+    atomic_fetch_add_explicit(&upstream->replies, 1, memory_order_relaxed);
+    atomic_store(&upstream->waiting_since_us, 0);
+
+    // Workers racing here may lose a sample, the average does not need every one
+    if (rtt_us > 0) {
+        int64_t srtt = atomic_load(&upstream->srtt_us);
+        srtt = srtt == 0 ? (int64_t)rtt_us : srtt + ((int64_t)rtt_us - srtt) / UPSTREAM_RTT_WEIGHT;
+        atomic_store(&upstream->srtt_us, (uint32_t)(srtt > 0 ? srtt : 1));
+    }
+
+    if (!atomic_exchange(&upstream->healthy, 1))
+        printf(GREEN "Server %s:%d answers again.\n" RESET, inet_ntoa(upstream->address.sin_addr), ntohs(upstream->address.sin_port));
+}
+
+
+// Function to print the round trip time, health and counters of every server
+void print_upstream_stats() {
+    for (int s = 0; s < upstream_count; s++) {
+        upstream_t *upstream = &upstreams[s];
+        printf(CYAN "Server %s:%d: %s, round trip %u us, %lu requests, %lu replies\n" RESET,
+            inet_ntoa(upstream->address.sin_addr), ntohs(upstream->address.sin_port),
+            atomic_load(&upstream->healthy) ? "healthy" : "dead", atomic_load(&upstream->srtt_us),
+            atomic_load(&upstream->requests), atomic_load(&upstream->replies));
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+
+#define MAX_UPSTREAMS 32           // Most servers RELAY_SERVERS may list, one bit each in a target set
+#define UPSTREAM_RTT_WEIGHT 8      // Each round trip moves the smoothed RTT by 1/8 of its difference, as TCP does
+
+
+// Server the relay forwards to, the counters are shared by every worker without a lock
+typedef struct {
+    struct sockaddr_in address;
+    _Atomic uint32_t srtt_us;             // Smoothed round trip time, 0 until the first reply is paired with its request
+    _Atomic uint64_t waiting_since_us;    // When the oldest request still unanswered was sent, 0 if the server answered them all
+    _Atomic uint64_t next_probe_us;       // A dead server gets a copy of one request at most this often, to notice it is back
+    atomic_int healthy;
+    atomic_ulong requests;
+    atomic_ulong replies;
+} upstream_t;
+
+extern upstream_t upstreams[];
+extern int upstream_count;
+
+
+// Function to get a monotonic clock in microseconds, the clock of every time kept by the upstreams
+uint64_t upstream_clock_us();
+
+// Function to read the servers of RELAY_SERVERS, or SERVER_IP alone if it is unset, returns -1 if the list is not valid
+int upstream_init();
+
+// Function to find the server a reply came from, returns -1 if it is none of them
+int upstream_find(const struct sockaddr_in *source);
+
+// Function to find the server whose address a client named in its server identifier (option 54), returns -1 if none has it
+int upstream_find_address(uint32_t address);
+
+// Function to check if a server answers in time, a server that leaves a request unanswered for RELAY_SERVER_TIMEOUT is dead
+int upstream_is_healthy(int server, uint64_t now);
+
+// Function to pick the servers of a request: the preferred server if it is healthy, else the fastest healthy one,
+// or every healthy one with RELAY_MODE="fanout". Dead servers due for a probe are added, and with no healthy server every server gets the request
+// awaited is set to the targets expected to answer, with fanout only the preferred server
+uint32_t upstream_targets(int preferred, uint64_t now, uint32_t *awaited);
+
+// Function to count a request sent to a server, expects_reply is false for messages the server will not answer
+void upstream_sent(int server, int expects_reply, uint64_t now);
+
+// Function to count a reply of a server, with the round trip of its request or 0 if it could not be paired
+void upstream_answered(int server, uint64_t rtt_us);
+
+// Function to print the round trip time, health and counters of every server
+void print_upstream_stats();
+
+#endif
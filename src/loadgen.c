@@ -0,0 +1,467 @@
+#define _GNU_SOURCE // For recvmmsg() and sendmmsg()
+
+// Personal includes
+#include "./loadgen.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <signal.h>
+
+// Define the socket variables in a global scope so that they can be accessed by the signal handler
+int sockets[LOADGEN_SOCKETS];
+struct sockaddr_in server_addr;
+
+loadgen_client_t *clients;
+uint32_t *idle_clients;          // Stack of the clients with no exchange in flight, only used in open loop
+int idle_count = 0;
+int closed_loop = 0;
+loadgen_send_queue_t *send_queues;
+
+latency_histogram_t dora_latency;   // From the DISCOVER to the ACK of its REQUEST
+latency_histogram_t renew_latency;  // From the renewal REQUEST to its ACK
+
+// Counters of the run, the load generator runs on a single thread
+unsigned long exchanges_started, first_starts, dora_completed, exchanges_completed;
+unsigned long naks, timeouts, skipped_arrivals, stray_replies;
+int in_flight = 0;
+uint64_t run_start_us, last_completion_us;
+
+batch_stats_t send_stats, receive_stats;
+
+
+// Function to get a monotonic clock in microseconds
+static uint64_t now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+
+// Function to get a uniform random number in (0, 1], xorshift is enough to space the arrivals
+static double next_uniform() {
+    static uint64_t state = 0;
+    if (state == 0)
+        state = now_us() | 1;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return ((state >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+
+// Function to add a latency to a histogram
+void latency_record(latency_histogram_t *histogram, uint64_t latency_us) {
+    int bucket;
+    if (latency_us < 2 * LATENCY_SUB_BUCKETS) {
+        bucket = (int)latency_us;
+    } else {
+        int exponent = 63 - __builtin_clzll(latency_us);  // At least 7
+        int shift = exponent - 6;
+        bucket = 2 * LATENCY_SUB_BUCKETS + (exponent - 7) * LATENCY_SUB_BUCKETS + (int)(latency_us >> shift) - LATENCY_SUB_BUCKETS;
+        if (bucket >= LATENCY_BUCKETS)
+            bucket = LATENCY_BUCKETS - 1;
+    }
+
+    histogram->counts[bucket]++;
+    histogram->total++;
+    if (latency_us > histogram->max)
+        histogram->max = latency_us;
+}
+
+
+// Function to get the latency below which a percentage of the samples fall, the top of its bucket
+uint64_t latency_percentile(const latency_histogram_t *histogram, double percentile) {
+    if (histogram->total == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)ceil(percentile / 100.0 * histogram->total);
+    if (rank == 0)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += histogram->counts[bucket];
+        if (seen < rank)
+            continue;
+
+        uint64_t top;
+        if (bucket < 2 * LATENCY_SUB_BUCKETS) {
+            top = (uint64_t)bucket;
+        } else {
+            int exponent = 7 + (bucket - 2 * LATENCY_SUB_BUCKETS) / LATENCY_SUB_BUCKETS;
+            uint64_t mantissa = LATENCY_SUB_BUCKETS + (bucket - 2 * LATENCY_SUB_BUCKETS) % LATENCY_SUB_BUCKETS;
+            top = ((mantissa + 1) << (exponent - 6)) - 1;
+        }
+        return top < histogram->max ? top : histogram->max;
+    }
+    return histogram->max;
+}
+
+
+// Function to print the percentiles of a histogram in a single line
+static void print_latency(const char *label, const latency_histogram_t *histogram) {
+    printf(CYAN "%s" RESET ": p50 %lu us, p99 %lu us, p99.9 %lu us, max %lu us (%lu samples)\n", label,
+        latency_percentile(histogram, 50.0), latency_percentile(histogram, 99.0), latency_percentile(histogram, 99.9),
+        histogram->max, histogram->total);
+}
+
+
+// Function to print the throughput and latency of the run
+void print_loadgen_report() {
+    uint64_t end = last_completion_us > run_start_us ? last_completion_us : now_us();
+    double seconds = (end - run_start_us) / 1e6;
+    if (seconds <= 0)
+        seconds = 1e-6;
+
+    printf(BOLD BLUE "\n==================== LOAD GENERATOR ====================\n" RESET);
+    printf(CYAN "Mode" RESET ": %s loop, %d clients, %d exchanges per second for %d s\n", closed_loop ? "closed" : "open", loadgen_clients, loadgen_rate, loadgen_duration);
+    printf(CYAN "Exchanges" RESET ": %lu started, %lu DORA completed, %lu renewed and released\n", exchanges_started, dora_completed, exchanges_completed);
+    printf(CYAN "Failures" RESET ": %lu NAKs, %lu timeouts, %lu arrivals with no idle client, %lu stray replies\n", naks, timeouts, skipped_arrivals, stray_replies);
+    printf(CYAN "Throughput" RESET ": %.0f DORA per second, %.0f messages sent and %.0f received per second over %.2f s\n",
+        dora_completed / seconds, atomic_load(&send_stats.datagrams) / seconds, atomic_load(&receive_stats.datagrams) / seconds, seconds);
+    print_latency("DORA latency", &dora_latency);
+    print_latency("Renewal latency", &renew_latency);
+    print_batch_stats("Sent", &send_stats);
+    print_batch_stats("Received", &receive_stats);
+}
+
+
+// Function to clean up and terminate the program
+void end_program() {
+    print_loadgen_report();
+
+    for (int s = 0; s < LOADGEN_SOCKETS; s++) {
+        if (sockets[s] >= 0)
+            close(sockets[s]);
+    }
+
+    printf(MAGENTA "Exiting...\n" RESET);
+    exit(0);
+}
+
+
+void handle_signal_interrupt(int signal) {
+    printf(YELLOW "\nSignal %d received.\n" RESET, signal);
+    end_program();
+}
+
+
+// Function to send the messages queued on every socket
+static void flush_send_queues() {
+    for (int s = 0; s < LOADGEN_SOCKETS; s++) {
+        loadgen_send_queue_t *queue = &send_queues[s];
+        if (queue->count == 0)
+            continue;
+
+        int sent = packet_batch_send(sockets[s], &queue->batch, queue->count, &send_stats);
+        if (sent < queue->count)
+            printf(RED "Failed to send %d messages to the server.\n" RESET, queue->count - (sent < 0 ? 0 : sent));
+        queue->count = 0;
+    }
+}
+
+
+// Function to queue the next message of a client on its socket, serialized with the message.c of the client
+static void queue_message(int index, uint8_t type, uint64_t now) {
+    loadgen_client_t *client = &clients[index];
+    loadgen_send_queue_t *queue = &send_queues[index % LOADGEN_SOCKETS];
+    if (queue->count == batch_size)
+        flush_send_queues();
+
+    dhcp_message_t msg;
+    init_dhcp_message(&msg);
+    msg.xid = client->xid;
+    memcpy(msg.chaddr, client->mac, sizeof(client->mac));
+    set_dhcp_message_type(&msg, type);
+
+    // SELECTING names the offered address and the server that offered it, RENEWING only its address in ciaddr
+    int o = 3;
+    int named_server = 0;
+    if (type == DHCP_REQUEST && client->state == LOADGEN_REQUESTING) {
+        uint32_t requested = htonl(client->address);
+        msg.options[o++] = 50;
+        msg.options[o++] = 4;
+        memcpy(&msg.options[o], &requested, 4);
+        o += 4;
+        named_server = 1;
+    } else if (type == DHCP_REQUEST || type == DHCP_RELEASE) {
+        msg.ciaddr = client->address;
+        named_server = type == DHCP_RELEASE;
+    }
+    if (named_server && client->server_id != 0) {
+        msg.options[o++] = 54;
+        msg.options[o++] = 4;
+        memcpy(&msg.options[o], &client->server_id, 4);
+        o += 4;
+    }
+    msg.options[o] = 255;
+
+    int length = build_dhcp_message(&msg, queue->buffers[queue->count], BUFFER_SIZE);
+    packet_batch_set(&queue->batch, queue->count, queue->buffers[queue->count], length, &server_addr);
+    queue->count++;
+    client->sent_us = now;
+}
+
+
+// Function to start a DORA exchange of a client with a new transaction ID
+static void start_client(int index, uint64_t now) {
+    loadgen_client_t *client = &clients[index];
+    client->xid = ((uint32_t)index << 8) | ((client->xid + 1) & 0xff);
+    client->state = LOADGEN_DISCOVERING;
+    client->address = 0;
+    client->server_id = 0;
+    client->started_us = now;
+    queue_message(index, DHCP_DISCOVER, now);
+    exchanges_started++;
+    in_flight++;
+}
+
+
+// Function to end the exchange of a client, in closed loop the client starts the next one at once
+static void finish_client(int index, uint64_t now, int running) {
+    clients[index].state = LOADGEN_IDLE;
+    in_flight--;
+    if (closed_loop && running)
+        start_client(index, now);
+    else if (!closed_loop)
+        idle_clients[idle_count++] = (uint32_t)index;
+}
+
+
+// Function to move a client one step on with a reply of the server
+static void handle_reply(const uint8_t *buffer, size_t length, uint64_t now, int running) {
+    const dhcp_message_t *msg = view_dhcp_message(buffer, length);
+    dhcp_option_index_t options;
+    if (msg == NULL || msg->op != 2 || index_dhcp_options(msg, length, &options) != 0) {
+        stray_replies++;
+        return;
+    }
+
+    // The transaction ID names the client, a reply to an older transaction of the client is stray
+    uint32_t xid = ntohl(msg->xid);
+    uint32_t index = xid >> 8;
+    if (index >= (uint32_t)loadgen_clients || clients[index].xid != xid || clients[index].state == LOADGEN_IDLE ||
+        memcmp(msg->chaddr, clients[index].mac, sizeof(clients[index].mac)) != 0) {
+        stray_replies++;
+        return;
+    }
+
+    loadgen_client_t *client = &clients[index];
+    uint8_t type = options.message_type;
+    if (type == DHCP_NAK) {
+        naks++;
+        finish_client(index, now, running);
+        return;
+    }
+
+    if (client->state == LOADGEN_DISCOVERING && type == DHCP_OFFER) {
+        uint8_t server_id_length = 0;
+        const uint8_t *server_id = find_dhcp_option(&options, 54, &server_id_length);
+        client->address = ntohl(msg->yiaddr);
+        if (server_id != NULL && server_id_length == 4)
+            memcpy(&client->server_id, server_id, 4);
+        client->state = LOADGEN_REQUESTING;
+        queue_message(index, DHCP_REQUEST, now);
+    } else if (client->state == LOADGEN_REQUESTING && type == DHCP_ACK) {
+        latency_record(&dora_latency, now - client->started_us);
+        dora_completed++;
+
+        // Renew at once with a new transaction, as a client at T1 would
+        client->xid = (client->xid & ~0xffu) | ((client->xid + 1) & 0xff);
+        client->state = LOADGEN_RENEWING;
+        queue_message(index, DHCP_REQUEST, now);
+    } else if (client->state == LOADGEN_RENEWING && type == DHCP_ACK) {
+        latency_record(&renew_latency, now - client->sent_us);
+        queue_message(index, DHCP_RELEASE, now);  // No server answers a RELEASE
+        exchanges_completed++;
+        last_completion_us = now;
+        finish_client(index, now, running);
+    } else {
+        stray_replies++;  // A second OFFER or an ACK the client no longer waits for
+    }
+}
+
+
+// Function to give up the exchanges whose last message got no reply in time
+static void expire_clients(uint64_t now, int running) {
+    for (int i = 0; i < loadgen_clients; i++) {
+        if (clients[i].state != LOADGEN_IDLE && now - clients[i].sent_us > (uint64_t)LOADGEN_TIMEOUT_MS * 1000) {
+            timeouts++;
+            finish_client(i, now, running);
+        }
+    }
+}
+
+
+// Function to open the sockets of the clients, every one of them sends to the server and gets its replies
+static int open_sockets() {
+    for (int s = 0; s < LOADGEN_SOCKETS; s++) {
+        sockets[s] = socket(AF_INET, SOCK_DGRAM, 0); // AF_INET: IPv4, SOCK_DGRAM: UDP
+        if (sockets[s] < 0) {
+            printf(RED "Socket creation failed.\n" RESET);
+            return -1;
+        }
+
+        int enable_broadcast = 1;
+        int buffer_size = LOADGEN_SOCKET_BUFFER;
+        setsockopt(sockets[s], SOL_SOCKET, SO_BROADCAST, &enable_broadcast, sizeof(enable_broadcast));
+        setsockopt(sockets[s], SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+        fcntl(sockets[s], F_SETFL, fcntl(sockets[s], F_GETFL) | O_NONBLOCK);
+
+        // Bound now so the replies have somewhere to arrive before the first message goes out
+        struct sockaddr_in local_addr = { .sin_family = AF_INET, .sin_port = 0, .sin_addr.s_addr = htonl(INADDR_ANY) };
+        if (bind(sockets[s], (struct sockaddr *)&local_addr, sizeof(local_addr)) < 0) {
+            printf(RED "Socket bind failed.\n" RESET);
+            return -1;
+        }
+    }
+    printf(GREEN "%d client sockets created successfully.\n" RESET, LOADGEN_SOCKETS);
+    return 0;
+}
+
+
+int main() {
+    for (int s = 0; s < LOADGEN_SOCKETS; s++)
+        sockets[s] = -1;
+
+    // Load environment variables
+    load_env_variables();
+
+    // Register the signal handler for SIGINT (CTRL+C)
+    signal(SIGINT, handle_signal_interrupt);
+
+    if (strcmp(loadgen_mode, "open") != 0 && strcmp(loadgen_mode, "closed") != 0) {
+        printf(RED "LOADGEN_MODE must be \"open\" or \"closed\".\n" RESET);
+        exit(0);
+    }
+    closed_loop = strcmp(loadgen_mode, "closed") == 0;
+
+    if (loadgen_clients < 1 || loadgen_clients > LOADGEN_MAX_CLIENTS || loadgen_rate < 1 || loadgen_duration < 1) {
+        printf(RED "LOADGEN_CLIENTS must be from 1 to %d, and LOADGEN_RATE and LOADGEN_DURATION at least 1.\n" RESET, LOADGEN_MAX_CLIENTS);
+        exit(0);
+    }
+
+    clients = calloc(loadgen_clients, sizeof(loadgen_client_t));
+    idle_clients = malloc(loadgen_clients * sizeof(uint32_t));
+    send_queues = calloc(LOADGEN_SOCKETS, sizeof(loadgen_send_queue_t));
+    if (clients == NULL || idle_clients == NULL || send_queues == NULL) {
+        printf(RED "Failed to allocate %d clients.\n" RESET, loadgen_clients);
+        exit(0);
+    }
+
+    // Locally administered MAC addresses, 02:00 and the index of the client
+    for (int i = loadgen_clients - 1; i >= 0; i--) {
+        clients[i].mac[0] = 0x02;
+        clients[i].mac[2] = (uint8_t)(i >> 24);
+        clients[i].mac[3] = (uint8_t)(i >> 16);
+        clients[i].mac[4] = (uint8_t)(i >> 8);
+        clients[i].mac[5] = (uint8_t)i;
+        idle_clients[idle_count++] = (uint32_t)i;
+    }
+
+    if (open_sockets() != 0)
+        end_program();
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    if (strlen(server_ip) == 0) {
+        printf("Server IP not provided. Using broadcast address.\n");
+        server_addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+    } else {
+        server_addr.sin_addr.s_addr = inet_addr(server_ip);
+    }
+    server_addr.sin_port = htons(port);
+
+    int epoll_fd = epoll_create1(0);
+    for (int s = 0; s < LOADGEN_SOCKETS; s++) {
+        struct epoll_event event = { .events = EPOLLIN, .data.u32 = (uint32_t)s };
+        if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sockets[s], &event) < 0) {
+            printf(RED "Failed to watch the client sockets.\n" RESET);
+            end_program();
+        }
+    }
+
+    static uint8_t buffers[MAX_BATCH_SIZE][BUFFER_SIZE];
+    static struct sockaddr_in sources[MAX_BATCH_SIZE];
+    packet_batch_t receive_batch;
+
+    printf(GREEN "Load generator: %s loop, %d clients, %d exchanges per second for %d s to %s:%d\n" RESET,
+        closed_loop ? "closed" : "open", loadgen_clients, loadgen_rate, loadgen_duration, inet_ntoa(server_addr.sin_addr), port);
+
+    run_start_us = now_us();
+    uint64_t run_end_us = run_start_us + (uint64_t)loadgen_duration * 1000000;
+    uint64_t next_arrival_us = run_start_us;
+    uint64_t last_expiry_us = run_start_us, last_progress_us = run_start_us;
+    unsigned long last_dora_completed = 0;
+
+    while (1) {
+        uint64_t now = now_us();
+        int running = now < run_end_us;
+
+        // Open loop: arrivals of a Poisson process at LOADGEN_RATE. Closed loop: the clients join at that rate, then each restarts when done
+        while (running && next_arrival_us <= now && (!closed_loop || first_starts < (unsigned long)loadgen_clients)) {
+            if (closed_loop) {
+                start_client((int)first_starts++, now);
+                next_arrival_us += 1000000 / loadgen_rate;
+            } else {
+                if (idle_count > 0)
+                    start_client((int)idle_clients[--idle_count], now);
+                else
+                    skipped_arrivals++;
+                next_arrival_us += (uint64_t)(-log(next_uniform()) * 1e6 / loadgen_rate);
+            }
+        }
+        flush_send_queues();
+
+        // Wait for replies, at most until the next arrival
+        int wait_ms = 100;
+        if (running && (!closed_loop || first_starts < (unsigned long)loadgen_clients))
+            wait_ms = next_arrival_us > now ? (int)((next_arrival_us - now) / 1000) : 0;
+        struct epoll_event events[LOADGEN_SOCKETS];
+        int ready = epoll_wait(epoll_fd, events, LOADGEN_SOCKETS, wait_ms < 100 ? wait_ms : 100);
+
+        for (int e = 0; e < ready; e++) {
+            int fd = sockets[events[e].data.u32];
+            int count;
+            do {
+                for (int i = 0; i < batch_size; i++)
+                    packet_batch_set(&receive_batch, i, buffers[i], BUFFER_SIZE, &sources[i]);
+                count = packet_batch_receive(fd, &receive_batch, batch_size, &receive_stats);
+
+                uint64_t received_us = now_us();
+                for (int i = 0; i < count; i++)
+                    handle_reply(buffers[i], receive_batch.headers[i].msg_len, received_us, received_us < run_end_us);
+            } while (count == batch_size);
+        }
+        flush_send_queues();
+
+        now = now_us();
+        if (now - last_expiry_us >= 100000) {
+            expire_clients(now, now < run_end_us);
+            last_expiry_us = now;
+            flush_send_queues();
+        }
+
+        if (now - last_progress_us >= 1000000) {
+            printf(CYAN "%lu DORA per second, %d exchanges in flight, %lu NAKs, %lu timeouts\n" RESET,
+                (dora_completed - last_dora_completed) * 1000000 / (now - last_progress_us), in_flight, naks, timeouts);
+            last_dora_completed = dora_completed;
+            last_progress_us = now;
+        }
+
+        // Once the arrivals stop, the exchanges in flight finish or time out
+        if (now >= run_end_us && in_flight == 0)
+            break;
+    }
+
+    end_program();
+}
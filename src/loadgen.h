@@ -0,0 +1,60 @@
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include "./data/message.h"
+#include "./config/env.h"
+#include "./utils/batch_io.h"
+
+#define BUFFER_SIZE 1024 // Buffer size for incoming messages, maximum size of a DHCP message is 1024 bytes
+#define LOADGEN_SOCKETS 8 // Sockets the clients are spread over, so a server in reuseport mode sees several flows
+#define LOADGEN_MAX_CLIENTS (1 << 24) // The client of a reply is the high 24 bits of its xid
+#define LOADGEN_TIMEOUT_MS 2000 // An exchange with no reply for this long is given up, there are no retransmissions
+#define LOADGEN_SOCKET_BUFFER (4 * 1024 * 1024) // Receive buffer of each socket, capped by net.core.rmem_max
+#define LATENCY_SUB_BUCKETS 64 // Buckets per power of two of the latency histogram, about 1.5% of precision
+#define LATENCY_BUCKETS (2 * LATENCY_SUB_BUCKETS + 40 * LATENCY_SUB_BUCKETS) // Enough for latencies of days in microseconds
+
+
+// Step of the exchange a synthetic client is waiting on
+typedef enum {
+    LOADGEN_IDLE,
+    LOADGEN_DISCOVERING,   // DISCOVER sent, waiting for an OFFER
+    LOADGEN_REQUESTING,    // REQUEST sent, waiting for the ACK that ends DORA
+    LOADGEN_RENEWING       // Renewal REQUEST sent, waiting for its ACK before the RELEASE
+} loadgen_state_t;
+
+// Synthetic client, its MAC address is 02:00 followed by its index so it never changes between runs
+typedef struct {
+    uint32_t xid;            // Current transaction ID, the index of the client and a sequence number in the low byte
+    uint32_t address;        // Offered or leased address in host order
+    uint32_t server_id;      // Server identifier of the OFFER (option 54) in network order, 0 if it had none
+    uint8_t state;           // loadgen_state_t
+    uint8_t mac[6];
+    uint64_t started_us;     // When the DISCOVER was sent
+    uint64_t sent_us;        // When the last message was sent, for the timeout
+} loadgen_client_t;
+
+// Histogram of latencies in microseconds, exact below 2 * LATENCY_SUB_BUCKETS and log-linear above
+typedef struct {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} latency_histogram_t;
+
+// Messages queued on one socket until the next sendmmsg
+typedef struct {
+    uint8_t buffers[MAX_BATCH_SIZE][BUFFER_SIZE];
+    packet_batch_t batch;
+    int count;
+} loadgen_send_queue_t;
+
+
+// Function declarations
+void end_program();
+void handle_signal_interrupt(int signal);
+void latency_record(latency_histogram_t *histogram, uint64_t latency_us);
+uint64_t latency_percentile(const latency_histogram_t *histogram, double percentile);
+void print_loadgen_report();
+
+#endif
@@ -0,0 +1,146 @@
+// Personal includes
+#include "./parse_bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+volatile unsigned long parse_sink; // Results of the parses are added here so the compiler keeps every call
+
+
+// Function to get a monotonic clock in nanoseconds
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+
+// Function to append an option to the options of a message, returns the place after it
+static int put_option(uint8_t *options, int o, uint8_t code, uint8_t length, const void *value) {
+    options[o++] = code;
+    options[o++] = length;
+    memcpy(&options[o], value, length);
+    return o + length;
+}
+
+
+// Function to serialize a message into a case as the server would receive it
+static void build_case(parse_bench_case_t *bench_case, const char *name, const dhcp_message_t *msg) {
+    bench_case->name = name;
+    bench_case->length = build_dhcp_message(msg, bench_case->buffer, sizeof(bench_case->buffer));
+}
+
+
+// Function to time index_dhcp_options on one message, returns the nanoseconds per parse of the fastest run
+// Each parse is followed by the lookups of the server (requested address and server identifier)
+double time_index_dhcp_options(const parse_bench_case_t *bench_case) {
+    const dhcp_message_t *msg = (const dhcp_message_t *)bench_case->buffer;
+    dhcp_option_index_t index;
+    double best = 0;
+
+    for (int run = 0; run < PARSE_BENCH_RUNS; run++) {
+        unsigned long sum = 0;
+        uint64_t start = now_ns();
+        for (int i = 0; i < PARSE_BENCH_ITERATIONS; i++) {
+            uint8_t length = 0;
+            sum += index_dhcp_options(msg, bench_case->length, &index) + index.message_type;
+            sum += find_dhcp_option(&index, 50, &length) != NULL;
+            sum += find_dhcp_option(&index, 54, &length) != NULL;
+        }
+        double elapsed = (double)(now_ns() - start) / PARSE_BENCH_ITERATIONS;
+        parse_sink += sum;
+        if (run == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+
+// Function to time classify_dhcp_batch on full batches of copies of one message, returns the nanoseconds per datagram of the fastest run
+double time_classify_dhcp_batch(const parse_bench_case_t *bench_case) {
+    static parse_bench_case_t copies[PARSE_BENCH_BATCH];
+    const uint8_t *buffers[PARSE_BENCH_BATCH];
+    size_t lengths[PARSE_BENCH_BATCH];
+    dhcp_packet_class_t classes[PARSE_BENCH_BATCH];
+
+    for (int k = 0; k < PARSE_BENCH_BATCH; k++) {
+        copies[k] = *bench_case;
+        buffers[k] = copies[k].buffer;
+        lengths[k] = (size_t)copies[k].length;
+    }
+
+    int calls = PARSE_BENCH_ITERATIONS / PARSE_BENCH_BATCH;
+    double best = 0;
+    for (int run = 0; run < PARSE_BENCH_RUNS; run++) {
+        unsigned long sum = 0;
+        uint64_t start = now_ns();
+        for (int i = 0; i < calls; i++)
+            sum += classify_dhcp_batch(buffers, lengths, PARSE_BENCH_BATCH, classes) + classes[0].type;
+        double elapsed = (double)(now_ns() - start) / ((double)calls * PARSE_BENCH_BATCH);
+        parse_sink += sum;
+        if (run == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+
+int main() {
+    parse_bench_case_t cases[3];
+    dhcp_message_t msg;
+    int o;
+
+    // The shortest DISCOVER, only the message type
+    init_dhcp_message(&msg);
+    msg.xid = 0x12345678;
+    msg.chaddr[0] = 0x02;
+    msg.chaddr[5] = 0x01;
+    set_dhcp_message_type(&msg, DHCP_DISCOVER);
+    msg.options[3] = 255;
+    build_case(&cases[0], "DISCOVER, message type only", &msg);
+
+    // A REQUEST of a common client, 12 options with the message type first
+    uint32_t requested = htonl(0x0A000064), server_id = htonl(0x0A000001);
+    uint16_t max_size = htons(1500);
+    const uint8_t client_id[] = { 1, 0x02, 0, 0, 0, 0, 0x01 };
+    const uint8_t parameters[] = { 1, 3, 6, 15, 31, 33, 43, 44, 46, 47, 119, 121, 249, 252 };
+    const uint8_t fqdn[] = { 0, 0, 0, 'c', 'l', 'i', 'e', 'n', 't', '-', '0', '0', '0', '1' };
+    const uint8_t auto_configure = 1;
+    const uint8_t rapid_commit = 0;
+    set_dhcp_message_type(&msg, DHCP_REQUEST);
+    o = 3;
+    o = put_option(msg.options, o, 61, sizeof(client_id), client_id);
+    o = put_option(msg.options, o, 50, 4, &requested);
+    o = put_option(msg.options, o, 54, 4, &server_id);
+    o = put_option(msg.options, o, 57, 2, &max_size);
+    o = put_option(msg.options, o, 12, 11, "client-0001");
+    o = put_option(msg.options, o, 81, sizeof(fqdn), fqdn);
+    o = put_option(msg.options, o, 60, 8, "MSFT 5.0");
+    o = put_option(msg.options, o, 55, sizeof(parameters), parameters);
+    o = put_option(msg.options, o, 116, 1, &auto_configure);
+    o = put_option(msg.options, o, 80, 0, &rapid_commit);
+    o = put_option(msg.options, o, 77, 6, "office");
+    msg.options[o] = 255;
+    build_case(&cases[1], "REQUEST, 12 options", &msg);
+
+    // The same REQUEST with the message type last, the batch classification has to walk the options to find it
+    memmove(msg.options, msg.options + 3, o - 3);
+    o -= 3;
+    const uint8_t type = DHCP_REQUEST;
+    o = put_option(msg.options, o, 53, 1, &type);
+    msg.options[o] = 255;
+    build_case(&cases[2], "REQUEST, 12 options, type last", &msg);
+
+    printf(BOLD "==================== PARSE BENCHMARK ====================\n" RESET);
+    printf("%d parses per run, fastest of %d runs\n", PARSE_BENCH_ITERATIONS, PARSE_BENCH_RUNS);
+    for (int c = 0; c < 3; c++) {
+        double index_ns = time_index_dhcp_options(&cases[c]);
+        double classify_ns = time_classify_dhcp_batch(&cases[c]);
+        printf(CYAN "%-32s" RESET " %3d bytes: index_dhcp_options %6.1f ns, classify_dhcp_batch %6.1f ns per datagram\n",
+            cases[c].name, cases[c].length, index_ns, classify_ns);
+    }
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef PARSE_BENCH_H
+#define PARSE_BENCH_H
+
+#include <stdint.h>
+#include "./data/message.h"
+#include "./config/env.h"
+
+#define PARSE_BENCH_ITERATIONS 2000000 // Parses of one message per run
+#define PARSE_BENCH_RUNS 7 // Runs of each case, the fastest is reported as the others only add noise of the machine
+#define PARSE_BENCH_BATCH 64 // Datagrams per call in the batch classification case, the largest BATCH_SIZE
+
+
+// Message parsed by a case, kept as received so it is read in place as the server does
+typedef struct {
+    const char *name;
+    _Alignas(8) uint8_t buffer[sizeof(dhcp_message_t)];
+    int length;
+} parse_bench_case_t;
+
+
+// Function declarations
+double time_index_dhcp_options(const parse_bench_case_t *bench_case);
+double time_classify_dhcp_batch(const parse_bench_case_t *bench_case);
+
+#endif
@@ -0,0 +1,266 @@
+// Personal includes
+#include "./pool_stress.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+pool_stress_client_t *clients;
+int client_count = 0;
+int thread_count = 0;
+_Atomic uint32_t *holders;          // Client + 1 that holds each entry of the pool as the threads saw it, 0 if none
+pool_stress_counters_t *thread_counters;
+atomic_int stop_threads = 0;
+
+
+// Function to get a monotonic clock in microseconds
+static uint64_t now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+
+// Function to get a random number of a thread, xorshift is enough to pick clients and operations
+static uint32_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return (uint32_t)(*state >> 32);
+}
+
+
+// Function to note that a client holds an address, counts a conflict if another client holds it already
+static void claim_address(pool_stress_counters_t *counters, int client, uint32_t address) {
+    uint32_t expected = 0;
+    if (!atomic_compare_exchange_strong(&holders[ip_to_index(address)], &expected, (uint32_t)client + 1))
+        counters->conflicts++;
+}
+
+
+// Function to note that a client gave its address back, it is cleared before the release so the next holder never finds it
+static void unclaim_address(pool_stress_counters_t *counters, int client, uint32_t address) {
+    uint32_t expected = (uint32_t)client + 1;
+    if (!atomic_compare_exchange_strong(&holders[ip_to_index(address)], &expected, 0))
+        counters->conflicts++;
+}
+
+
+// Function run by every thread, it drives the clients whose index modulo the thread count is its own
+// Clients of different threads compete for the same shards and, once the pool runs low, for the same addresses
+void *pool_stress_thread(void *arg) {
+    int t = (int)(intptr_t)arg;
+    pool_stress_counters_t *counters = &thread_counters[t];
+    uint64_t state = (uint64_t)(t + 1) * 0x9E3779B97F4A7C15ULL;
+    int own_clients = (client_count - t + thread_count - 1) / thread_count;
+
+    while (!atomic_load_explicit(&stop_threads, memory_order_relaxed)) {
+        int c = t + (int)(next_random(&state) % own_clients) * thread_count;
+        pool_stress_client_t *client = &clients[c];
+        uint32_t xid = ++client->xid;
+        uint32_t roll = next_random(&state) % 100;
+
+        // A client with a lease renews it or releases it
+        if (client->address != 0) {
+            if (roll < POOL_STRESS_RELEASE_PERCENT) {
+                unclaim_address(counters, c, client->address);
+                release_ip(client->address);
+                client->address = 0;
+                counters->releases++;
+            } else if (renew_lease(local_scope, client->address, client->id, POOL_STRESS_CLIENT_ID_LEN, xid) == 0) {
+                counters->renewals++;
+            } else {
+                counters->lost++;
+            }
+            continue;
+        }
+
+        // A rebooting client asks for an address without a DISCOVER, the pool must refuse it if another client holds it
+        if (roll >= 100 - POOL_STRESS_REBOOT_PERCENT) {
+            uint32_t requested = local_scope->range_start + 1 + next_random(&state) % (local_scope->range_end - local_scope->range_start);
+            counters->reboots++;
+            if (renew_lease(local_scope, requested, client->id, POOL_STRESS_CLIENT_ID_LEN, xid) == 0) {
+                claim_address(counters, c, requested);
+                client->address = requested;
+            }
+            continue;
+        }
+
+        // A client without one goes through DISCOVER and REQUEST in the same transaction, as the server sees them
+        uint32_t offered = assign_ip(local_scope, client->id, POOL_STRESS_CLIENT_ID_LEN, xid);
+        if (offered == 0) {
+            counters->exhausted++;
+            continue;
+        }
+        counters->offers++;
+
+        if (roll < POOL_STRESS_ABANDON_PERCENT) {
+            if (roll % 2 == 0)
+                withdraw_offer(local_scope, client->id, POOL_STRESS_CLIENT_ID_LEN);
+            continue;
+        }
+
+        if (renew_lease(local_scope, offered, client->id, POOL_STRESS_CLIENT_ID_LEN, xid) != 0) {
+            counters->refused++;
+            continue;
+        }
+        claim_address(counters, c, offered);
+        client->address = offered;
+        counters->bindings++;
+    }
+
+    return NULL;
+}
+
+
+// Function to check one bound address of the pool against the client that holds it, counts every mismatch in arg
+static void check_binding(const lease_info_t *lease, const client_binding_t *binding, void *arg) {
+    int *mismatches = (int *)arg;
+    if (!lease->is_assigned)
+        return;
+
+    const uint8_t *id = binding->client_id;
+    int c = id[2] << 24 | id[3] << 16 | id[4] << 8 | id[5];
+    int holder = (int)atomic_load(&holders[ip_to_index(lease->ip_address)]) - 1;
+    if (binding->client_id_len == POOL_STRESS_CLIENT_ID_LEN && c < client_count && holder == c && clients[c].address == lease->ip_address)
+        return;
+
+    char ip_buffer[IP_ADDRESS_SIZE];
+    int_to_ip(lease->ip_address, ip_buffer);
+    if (*mismatches < 10)
+        printf(RED "Address %s is bound to client %d, held by client %d\n" RESET, ip_buffer, c, holder);
+    (*mismatches)++;
+}
+
+
+// Function to check that every bound address of the pool belongs to the one client that holds it, and that every lease is bound
+// Returns the number of mismatches
+int check_pool_bindings() {
+    int mismatches = 0;
+    for_each_binding(check_binding, &mismatches);
+
+    for (int c = 0; c < client_count; c++) {
+        if (clients[c].address == 0)
+            continue;
+        int holder = (int)atomic_load(&holders[ip_to_index(clients[c].address)]) - 1;
+        if (holder != c) {
+            char ip_buffer[IP_ADDRESS_SIZE];
+            int_to_ip(clients[c].address, ip_buffer);
+            if (mismatches < 10)
+                printf(RED "Client %d holds %s, which is noted for client %d\n" RESET, c, ip_buffer, holder);
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+
+int main() {
+    // Load environment variables, the pool is built from the same scopes as the server
+    load_env_variables();
+
+    // The pool stays in memory and nothing is journaled, the files of a server are never touched
+    pool_file[0] = '\0';
+    if (init_ip_pool() != 0) {
+        printf(RED "Failed to initialize the IP pool.\n" RESET);
+        return 1;
+    }
+    if (local_scope->lease_time <= POOL_STRESS_SECONDS) {
+        printf(RED "The lease time of the scope must be longer than %d seconds.\n" RESET, POOL_STRESS_SECONDS);
+        return 1;
+    }
+
+    int addresses = (int)(local_scope->range_end - local_scope->range_start);
+    client_count = addresses * POOL_STRESS_CLIENTS_PER_ADDRESS;
+    thread_count = worker_count > 0 ? worker_count : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count < 2)
+        thread_count = 2;
+    if (client_count < thread_count)
+        client_count = thread_count;
+
+    clients = calloc(client_count, sizeof(pool_stress_client_t));
+    holders = calloc(pool_size, sizeof(_Atomic uint32_t));
+    thread_counters = calloc(thread_count, sizeof(pool_stress_counters_t));
+    pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+    if (clients == NULL || holders == NULL || thread_counters == NULL || threads == NULL) {
+        printf(RED "Failed to allocate %d clients.\n" RESET, client_count);
+        return 1;
+    }
+
+    // Locally administered MAC addresses, 02:00 and the index of the client
+    for (int c = 0; c < client_count; c++) {
+        clients[c].id[0] = 0x02;
+        clients[c].id[2] = (uint8_t)(c >> 24);
+        clients[c].id[3] = (uint8_t)(c >> 16);
+        clients[c].id[4] = (uint8_t)(c >> 8);
+        clients[c].id[5] = (uint8_t)c;
+    }
+
+    printf(YELLOW "Stressing %d addresses with %d clients on %d threads for %d s...\n" RESET, addresses, client_count, thread_count, POOL_STRESS_SECONDS);
+
+    // The pool logs every renewal, the log of millions of them is thrown away while the threads run
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (saved_stdout >= 0 && null_fd >= 0)
+        dup2(null_fd, STDOUT_FILENO);
+
+    uint64_t start = now_us();
+    for (int t = 0; t < thread_count; t++) {
+        if (pthread_create(&threads[t], NULL, pool_stress_thread, (void *)(intptr_t)t) != 0) {
+            atomic_store(&stop_threads, 1);
+            thread_count = t;
+            break;
+        }
+    }
+
+    // The lease timer runs meanwhile, so abandoned offers expire under the threads
+    while (now_us() - start < (uint64_t)POOL_STRESS_SECONDS * 1000000 && !atomic_load(&stop_threads)) {
+        check_leases();
+        usleep(10000);
+    }
+    atomic_store(&stop_threads, 1);
+    for (int t = 0; t < thread_count; t++)
+        pthread_join(threads[t], NULL);
+    double seconds = (now_us() - start) / 1e6;
+
+    fflush(stdout);
+    if (saved_stdout >= 0 && null_fd >= 0)
+        dup2(saved_stdout, STDOUT_FILENO);
+
+    pool_stress_counters_t total;
+    memset(&total, 0, sizeof(total));
+    for (int t = 0; t < thread_count; t++) {
+        total.offers += thread_counters[t].offers;
+        total.bindings += thread_counters[t].bindings;
+        total.renewals += thread_counters[t].renewals;
+        total.releases += thread_counters[t].releases;
+        total.refused += thread_counters[t].refused;
+        total.reboots += thread_counters[t].reboots;
+        total.exhausted += thread_counters[t].exhausted;
+        total.lost += thread_counters[t].lost;
+        total.conflicts += thread_counters[t].conflicts;
+    }
+    unsigned long operations = total.offers + total.bindings + total.renewals + total.releases + total.refused + total.reboots + total.exhausted + total.lost;
+
+    int mismatches = check_pool_bindings();
+
+    printf(BOLD "\n==================== POOL STRESS ====================\n" RESET);
+    printf(CYAN "Operations" RESET ": %lu in %.2f s, %.0f per second\n", operations, seconds, operations / seconds);
+    printf(CYAN "Exchanges" RESET ": %lu offers, %lu bound, %lu renewed, %lu released, %lu REQUESTs without an offer\n", total.offers, total.bindings, total.renewals, total.releases, total.reboots);
+    printf(CYAN "Refused" RESET ": %lu REQUESTs, %lu DISCOVERs with the scope full, %lu renewals of a held lease\n", total.refused, total.exhausted, total.lost);
+    printf(CYAN "Conflicts" RESET ": %lu while running, %d in the final check\n", total.conflicts, mismatches);
+
+    int failed = total.conflicts > 0 || total.lost > 0 || mismatches > 0;
+    if (failed)
+        printf(RED "An address was held by two clients or a lease was lost.\n" RESET);
+    else
+        printf(GREEN "No address was held by two clients.\n" RESET);
+
+    close_ip_pool();
+    return failed;
+}
@@ -0,0 +1,44 @@
+#ifndef POOL_STRESS_H
+#define POOL_STRESS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "./config/env.h"
+#include "./config/scope.h"
+#include "./data/ip_pool.h"
+#include "./utils/utils.h"
+
+#define POOL_STRESS_SECONDS 5 // How long the threads run, far below the lease time so no bound lease expires meanwhile
+#define POOL_STRESS_CLIENTS_PER_ADDRESS 2 // More clients than addresses, so the threads compete for the last free ones
+#define POOL_STRESS_RELEASE_PERCENT 30 // Exchanges of a client holding an address that release it, the others renew it
+#define POOL_STRESS_ABANDON_PERCENT 5 // Offers the client never requests, half of them withdrawn and the rest left to expire
+#define POOL_STRESS_REBOOT_PERCENT 10 // Clients without an address that REQUEST any address of the scope, as a client rebooting with a stale one
+#define POOL_STRESS_CLIENT_ID_LEN 6 // Client identifiers are MAC addresses, 02:00 followed by the index of the client
+
+
+// Synthetic client, only ever driven by one thread as a real client sends one message at a time
+typedef struct {
+    uint32_t address;   // Address bound to the client in host order, 0 if it holds none
+    uint32_t xid;
+    uint8_t id[POOL_STRESS_CLIENT_ID_LEN];
+} pool_stress_client_t;
+
+// Counters of a thread, added up at the end
+typedef struct {
+    unsigned long offers;
+    unsigned long bindings;
+    unsigned long renewals;
+    unsigned long releases;
+    unsigned long refused;      // REQUESTs of an offered address the pool did not bind
+    unsigned long reboots;      // REQUESTs of an address with no offer, bound or refused
+    unsigned long exhausted;    // DISCOVERs with no free address left
+    unsigned long lost;         // Renewals of a lease the client holds that the pool refused
+    unsigned long conflicts;    // Addresses bound while another client held them
+} pool_stress_counters_t;
+
+
+// Function declarations
+void *pool_stress_thread(void *arg);
+int check_pool_bindings();
+
+#endif
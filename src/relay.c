@@ -1,10 +1,17 @@
+#define _GNU_SOURCE // For recvmmsg() and sendmmsg()
+
 // Personal includes
 #include "./relay.h"
+#include "./data/transaction_table.h"
+#include "./data/upstream.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <signal.h>
@@ -14,7 +21,15 @@
 
 // Define the socket variable in a global scope so that it can be accessed by the signal handler
 int client_sockfd, server_sockfd;
-struct sockaddr_in server_addr, client_addr, client_subnet;
+uint32_t relay_address;    // Address of the relay on the subnet of its clients, in network order, stamped in giaddr
+uint16_t client_port;      // Port of the clients in network order, next to the server port as 68 is next to 67
+
+// Fill levels of the recvmmsg and sendmmsg calls in each direction
+batch_stats_t client_receive_stats, server_send_stats;
+batch_stats_t server_receive_stats, client_send_stats;
+
+// Messages the workers did not forward
+atomic_ulong dropped_requests, dropped_replies;
 
 
 // Function to clean up and terminate the program
@@ -25,6 +40,13 @@ void end_program() {
     if (server_sockfd >= 0)
         close(server_sockfd);
 
+    print_batch_stats("Received from clients", &client_receive_stats);
+    print_batch_stats("Forwarded to server", &server_send_stats);
+    print_batch_stats("Received from server", &server_receive_stats);
+    print_batch_stats("Forwarded to clients", &client_send_stats);
+    printf(CYAN "Dropped %lu requests and %lu replies\n" RESET, atomic_load(&dropped_requests), atomic_load(&dropped_replies));
+    print_upstream_stats();
+
     printf("Exiting...\n");
     exit(0);
 }
@@ -36,56 +58,230 @@ void handle_signal_interrupt(int signal) {
 }
 
 
-// Function to listen for DHCP Offer/ACK in a separate thread
-void *dhcp_client_listener(void *arg) {
-    socklen_t addr_len = sizeof(struct sockaddr_in);
-    char buffer[BUFFER_SIZE];
+// Function to get the address stamped in giaddr, RELAY_IP if it is set and otherwise the address of eth0
+static int get_relay_address(uint32_t *address) {
+    if (relay_ip[0] != '\0')
+        return inet_pton(AF_INET, relay_ip, address) == 1 ? 0 : -1;
 
-    while (1) {
-        // Clean the buffer
-        memset(buffer, 0, sizeof(buffer));
-        // Listen for incoming DHCP OFFER or ACK
-        ssize_t recv_len = recvfrom(client_sockfd, buffer, sizeof(buffer), 0, (struct sockaddr *)&client_addr, &addr_len);
-        if (recv_len < 0) {
-            printf(RED "Failed to receive data from client.\n" RESET);
-            continue;
+    struct ifreq ifr;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return -1;
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, "eth0", IFNAMSIZ - 1);
+    int result = ioctl(fd, SIOCGIFADDR, &ifr);
+    close(fd);
+    if (result < 0)
+        return -1;
+
+    *address = ((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr.s_addr;
+    return 0;
+}
+
+
+// Function to receive a batch of one direction, returns 0 when another worker took the datagrams first
+static int receive_relay_batch(int fd, relay_batch_t *batch, batch_stats_t *stats) {
+    for (int i = 0; i < batch_size; i++) {
+        packet_batch_set(&batch->receive_batch, i, batch->buffers[i], BUFFER_SIZE, &batch->sources[i]);
+    }
+
+    int count = packet_batch_receive(fd, &batch->receive_batch, batch_size, stats);
+    if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    return count;
+}
+
+
+// Function to send the requests gathered in a batch to their servers, returns how many are left in the batch
+static int send_server_batch(relay_batch_t *batch, int forward) {
+    if (forward == 0)
+        return 0;
+
+    int sent = packet_batch_send(server_sockfd, &batch->send_batch, forward, &server_send_stats);
+    if (sent < forward) {
+        printf(RED "Failed to forward %d messages to server.\n" RESET, forward - (sent < 0 ? 0 : sent));
+        return 0;
+    }
+
+    printf(CYAN "%d DHCP messages forwarded to server.\n" RESET, forward);
+    return 0;
+}
+
+
+// Function to pick the servers of a request, in fastest mode a client stays with the server it named in option 54
+// or else with the server that answered its transaction, since no other server would take its REQUEST
+// awaited is set to the targets expected to reply, none for messages no server answers (RELEASE, DECLINE)
+static uint32_t request_targets(const dhcp_message_t *msg, size_t length, int answered_by, uint64_t now, uint32_t *awaited) {
+    dhcp_option_index_t options;
+    int preferred = answered_by;
+    int expects_reply = 1;
+
+    // A BOOTP request without the magic cookie has no options but is answered all the same
+    if (index_dhcp_options(msg, length, &options) == 0) {
+        expects_reply = options.message_type != DHCP_RELEASE && options.message_type != DHCP_DECLINE;
+
+        uint8_t server_id_length = 0;
+        const uint8_t *server_id = find_dhcp_option(&options, 54, &server_id_length);
+        if (server_id != NULL && server_id_length == 4) {
+            uint32_t address;
+            memcpy(&address, server_id, sizeof(address));
+            int named = upstream_find_address(address);
+            if (named >= 0)
+                preferred = named;
         }
+    }
+
+    uint32_t targets = upstream_targets(preferred, now, awaited);
+    if (!expects_reply)
+        *awaited = 0;
+    return targets;
+}
+
 
-        ssize_t sent_bytes = sendto(server_sockfd, buffer, recv_len, 0, (struct sockaddr*)&server_addr, addr_len);
+// Function to forward a batch of DHCP DISCOVER, REQUEST or RELEASE from clients to the servers
+// Every request gets the relay in giaddr and one more hop, and the table remembers which client sent it and when
+int forward_client_batch(relay_batch_t *batch) {
+    int count = receive_relay_batch(client_sockfd, batch, &client_receive_stats);
+    if (count < 0) {
+        printf(RED "Failed to receive data from client.\n" RESET);
+        return -1;
+    }
+
+    uint64_t now = upstream_clock_us();
+    int forward = 0;
+    for (int i = 0; i < count; i++) {
+        dhcp_message_t *msg = (dhcp_message_t *)batch->buffers[i];
+        unsigned int length = batch->receive_batch.headers[i].msg_len;
 
-        if (sent_bytes < 0) {
-            printf(RED "Failed to forward message to server.\n" RESET);
+        if (length < BOOTP_HEADER_LENGTH || msg->op != 1 || msg->hops > RELAY_MAX_HOPS) {
+            atomic_fetch_add_explicit(&dropped_requests, 1, memory_order_relaxed);
             continue;
         }
 
-        printf(CYAN "DHCP message forwarded to server.\n" RESET);
+        // A request that came through another relay keeps the giaddr of the first one, RFC 1542 section 4.1.1
+        msg->hops++;
+        if (msg->giaddr == 0)
+            msg->giaddr = relay_address;
+
+        int answered_by = transaction_table_insert(msg->xid, msg->chaddr, msg->hlen, &batch->sources[i], now);
+        uint32_t awaited;
+        uint32_t targets = request_targets(msg, length, answered_by, now, &awaited);
+
+        // With fanout one request takes an entry of the batch per server
+        for (int s = 0; s < upstream_count; s++) {
+            if (!(targets & (1u << s)))
+                continue;
+            if (forward == MAX_BATCH_SIZE)
+                forward = send_server_batch(batch, forward);
+            packet_batch_set(&batch->send_batch, forward++, msg, length, &upstreams[s].address);
+            upstream_sent(s, (awaited >> s) & 1, now);
+        }
     }
 
-    return NULL;
+    send_server_batch(batch, forward);
+    return count;
 }
 
-void *dhcp_server_listener(void *arg) {
-    socklen_t addr_len = sizeof(struct sockaddr_in);
-    char buffer[BUFFER_SIZE];
 
-    while (1) {
-        // Clean the buffer
-        memset(buffer, 0, sizeof(buffer));
-        // Listen for incoming DHCP OFFER or ACK
-        ssize_t recv_len = recvfrom(server_sockfd, buffer, sizeof(buffer), 0, (struct sockaddr *)&server_addr, &addr_len);
-        if (recv_len < 0) {
-            printf(RED "Failed to receive data from server.\n" RESET);
+// Function to pick where a reply goes, the client of its transaction or else the destination of RFC 1542 section 4.1.2
+// sent_us is set to when the request of the transaction was forwarded, 0 if the transaction is gone
+// Returns -1 for a reply this relay has nothing to do with
+static int reply_destination(const dhcp_message_t *msg, int server, struct sockaddr_in *destination, uint64_t *sent_us) {
+    *sent_us = 0;
+    if (transaction_table_find(msg->xid, msg->chaddr, msg->hlen, server, destination, sent_us) == 0)
+        return 0;
+
+    if (msg->giaddr != relay_address)
+        return -1;
+
+    // The transaction expired, the reply goes to the client port: broadcast if the client asked for it or has no address yet
+    memset(destination, 0, sizeof(*destination));
+    destination->sin_family = AF_INET;
+    destination->sin_port = client_port;
+    if ((ntohs(msg->flags) & BOOTP_BROADCAST_FLAG) || msg->ciaddr == 0)
+        destination->sin_addr.s_addr = htonl(INADDR_BROADCAST);
+    else
+        destination->sin_addr.s_addr = msg->ciaddr;
+    return 0;
+}
+
+
+// Function to forward a batch of DHCP OFFER, ACK or NAK from the servers to the clients that are waiting for them
+// Each reply paired with its request gives the round trip time of the server that sent it
+int forward_server_batch(relay_batch_t *batch) {
+    int count = receive_relay_batch(server_sockfd, batch, &server_receive_stats);
+    if (count < 0) {
+        printf(RED "Failed to receive data from server.\n" RESET);
+        return -1;
+    }
+
+    uint64_t now = upstream_clock_us();
+    int forward = 0;
+    for (int i = 0; i < count; i++) {
+        const dhcp_message_t *msg = (const dhcp_message_t *)batch->buffers[i];
+        unsigned int length = batch->receive_batch.headers[i].msg_len;
+        int server = upstream_find(&batch->sources[i]);
+
+        if (length < BOOTP_HEADER_LENGTH || msg->op != 2 || server < 0) {
+            atomic_fetch_add_explicit(&dropped_replies, 1, memory_order_relaxed);
             continue;
         }
 
-        ssize_t sent_bytes = sendto(client_sockfd, buffer, recv_len, 0, (struct sockaddr*)&client_addr, addr_len);
-
-        if (sent_bytes < 0) {
-            printf(RED "Failed to forward message to client.\n" RESET);
+        uint64_t sent_us;
+        int routed = reply_destination(msg, server, &batch->destinations[forward], &sent_us);
+        upstream_answered(server, sent_us != 0 && now > sent_us ? now - sent_us : 0);
+        if (routed != 0) {
+            atomic_fetch_add_explicit(&dropped_replies, 1, memory_order_relaxed);
             continue;
         }
 
-        printf(CYAN "DHCP message forwarded to client.\n" RESET);
+        packet_batch_set(&batch->send_batch, forward, batch->buffers[i], length, &batch->destinations[forward]);
+        forward++;
+    }
+
+    if (forward == 0)
+        return count;
+
+    int sent = packet_batch_send(client_sockfd, &batch->send_batch, forward, &client_send_stats);
+    if (sent < forward) {
+        printf(RED "Failed to forward %d messages to client.\n" RESET, forward - (sent < 0 ? 0 : sent));
+        return count;
+    }
+
+    printf(CYAN "%d DHCP messages forwarded to client.\n" RESET, forward);
+    return count;
+}
+
+
+// Function of a relay worker, it forwards whichever direction has datagrams waiting
+// Every worker waits on both sockets with EPOLLEXCLUSIVE, so a datagram wakes one worker instead of all of them
+void *relay_worker(void *arg) {
+    (void)arg;
+    relay_batch_t *batch = malloc(sizeof(relay_batch_t));
+    int epoll_fd = epoll_create1(0);
+    if (batch == NULL || epoll_fd < 0) {
+        printf(RED "Failed to start a relay worker.\n" RESET);
+        end_program();
+    }
+
+    struct epoll_event client_event = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.fd = client_sockfd };
+    struct epoll_event server_event = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.fd = server_sockfd };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_sockfd, &client_event) < 0 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_sockfd, &server_event) < 0) {
+        printf(RED "Failed to watch the relay sockets: %s\n" RESET, strerror(errno));
+        end_program();
+    }
+
+    while (1) {
+        struct epoll_event events[2];
+        int ready = epoll_wait(epoll_fd, events, 2, -1);
+        for (int e = 0; e < ready; e++) {
+            if (events[e].data.fd == client_sockfd)
+                forward_client_batch(batch);
+            else
+                forward_server_batch(batch);
+        }
     }
 
     return NULL;
@@ -93,15 +289,21 @@ void *dhcp_server_listener(void *arg) {
 
 
 int main() {
-    // uint8_t buffer[sizeof(dhcp_message_t)];
-    char buffer[BUFFER_SIZE];
-
     // Load environment variables
     load_env_variables();
 
     // Register the signal handler for SIGINT (CTRL+C)
     signal(SIGINT, handle_signal_interrupt);
 
+    if (upstream_init() != 0)
+        exit(0);
+
+    if (get_relay_address(&relay_address) != 0) {
+        printf(RED "Failed to get the address of the relay, set RELAY_IP to its address on the subnet of the clients.\n" RESET);
+        exit(0);
+    }
+    client_port = htons(port + 1);
+
     // Initialize the client socket
     client_sockfd = socket(AF_INET, SOCK_DGRAM, 0); // AF_INET: IPv4, SOCK_DGRAM: UDP
 
@@ -137,6 +339,16 @@ int main() {
         return -1;
     }
 
+    // Bursts of requests from many clients at once wait in the socket until a worker is free, capped by net.core.rmem_max
+    int buffer_size = RELAY_SOCKET_BUFFER;
+    setsockopt(client_sockfd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    setsockopt(server_sockfd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+    // The workers share both sockets, a worker that finds nothing left to read goes back to waiting
+    fcntl(client_sockfd, F_SETFL, fcntl(client_sockfd, F_GETFL) | O_NONBLOCK);
+    fcntl(server_sockfd, F_SETFL, fcntl(server_sockfd, F_GETFL) | O_NONBLOCK);
+
+    struct sockaddr_in client_addr;
     memset(&client_addr, 0, sizeof(client_addr));
     client_addr.sin_family = AF_INET;
     client_addr.sin_port = htons(port);
@@ -149,24 +361,21 @@ int main() {
         exit(0);
     }
 
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(port);
-    server_addr.sin_addr.s_addr = inet_addr(server_ip);
+    transaction_table_init();
 
-    // Create a thread to listen to incoming messages from the client
-    pthread_t client_listener_thread;
-    if (pthread_create(&client_listener_thread, NULL, dhcp_client_listener, NULL) != 0) {
-        printf(RED "Failed to create client listener thread.\n" RESET);
-        end_program();
+    // Create the workers that forward messages in both directions
+    int workers = worker_count > 0 ? worker_count : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    for (int w = 0; w < workers; w++) {
+        pthread_t worker_thread;
+        if (pthread_create(&worker_thread, NULL, relay_worker, NULL) != 0) {
+            printf(RED "Failed to create relay worker thread.\n" RESET);
+            end_program();
+        }
+        pthread_detach(worker_thread);
     }
 
-    // Create a thread to listen to incoming messages from the server
-    pthread_t server_listener_thread;
-    if (pthread_create(&server_listener_thread, NULL, dhcp_server_listener, NULL) != 0) {
-        printf(RED "Failed to create server listener thread.\n" RESET);
-        end_program();
-    }
+    struct in_addr giaddr = { .s_addr = relay_address };
+    printf(GREEN "Relay %s running with %d workers\n" RESET, inet_ntoa(giaddr), workers);
 
     while (1) {
         sleep(1);
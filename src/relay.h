@@ -3,16 +3,34 @@
 
 #include <netinet/in.h>
 #include <stdint.h>
-#include "./config/env.h" 
+#include "./config/env.h"
+#include "./utils/batch_io.h"
+#include "./data/message.h"
 
 #define MAX_CHARACTERS 360
 #define BUFFER_SIZE 1024 // Buffer size for incoming messages, maximum size of a DHCP message is 1024 bytes
-#define SOCKET_ADDRESS struct sockaddr // Define SOCKET_ADDRESS as struct sockaddr 
+#define SOCKET_ADDRESS struct sockaddr // Define SOCKET_ADDRESS as struct sockaddr
+#define RELAY_MAX_HOPS 16 // Requests that already went through more relays are dropped, as RFC 1542 asks
+#define BOOTP_BROADCAST_FLAG 0x8000 // Bit of flags set by clients that can only receive broadcast replies
+#define RELAY_SOCKET_BUFFER (4 * 1024 * 1024) // Receive buffer of each socket, room for a burst of thousands of clients
+#define BOOTP_HEADER_LENGTH offsetof(dhcp_message_t, magic_cookie) // Shortest message the relay forwards, up to the magic cookie
+
+
+// Buffers of a batch of one direction, owned by a single worker
+typedef struct {
+    char buffers[MAX_BATCH_SIZE][BUFFER_SIZE];
+    struct sockaddr_in sources[MAX_BATCH_SIZE];
+    struct sockaddr_in destinations[MAX_BATCH_SIZE];
+    packet_batch_t receive_batch;
+    packet_batch_t send_batch;
+} relay_batch_t;
+
 
 // Function declaration
 void end_program();
 void handle_signal_interrupt(int signal);
-void *dhcp_client_listener(void *arg);
-void *dhcp_server_listener(void *arg);
+int forward_client_batch(relay_batch_t *batch);
+int forward_server_batch(relay_batch_t *batch);
+void *relay_worker(void *arg);
 
 #endif
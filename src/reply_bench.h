@@ -0,0 +1,24 @@
+#ifndef REPLY_BENCH_H
+#define REPLY_BENCH_H
+
+#include <stdint.h>
+#include "./data/message.h"
+#include "./data/reply.h"
+#include "./config/env.h"
+#include "./config/scope.h"
+
+#define REPLY_BENCH_ITERATIONS 2000000 // Replies built per run
+#define REPLY_BENCH_RUNS 7 // Runs of each encoding, the fastest is reported as the others only add noise of the machine
+#define REPLY_BENCH_SLOTS 64 // Replies are built in turn in this many slots, as in the transmit slots of a batch
+
+
+// Function to build an OFFER or ACK of an address for a request
+typedef void (*reply_encoder_t)(dhcp_message_t *reply, const dhcp_message_t *request, const scope_t *scope, uint8_t type, uint32_t address);
+
+
+// Function declarations
+void encode_reply_per_packet(dhcp_message_t *reply, const dhcp_message_t *request, const scope_t *scope, uint8_t type, uint32_t address);
+void encode_reply_from_template(dhcp_message_t *reply, const dhcp_message_t *request, const scope_t *scope, uint8_t type, uint32_t address);
+double time_reply_encoder(reply_encoder_t encode, const dhcp_message_t *request, const scope_t *scope);
+
+#endif
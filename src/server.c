@@ -1,3 +1,5 @@
+#define _GNU_SOURCE // For pthread_setaffinity_np() and CPU_SET()
+
 // Essential includes for C programs
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,193 +10,887 @@
 #include <sys/socket.h> // For socket creation
 #include <arpa/inet.h>  // For htons() function
 #include <unistd.h>     // For close() function
+#include <linux/filter.h> // For the BPF program that steers packets to the shard of the receiving CPU
+#include <errno.h>
 
 // Include for Signal Handling
 #include <signal.h>
 
 // Includes for threads
 #include <pthread.h>
+#include <sched.h> // For sched_getaffinity(), the CPUs the shards can be pinned to
+#include <semaphore.h>
+#include <stdatomic.h>
 
 // Personal includes
 #include "./server.h"
 #include "./config/env.h"
+#include "./config/reservation.h"
 #include "data/ip_pool.h"
+#include "data/request_queue.h"
+#include "data/lease_journal.h"
+#include "data/lease_replication.h"
+#include "data/load_balancing.h"
+#include "data/reply.h"
+#include "utils/batch_io.h"
+#include "utils/uring.h"
+#include "utils/alloc_counter.h"
+#include "utils/utils.h"
 
 // Global variables
-int sockfd;
+int sockfd = -1;
 char global_gateway_ip[16]; // Global variable for the gateway IP
 
+// Worker pool, the receiver takes a slot from free_slots, fills it and hands it to the workers through pending_requests
+client_data_t *request_slots = NULL;
+request_queue_t free_slots;
+request_queue_t pending_requests;
+sem_t pending_signal; // Counts the requests in pending_requests so idle workers can sleep
+atomic_ulong dropped_packets = 0; // Packets dropped because every slot was in use
+volatile sig_atomic_t reload_requested = 0; // Set by SIGHUP, the lease timer then reads the reservations file again
+volatile sig_atomic_t stop_requested = 0; // Set by SIGINT, the main thread then closes the journal and exits
+
+// Receive shards, one SO_REUSEPORT socket and one pinned thread per shard
+int *shard_sockets = NULL;
+int *shard_cpus = NULL; // CPU each shard is pinned to, the steering program maps each CPU back to its shard
+int shard_count = 0;
+
+// Threads that touch the journal and the pool, end_program stops and joins them before closing either
+pthread_t *server_threads = NULL; // Workers in pool mode, shards in reuseport and uring modes
+int server_thread_count = 0;
+pthread_t lease_thread;
+int lease_thread_started = 0;
+
+// Fill levels of the recvmmsg and sendmmsg calls
+batch_stats_t receive_stats;
+batch_stats_t send_stats;
+
+// Heap allocation counter, checked once every thread is ready to prove the request path does not allocate
+atomic_int ready_threads = 0;
+long startup_allocations = -1;
+
+
+// Function to stop every worker, shard, the lease timer and the replication thread, and wait for them
+// Workers sleep on the semaphore and get one wakeup each, shards and the lease timer wake up at least once per STOP_CHECK_SECONDS
+void stop_server_threads() {
+    stop_requested = 1;
+
+    if (shard_count == 0) {
+        for (int i = 0; i < server_thread_count; i++)
+            sem_post(&pending_signal);
+    }
+    for (int i = 0; i < server_thread_count; i++)
+        pthread_join(server_threads[i], NULL);
+    server_thread_count = 0;
+
+    if (lease_thread_started) {
+        pthread_join(lease_thread, NULL);
+        lease_thread_started = 0;
+    }
+
+    lease_replication_stop();
+}
+
 
 // Function to clean up and terminate the program
 void end_program() {
+    // Nothing may append to the journal or touch the pool once they are closed
+    stop_server_threads();
+
     if (sockfd >= 0)
         close(sockfd);
+
+    for (int i = 0; i < shard_count; i++)
+        close(shard_sockets[i]);
+
+    lease_journal_close();
         
-    if (ip_pool)
-        free(ip_pool);
+    close_ip_pool();
+
+    printf("Packets dropped (request queue full): %lu\n", atomic_load(&dropped_packets));
+    print_batch_stats("Received", &receive_stats);
+    print_batch_stats("Sent", &send_stats);
+
+    if (startup_allocations >= 0)
+        printf("Heap allocations after startup: %ld\n", alloc_counter_get() - startup_allocations);
 
     printf("Exiting...\n");
     exit(0);
 }
 
 
+// Function to ask the main thread to stop, waiting for the journal is not safe in a signal handler
 void handle_signal_interrupt(int signal) {
-    printf("\nSignal %d received.\n", signal);
-    end_program();
+    (void)signal;
+    stop_requested = 1;
 }
 
 
-void send_dhcp_offer(int socket_fd, struct sockaddr_in *client_addr, dhcp_message_t *discover_message) {
-    dhcp_message_t offer_message;
-    init_dhcp_message(&offer_message);
+// Function to ask for a reload of the reservations, the work is left to the lease timer
+void handle_signal_reload(int signal) {
+    (void)signal;
+    reload_requested = 1;
+}
 
-    // Copy the client's MAC
-    memcpy(offer_message.chaddr, discover_message->chaddr, 6);
 
-    // Try to assign an IP from the pool
-    char *assigned_ip = assign_ip();
-    if (assigned_ip == NULL) {
-        printf(RED "No available IP addresses in the pool.\n" RESET);
+// Function to run the once per second work of the server: expire the leases, and reload the reservations when asked to
+void run_lease_timer() {
+    if (reload_requested) {
+        reload_requested = 0;
+        printf(YELLOW "Reloading the reservations...\n" RESET);
+        load_reservations();
+    }
+    check_leases();
+}
 
-        // Set message type as DHCP_NAK
-        set_dhcp_message_type(&offer_message, DHCP_NAK);
-    } else {
-        // Set the your IP address
-        inet_pton(AF_INET, assigned_ip, &offer_message.yiaddr);
 
-        // Set the server IP
-        inet_pton(AF_INET, server_ip, &offer_message.siaddr);
+// Function to get how many bytes of chaddr identify the client, hlen comes from the wire so it is clamped
+int client_id_length(const dhcp_message_t *message) {
+    return message->hlen < CLIENT_ID_SIZE ? message->hlen : CLIENT_ID_SIZE;
+}
 
-        // Set the gateway IP
-        inet_pton(AF_INET, global_gateway_ip, &offer_message.giaddr);
 
-        // Set DHCP message type to DHCP_OFFER
-        set_dhcp_message_type(&offer_message, DHCP_OFFER);
+// Function to get the address reserved for the client of a message, 0 if it has none on the subnet of the scope
+uint32_t find_scope_reservation(const scope_t *scope, const dhcp_message_t *message) {
+    uint32_t reserved_ip = find_reservation(message->chaddr, client_id_length(message));
+    return (reserved_ip & scope->subnet_mask) == scope->network ? reserved_ip : 0;
+}
 
-        // Add subnet mask (option 1)
-        offer_message.options[3] = 1;
-        offer_message.options[4] = 4;
-        inet_pton(AF_INET, global_subnet_mask, &offer_message.options[5]);
 
-        // Add DNS (option 6)
-        offer_message.options[9] = 6;
-        offer_message.options[10] = 4;
-        inet_pton(AF_INET, global_dns_ip, &offer_message.options[11]);
+void send_dhcp_offer(dhcp_reply_t *reply, const dhcp_message_t *discover_message, const scope_t *scope) {
+    dhcp_message_t *offer_message = &reply->message;
 
-        // Add lease time (option 51)
-        offer_message.options[15] = 51;
-        offer_message.options[16] = 4;
-        uint32_t lease_time = htonl(LEASE_TIME);
-        memcpy(&offer_message.options[17], &lease_time, 4);
+    // A client with a reservation on the subnet of the scope gets its address without touching the pool
+    // Otherwise try to offer an IP from the scope, a client that retransmits gets the address it was already offered
+    // The offer is held for OFFER_HOLD_TIME, only a REQUEST of the same transaction takes it
+    uint32_t assigned_ip = find_scope_reservation(scope, discover_message);
+    if (assigned_ip == 0)
+        assigned_ip = assign_ip(scope, discover_message->chaddr, client_id_length(discover_message), ntohl(discover_message->xid));
+    if (assigned_ip == 0) {
+        printf(RED "No available IP addresses in the scope.\n" RESET);
 
-        // End of options
-        offer_message.options[21] = 255;
-    }
+        // Set message type as DHCP_NAK
+        begin_dhcp_reply(offer_message, discover_message);
+        set_dhcp_message_type(offer_message, DHCP_NAK);
+    } else {
+        // The template of the scope carries the server IP and the lease options
+        begin_scope_reply(offer_message, discover_message, scope, DHCP_OFFER);
 
-    // Send DHCP_OFFER or DHCP_NAK message
-    if (sendto(sockfd, &offer_message, sizeof(offer_message), 0, (struct sockaddr *) client_addr, sizeof(*client_addr)) < 0) {
-        perror(RED "Error sending DHCP message" RESET);
-    } else if (offer_message.options[2] == DHCP_OFFER) {
-        printf(GREEN "DHCP_OFFER sent to client.\n" RESET);
-    } else if (offer_message.options[2] == DHCP_NAK) {
-        printf(RED "DHCP_NAK sent to client: IP not available.\n" RESET);
+        // Set the your IP address
+        offer_message->yiaddr = htonl(assigned_ip);
+
+        // Set the gateway IP
+        set_reply_gateway(offer_message, discover_message, scope);
     }
 }
 
 
-void handle_dhcp_request(int sockfd, struct sockaddr_in *client_addr, dhcp_message_t *request_msg) {
-    // Check if the client is requesting an IP that is no longer available or if there is an error in the request
-    if (!is_ip_available(request_msg -> yiaddr)) {
+// Function to answer a DHCP_REQUEST, returns 1 if an answer was built in reply and 0 if the request was meant for another server
+int handle_dhcp_request(dhcp_reply_t *reply, const dhcp_message_t *request_msg, const dhcp_option_index_t *options, const scope_t *scope) {
+    // A client that took the offer of another server names that server in option 54, the address offered here is free again
+    uint8_t length;
+    const uint8_t *identifier = find_dhcp_option(options, 54, &length);
+    if (identifier != NULL && length == 4 && server_identifier != 0 && memcmp(identifier, &server_identifier, 4) != 0) {
+        printf(YELLOW "The client chose another server, withdrawing its offer.\n" RESET);
+        withdraw_offer(scope, request_msg->chaddr, client_id_length(request_msg));
+        return 0;
+    }
+
+    dhcp_message_t *ack_message = &reply->message;
+
+    // The requested address comes in option 50 while selecting an offer, and in ciaddr while renewing
+    // The client of this project also sends the offered address back in yiaddr, every field is in network order
+    const uint8_t *requested_option = find_dhcp_option(options, 50, &length);
+    uint32_t requested_ip;
+    if (requested_option != NULL && length == 4)
+        memcpy(&requested_ip, requested_option, 4);
+    else
+        requested_ip = request_msg->ciaddr != 0 ? request_msg->ciaddr : request_msg->yiaddr;
+    requested_ip = ntohl(requested_ip);
+
+    // A client with a reservation may only take its reserved address
+    // Check if the client is requesting an IP outside its scope, offered to another transaction or bound to another client, otherwise its lease starts again
+    uint32_t reserved_ip = find_scope_reservation(scope, request_msg);
+    if (reserved_ip != 0 ? requested_ip != reserved_ip : renew_lease(scope, requested_ip, request_msg->chaddr, client_id_length(request_msg), ntohl(request_msg->xid)) != 0) {
         // Send a DHCP_NAK if the requested IP is unavailable
         printf(RED "Requested IP is not available, sending DHCP_NAK...\n" RESET);
-        set_dhcp_message_type(request_msg, DHCP_NAK); // Set message type to DHCP_NAK
+        begin_dhcp_reply(ack_message, request_msg);
+        set_dhcp_message_type(ack_message, DHCP_NAK); // Set message type to DHCP_NAK
     } else {
-        renew_lease(inet_ntoa(*(struct in_addr *)&request_msg -> yiaddr));
         printf(GREEN "Sending DHCP_ACK...\n" RESET);
-        set_dhcp_message_type(request_msg, DHCP_ACK); // Set message type to DHCP_ACK
-    }
-
 
-    if (sendto(sockfd, request_msg, sizeof(*request_msg), 0, (struct sockaddr *)client_addr, sizeof(*client_addr)) < 0) {
-        perror(RED "Error sending DHCP message" RESET);
-    } else if (request_msg -> options[2] == DHCP_ACK) {
-        printf(GREEN "DHCP_ACK sent to client.\n" RESET);
-    } else if (request_msg -> options[2] == DHCP_NAK) {
-        printf(RED "DHCP_NAK sent to client: IP not available.\n" RESET);
+        // The template of the scope carries the server IP and the lease options
+        begin_scope_reply(ack_message, request_msg, scope, DHCP_ACK);
+        ack_message->yiaddr = htonl(requested_ip);
+        set_reply_gateway(ack_message, request_msg, scope);
     }
+    return 1;
 }
 
 
-void handle_dhcp_release(int sockfd, dhcp_message_t *release_msg) {
+void handle_dhcp_release(const dhcp_message_t *release_msg) {
+    // The client sends its address in ciaddr
+    uint32_t released_ip = ntohl(release_msg->ciaddr);
+
     // Free the IP address
-    release_ip(inet_ntoa(*(struct in_addr *)&release_msg->ciaddr));
+    release_ip(released_ip);
 
     // Print the DHCP_RELEASE message
-    printf("IP address %s released.\n", inet_ntoa(*(struct in_addr *)&release_msg->ciaddr));
+    char ip_buffer[IP_ADDRESS_SIZE];
+    int_to_ip(released_ip, ip_buffer);
+    printf("IP address %s released.\n", ip_buffer);
 }
 
 
-void *process_client_connection(void *arg) {
-    client_data_t *data = (client_data_t *)arg;
-    char *buffer = data->buffer;
-    struct sockaddr_in client_addr = data->client_addr;
-    socklen_t client_addr_len = data->client_addr_len;
-    int connection_sockfd = data->sockfd;
-
-    printf(CYAN "Processing DHCP message from client %s:%d\n" RESET, inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+// Function to process one DHCP message classified by classify_dhcp_batch, returns 1 if an answer was built in reply and 0 otherwise
+// The batch validation already checked the header and found the message type, only the options are indexed here
+int process_client_connection(const dhcp_packet_class_t *packet, const uint8_t *buffer, size_t recv_len, const struct sockaddr_in *client_addr, dhcp_reply_t *reply) {
+    // Load balanced servers each answer the clients of their own buckets, a DISCOVER of another bucket is dropped before any other work
+    uint8_t dhcp_message_type = packet->type;
+    int client_id_len = packet->hlen < CLIENT_ID_SIZE ? packet->hlen : CLIENT_ID_SIZE;
+    if (dhcp_message_type == DHCP_DISCOVER && !load_balancing_owns(packet->chaddr, client_id_len))
+        return 0;
 
-    dhcp_message_t dhcp_msg;
+    printf(CYAN "Processing DHCP message from client %s:%d\n" RESET, inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port));
 
-    if (parse_dhcp_message((uint8_t *)buffer, &dhcp_msg) != 0) {
+    // Read the message where it was received, the fields stay in network order
+    // The options are indexed once, against the length actually received
+    const dhcp_message_t *dhcp_msg = (const dhcp_message_t *)buffer;
+    dhcp_option_index_t options;
+    if (index_dhcp_options(dhcp_msg, recv_len, &options) != 0) {
         printf(RED "Failed to parse DHCP message.\n" RESET);
-        free(data);
-        return NULL;
+        return 0;
     }
 
     // Print the DHCP message with detailed formatting
-    print_dhcp_message(&dhcp_msg, false);
+    print_dhcp_message(dhcp_msg, &options, false);
 
-    uint8_t dhcp_message_type = 0;
-    for (int i = 0; i < DHCP_OPTIONS_LENGTH; i++) {
-        if (dhcp_msg.options[i] == 53) {
-            dhcp_message_type = dhcp_msg.options[i + 2]; // Corregido: obtener el valor real del tipo de mensaje
-            break;
-        }
+    // A REQUEST naming a server in option 54 is for that server, any other one goes by the bucket of its client
+    uint8_t identifier_length;
+    if (dhcp_message_type == DHCP_REQUEST && find_dhcp_option(&options, 54, &identifier_length) == NULL &&
+        !load_balancing_owns(packet->chaddr, client_id_len)) {
+        printf(YELLOW "Another load balanced server answers this client, dropping the message.\n" RESET);
+        return 0;
+    }
+
+    reply->client_addr = *client_addr;
+
+    // A relay puts its own address on the client subnet in giaddr, clients without a relay share the subnet of the server
+    const scope_t *scope = dhcp_msg->giaddr != 0 ? find_scope(ntohl(dhcp_msg->giaddr)) : local_scope;
+    if (scope == NULL && dhcp_message_type != DHCP_RELEASE) {
+        struct in_addr relay = { .s_addr = dhcp_msg->giaddr };
+        printf(RED "No scope serves the subnet of relay %s, dropping the message.\n" RESET, inet_ntoa(relay));
+        return 0;
     }
 
     switch (dhcp_message_type) {
     case DHCP_DISCOVER:
         printf(GREEN "Received DHCP_DISCOVER from client.\n" RESET);
-        send_dhcp_offer(connection_sockfd, &client_addr, &dhcp_msg);
-        break;
+        send_dhcp_offer(reply, dhcp_msg, scope);
+        return 1;
 
     case DHCP_REQUEST:
         printf(GREEN "Received DHCP_REQUEST from client.\n" RESET);
-        handle_dhcp_request(connection_sockfd, &client_addr, &dhcp_msg);
-        break;
+        return handle_dhcp_request(reply, dhcp_msg, &options, scope);
 
     case DHCP_RELEASE:
         printf(GREEN "Received DHCP_RELEASE from client.\n" RESET);
-        handle_dhcp_release(connection_sockfd, &dhcp_msg);
-        break;
+        handle_dhcp_release(dhcp_msg);
+        return 0;
 
     default:
         printf(RED "Unrecognized DHCP message type: %d\n" RESET, dhcp_message_type);
-        break;
+        return 0;
     }
+}
+
+
+// Function to send the answers of a batch with a single sendmmsg call
+void send_dhcp_replies(int fd, dhcp_reply_t *replies, int count, packet_batch_t *batch) {
+    if (count == 0)
+        return;
+
+    // The leases granted by this batch must be on disk before their ACKs leave, one group commit covers them all
+    lease_journal_flush();
+
+    for (int i = 0; i < count; i++) {
+        packet_batch_set(batch, i, &replies[i].message, dhcp_message_length(&replies[i].message), &replies[i].client_addr);
+    }
+
+    int sent = packet_batch_send(fd, batch, count, &send_stats);
+    if (sent < 0) {
+        perror(RED "Error sending DHCP message" RESET);
+        sent = 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        log_dhcp_reply(&replies[i], i < sent);
+    }
+}
+
+
+// Function to print the outcome of sending an answer
+void log_dhcp_reply(const dhcp_reply_t *reply, int sent) {
+    uint8_t type = reply->message.options[2];
+
+    if (!sent) {
+        printf(RED "Error sending DHCP message to client.\n" RESET);
+    } else if (type == DHCP_OFFER) {
+        printf(GREEN "DHCP_OFFER sent to client.\n" RESET);
+    } else if (type == DHCP_ACK) {
+        printf(GREEN "DHCP_ACK sent to client.\n" RESET);
+    } else if (type == DHCP_NAK) {
+        printf(RED "DHCP_NAK sent to client: IP not available.\n" RESET);
+    }
+}
 
-    free(data);
+
+// Function to answer a batch of received datagrams, returns how many answers were built, answer n in *replies[n]
+// The batch is validated and classified first, datagrams that are not DHCP requests never reach the per-message parse
+// DISCOVERs are answered first, then REQUESTs and RELEASEs, each client in the order it sent its messages
+int process_request_batch(const uint8_t *const *buffers, const size_t *lengths, const struct sockaddr_in *const *client_addrs, int count, dhcp_reply_t *const *replies) {
+    // A standby keeps quiet, the active server of the pair answers
+    if (!lease_replication_is_active())
+        return 0;
+
+    dhcp_packet_class_t classes[MAX_BATCH_SIZE];
+    int valid = classify_dhcp_batch(buffers, lengths, count, classes);
+    if (valid < count)
+        printf(YELLOW "Dropped %d datagrams that are not DHCP requests.\n" RESET, count - valid);
+
+    int reply_count = 0;
+    for (int c = 0; c < valid; c++) {
+        int slot = classes[c].slot;
+        reply_count += process_client_connection(&classes[c], buffers[slot], lengths[slot], client_addrs[slot], replies[reply_count]);
+    }
+    return reply_count;
+}
+
+
+// Function to answer a batch of requests received in client_data_t slots, returns how many answers were built in replies
+int process_client_batch(client_data_t *const *requests, int count, dhcp_reply_t *replies) {
+    const uint8_t *buffers[MAX_BATCH_SIZE];
+    size_t lengths[MAX_BATCH_SIZE];
+    const struct sockaddr_in *client_addrs[MAX_BATCH_SIZE];
+    dhcp_reply_t *reply_slots[MAX_BATCH_SIZE];
+
+    for (int i = 0; i < count; i++) {
+        buffers[i] = (const uint8_t *)requests[i]->buffer;
+        lengths[i] = requests[i]->recv_len > 0 ? (size_t)requests[i]->recv_len : 0;
+        client_addrs[i] = &requests[i]->client_addr;
+        reply_slots[i] = &replies[i];
+    }
+
+    return process_request_batch(buffers, lengths, client_addrs, count, reply_slots);
+}
+
+
+// Function run by every worker, it takes up to batch_size requests from the queue, answers them together and gives the slots back
+void *worker_thread(void *arg) {
+    client_data_t *requests[MAX_BATCH_SIZE];
+    dhcp_reply_t replies[MAX_BATCH_SIZE];
+    packet_batch_t batch;
+
+    atomic_fetch_add(&ready_threads, 1);
+
+    while (!stop_requested) {
+        sem_wait(&pending_signal);
+
+        int count = 0;
+        do {
+            client_data_t *data = (client_data_t *)request_queue_pop(&pending_requests);
+            if (data != NULL)
+                requests[count++] = data;
+        } while (count < batch_size && sem_trywait(&pending_signal) == 0);
+
+        if (count == 0)
+            continue;
+
+        int reply_count = process_client_batch(requests, count, replies);
+
+        send_dhcp_replies(requests[0]->sockfd, replies, reply_count, &batch);
+
+        for (int i = 0; i < count; i++) {
+            request_queue_push(&free_slots, requests[i]);
+        }
+    }
+
+    // Pass the wakeup on, this worker may have taken the one of another worker with sem_trywait
+    sem_post(&pending_signal);
     return NULL;
 }
 
 
+// Function to preallocate the request slots and start the worker threads
+int start_worker_pool(int workers) {
+    request_slots = (client_data_t *)malloc(REQUEST_QUEUE_SIZE * sizeof(client_data_t));
+    if (request_slots == NULL) {
+        printf(RED "Failed to allocate memory for request slots.\n" RESET);
+        return -1;
+    }
+
+    if (request_queue_init(&free_slots, REQUEST_QUEUE_SIZE) != 0 || request_queue_init(&pending_requests, REQUEST_QUEUE_SIZE) != 0) {
+        printf(RED "Failed to allocate memory for request queues.\n" RESET);
+        return -1;
+    }
+
+    for (int i = 0; i < REQUEST_QUEUE_SIZE; i++) {
+        request_queue_push(&free_slots, &request_slots[i]);
+    }
+
+    sem_init(&pending_signal, 0, 0);
+
+    server_threads = (pthread_t *)calloc(workers, sizeof(pthread_t));
+    if (server_threads == NULL) {
+        printf(RED "Failed to allocate memory for worker threads.\n" RESET);
+        return -1;
+    }
+
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&server_threads[i], NULL, worker_thread, NULL) != 0) {
+            printf(RED "Failed to create worker thread.\n" RESET);
+            return -1;
+        }
+        server_thread_count++;
+    }
+
+    printf(GREEN "Worker pool started with %d workers.\n" RESET, workers);
+    return 0;
+}
+
+
 void *check_and_release(void *arg) {
-    while (1) {
-        check_leases();
+    while (!stop_requested) {
+        run_lease_timer();
         sleep(1);
     }
+    return NULL;
+}
+
+// Function to create a UDP socket bound to the server port, reuse_port lets several sockets share the port
+int open_server_socket(int reuse_port) {
+    struct sockaddr_in server_addr;
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        printf(RED "Socket creation failed.\n" RESET);
+        return -1;
+    }
+
+    int enable = 1;
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+        perror(RED "Error setting SO_REUSEPORT" RESET);
+        close(fd);
+        return -1;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));       // Zero out the structure
+    server_addr.sin_family = AF_INET;                   // IPv4
+    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);     // Bind to any address on the system
+    server_addr.sin_port = htons(port);                 // Convert port to network byte order
+
+    if (bind(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        printf(RED "Socket bind failed.\n" RESET);
+        close(fd);
+        return -1;
+    }
+
+    // The thread reading the socket wakes up now and then even with no traffic, to notice SIGINT
+    struct timeval stop_check = { .tv_sec = STOP_CHECK_SECONDS, .tv_usec = 0 };
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &stop_check, sizeof(stop_check)) < 0) {
+        perror(RED "Failed to set the receive timeout" RESET);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+// Function to choose the CPU of every shard, in turn over the CPUs the server may run on, returns -1 if there is no memory
+int assign_shard_cpus(int shards) {
+    shard_cpus = (int *)calloc(shards, sizeof(int));
+    if (shard_cpus == NULL) {
+        printf(RED "Failed to allocate memory for shard CPUs.\n" RESET);
+        return -1;
+    }
+
+    // CPU numbers are not always 0 to n - 1, a CPU can be offline or outside the affinity of the process
+    int cpus[CPU_SETSIZE];
+    int cpu_total = 0;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++)
+            if (CPU_ISSET(c, &allowed))
+                cpus[cpu_total++] = c;
+    }
+    if (cpu_total == 0) {
+        cpu_total = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        for (int c = 0; c < cpu_total && c < CPU_SETSIZE; c++)
+            cpus[c] = c;
+    }
+
+    for (int s = 0; s < shards; s++)
+        shard_cpus[s] = cpus[s % cpu_total];
+    return 0;
+}
+
+
+// Function to make the kernel deliver each packet to the socket of the shard pinned to the CPU that received it
+// A CPU with no shard or with several returns an index past the group, so the kernel spreads its packets by the flow hash
+int attach_cpu_steering(int fd, int shards) {
+    // One comparison and one return per CPU with a single shard, plus the load and the fallback
+    struct sock_filter *code = (struct sock_filter *)calloc(2 * shards + 2, sizeof(struct sock_filter));
+    if (code == NULL)
+        return -1;
+
+    int length = 0;
+    code[length++] = (struct sock_filter){ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU }; // A = current CPU
+    for (int s = 0; s < shards; s++) {
+        int sharing = 0;
+        for (int t = 0; t < shards; t++)
+            sharing += shard_cpus[t] == shard_cpus[s];
+        if (sharing > 1)
+            continue;
+
+        code[length++] = (struct sock_filter){ BPF_JMP | BPF_JEQ | BPF_K, 0, 1, (uint32_t)shard_cpus[s] }; // A == CPU of the shard?
+        code[length++] = (struct sock_filter){ BPF_RET | BPF_K, 0, 0, (uint32_t)s };                       // Socket index of the shard
+    }
+    code[length++] = (struct sock_filter){ BPF_RET | BPF_K, 0, 0, (uint32_t)shards }; // Past the group, the flow hash decides
+
+    struct sock_fprog program = { .len = (unsigned short)length, .filter = code };
+    int result = setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program));
+    free(code);
+    return result;
+}
+
+
+// Function to pin the calling thread to the CPU of its shard
+void pin_shard_to_cpu(int shard) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(shard_cpus[shard], &cpu_set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+        printf(YELLOW "Failed to pin shard %d to CPU %d.\n" RESET, shard, shard_cpus[shard]);
+    }
+}
+
+
+// Function run by every shard, it receives and answers the messages of its socket on its own CPU
+void *shard_thread(void *arg) {
+    int shard = (int)(intptr_t)arg;
+    pin_shard_to_cpu(shard);
+
+    int fd = shard_sockets[shard];
+    client_data_t requests[MAX_BATCH_SIZE];
+    client_data_t *request_list[MAX_BATCH_SIZE];
+    dhcp_reply_t replies[MAX_BATCH_SIZE];
+    packet_batch_t receive_batch, send_batch;
+
+    for (int i = 0; i < batch_size; i++) {
+        requests[i].sockfd = fd;
+        request_list[i] = &requests[i];
+        packet_batch_set(&receive_batch, i, requests[i].buffer, BUFFER_SIZE, &requests[i].client_addr);
+    }
+
+    atomic_fetch_add(&ready_threads, 1);
+
+    while (!stop_requested) {
+        int count = packet_batch_receive(fd, &receive_batch, batch_size, &receive_stats);
+        if (count < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                printf(RED "Failed to receive data.\n" RESET);
+            continue;
+        }
+
+        for (int i = 0; i < count; i++) {
+            client_data_t *data = &requests[i];
+            data->recv_len = receive_batch.headers[i].msg_len;
+            data->client_addr_len = receive_batch.headers[i].msg_hdr.msg_namelen;
+
+            // Clear the part of the message that was not received so it does not keep data from the previous request
+            if (data->recv_len < (ssize_t)sizeof(dhcp_message_t))
+                memset(data->buffer + data->recv_len, 0, sizeof(dhcp_message_t) - data->recv_len);
+        }
+
+        int reply_count = process_client_batch(request_list, count, replies);
+
+        send_dhcp_replies(fd, replies, reply_count, &send_batch);
+    }
+
+    return NULL;
+}
+
+
+// Function to queue the send of a reply of the transmit slab, submitting early if the submission ring is full
+// The early submit carries the sends queued so far, so their leases are flushed to the journal before it
+static void queue_uring_send(uring_t *ring, int fd, uring_tx_slot_t *tx_slots, int tx) {
+    uring_tx_slot_t *slot = &tx_slots[tx];
+    slot->iov.iov_base = &slot->reply.message;
+    slot->iov.iov_len = dhcp_message_length(&slot->reply.message);
+    memset(&slot->msg, 0, sizeof(slot->msg));
+    slot->msg.msg_name = &slot->reply.client_addr;
+    slot->msg.msg_namelen = sizeof(slot->reply.client_addr);
+    slot->msg.msg_iov = &slot->iov;
+    slot->msg.msg_iovlen = 1;
+
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (sqe == NULL) {
+        lease_journal_flush();
+        uring_submit_and_wait(ring, 0);
+        sqe = uring_get_sqe(ring);
+    }
+
+    uring_prep_sendmsg(sqe, fd, &slot->msg);
+    sqe->user_data = URING_USER_DATA(URING_SEND, tx);
+}
+
+
+// Function to answer the datagrams an io_uring shard received while draining its completions, returns how many sends were queued
+// Every answer is built in a free slot of the transmit slab, datagrams that find no free slot are dropped
+static int answer_uring_batch(uring_t *ring, int fd, uring_buffer_ring_t *receive_buffers, uring_receive_batch_t *received,
+                              uring_tx_slot_t *tx_slots, int *free_tx, int *free_tx_count) {
+    int count = received->count;
+    if (count > *free_tx_count) {
+        atomic_fetch_add(&dropped_packets, count - *free_tx_count);
+        count = *free_tx_count;
+    }
+
+    // The slots are taken from the free list up front and the ones left without an answer go back to it
+    dhcp_reply_t *replies[MAX_BATCH_SIZE];
+    int taken[MAX_BATCH_SIZE];
+    for (int i = 0; i < count; i++) {
+        taken[i] = free_tx[--*free_tx_count];
+        replies[i] = &tx_slots[taken[i]].reply;
+    }
+
+    int reply_count = process_request_batch(received->buffers, received->lengths, received->client_addrs, count, replies);
+    for (int i = 0; i < reply_count; i++)
+        queue_uring_send(ring, fd, tx_slots, taken[i]);
+    for (int i = reply_count; i < count; i++)
+        free_tx[(*free_tx_count)++] = taken[i];
+
+    for (int i = 0; i < received->count; i++)
+        uring_buffer_ring_recycle(receive_buffers, received->buffer_ids[i]);
+    received->count = 0;
+    return reply_count;
 }
 
+
+// Function run by every io_uring shard, one ring carries the receives, the sends and the lease timer of its CPU
+void *uring_thread(void *arg) {
+    int shard = (int)(intptr_t)arg;
+    int fd = shard_sockets[shard];
+    pin_shard_to_cpu(shard);
+
+    uring_t ring;
+    uring_buffer_ring_t receive_buffers;
+    if (uring_init(&ring, URING_ENTRIES) != 0 || uring_setup_buffer_ring(&ring, &receive_buffers, URING_BUFFER_GROUP, URING_BUFFERS, URING_BUFFER_SIZE) != 0) {
+        perror(RED "Failed to set up io_uring" RESET);
+        stop_requested = 1;
+        return NULL;
+    }
+
+    // Transmit slab, a reply stays in its slot until the kernel reports the send as done
+    uring_tx_slot_t *tx_slots = (uring_tx_slot_t *)calloc(URING_TX_SLOTS, sizeof(uring_tx_slot_t));
+    int free_tx[URING_TX_SLOTS];
+    int free_tx_count = URING_TX_SLOTS;
+    if (tx_slots == NULL) {
+        printf(RED "Failed to allocate memory for the transmit slab.\n" RESET);
+        uring_destroy(&ring);
+        stop_requested = 1;
+        return NULL;
+    }
+    for (int i = 0; i < URING_TX_SLOTS; i++) {
+        free_tx[i] = i;
+    }
+
+    // Template of the multishot receive, the kernel writes the client address in front of each payload
+    struct msghdr receive_msg;
+    memset(&receive_msg, 0, sizeof(receive_msg));
+    receive_msg.msg_namelen = sizeof(struct sockaddr_in);
+
+    // The first shard replaces the check_and_release thread with a timer on its ring, on the others the timer only wakes the shard to notice SIGINT
+    struct __kernel_timespec lease_tick = { .tv_sec = STOP_CHECK_SECONDS, .tv_nsec = 0 };
+    struct io_uring_sqe *timer_sqe = uring_get_sqe(&ring);
+    uring_prep_timeout(timer_sqe, &lease_tick);
+    timer_sqe->user_data = URING_USER_DATA(URING_TIMEOUT, 0);
+
+    int receive_armed = 0;
+    uring_receive_batch_t pending;
+    pending.count = 0;
+
+    atomic_fetch_add(&ready_threads, 1);
+
+    while (!stop_requested) {
+        if (!receive_armed) {
+            // The ring may be full of sends from the last drain, they are all flushed to the journal by now
+            struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+            if (sqe == NULL) {
+                uring_submit_and_wait(&ring, 0);
+                sqe = uring_get_sqe(&ring);
+            }
+            uring_prep_recvmsg_multishot(sqe, fd, &receive_msg, URING_BUFFER_GROUP);
+            sqe->user_data = URING_USER_DATA(URING_RECV, 0);
+            receive_armed = 1;
+        }
+
+        if (uring_submit_and_wait(&ring, 1) < 0) {
+            perror(RED "Error waiting for io_uring completions" RESET);
+            continue;
+        }
+
+        int received = 0;
+        int sends = 0;
+        struct io_uring_cqe *cqe;
+
+        while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+            int type = (int)(cqe->user_data >> 32);
+            int index = (int)(cqe->user_data & 0xFFFFFFFF);
+
+            if (type == URING_RECV) {
+                // The multishot receive stops when it runs out of buffers or fails, post it again
+                if (!(cqe->flags & IORING_CQE_F_MORE))
+                    receive_armed = 0;
+
+                if (cqe->res < 0) {
+                    if (cqe->res != -ENOBUFS)
+                        printf(RED "Failed to receive data: %s\n" RESET, strerror(-cqe->res));
+                    uring_cqe_seen(&ring);
+                    continue;
+                }
+
+                uint16_t buffer_id = URING_CQE_BUFFER_ID(cqe);
+                uint8_t *buffer = uring_buffer_ring_get(&receive_buffers, buffer_id);
+                struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buffer;
+                struct sockaddr_in *client_addr = (struct sockaddr_in *)(buffer + sizeof(*out));
+                uint8_t *payload = (uint8_t *)client_addr + receive_msg.msg_namelen + receive_msg.msg_controllen;
+                ssize_t recv_len = out->payloadlen;
+                received++;
+
+                // A datagram larger than the buffer is cut and payloadlen still gives its full length, it is not a DHCP message we answer
+                if (out->flags & MSG_TRUNC) {
+                    uring_buffer_ring_recycle(&receive_buffers, buffer_id);
+                    uring_cqe_seen(&ring);
+                    continue;
+                }
+                ssize_t payload_room = (ssize_t)(URING_BUFFER_SIZE - sizeof(*out) - receive_msg.msg_namelen - receive_msg.msg_controllen);
+                if (recv_len > payload_room)
+                    recv_len = payload_room;
+
+                // Clear the part of the message that was not received so it does not keep data from the previous request
+                if (recv_len < (ssize_t)sizeof(dhcp_message_t))
+                    memset(payload + recv_len, 0, sizeof(dhcp_message_t) - recv_len);
+
+                // The datagram stays in its buffer until the batch is answered, with the rest of the completions of this drain
+                pending.buffers[pending.count] = payload;
+                pending.lengths[pending.count] = (size_t)recv_len;
+                pending.client_addrs[pending.count] = client_addr;
+                pending.buffer_ids[pending.count] = buffer_id;
+                if (++pending.count == batch_size)
+                    sends += answer_uring_batch(&ring, fd, &receive_buffers, &pending, tx_slots, free_tx, &free_tx_count);
+            } else if (type == URING_SEND) {
+                log_dhcp_reply(&tx_slots[index].reply, cqe->res >= 0);
+                free_tx[free_tx_count++] = index;
+            } else if (type == URING_TIMEOUT) {
+                if (shard == 0)
+                    run_lease_timer();
+
+                // An early submit also sends the replies queued so far, their leases go to the journal first
+                struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+                if (sqe == NULL) {
+                    lease_journal_flush();
+                    uring_submit_and_wait(&ring, 0);
+                    sqe = uring_get_sqe(&ring);
+                }
+                uring_prep_timeout(sqe, &lease_tick);
+                sqe->user_data = URING_USER_DATA(URING_TIMEOUT, 0);
+            }
+
+            uring_cqe_seen(&ring);
+        }
+
+        if (pending.count > 0)
+            sends += answer_uring_batch(&ring, fd, &receive_buffers, &pending, tx_slots, free_tx, &free_tx_count);
+
+        // Every send prepared while draining the completions goes out with the next submit, once their leases are on disk
+        if (sends > 0)
+            lease_journal_flush();
+        record_batch_fill(&receive_stats, received);
+        record_batch_fill(&send_stats, sends);
+    }
+
+    // Send the replies still queued and wait for every send in flight before the transmit slab goes away
+    while (free_tx_count < URING_TX_SLOTS && uring_submit_and_wait(&ring, 1) >= 0) {
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&ring)) != NULL) {
+            if ((int)(cqe->user_data >> 32) == URING_SEND) {
+                int index = (int)(cqe->user_data & 0xFFFFFFFF);
+                log_dhcp_reply(&tx_slots[index].reply, cqe->res >= 0);
+                free_tx[free_tx_count++] = index;
+            }
+            uring_cqe_seen(&ring);
+        }
+    }
+
+    uring_destroy(&ring);
+    free(tx_slots);
+    return NULL;
+}
+
+
+// Function to open one SO_REUSEPORT socket per shard and start its pinned thread running thread_function
+int start_reuseport_shards(int shards, void *(*thread_function)(void *)) {
+    shard_sockets = (int *)calloc(shards, sizeof(int));
+    if (shard_sockets == NULL) {
+        printf(RED "Failed to allocate memory for shard sockets.\n" RESET);
+        return -1;
+    }
+
+    // Open every socket before starting the threads so the group is complete when packets arrive
+    for (int i = 0; i < shards; i++) {
+        shard_sockets[i] = open_server_socket(1);
+        if (shard_sockets[i] < 0)
+            return -1;
+        shard_count++;
+    }
+
+    // The pinning and the steering program come from the same table, so each packet is read on the CPU that received it
+    if (assign_shard_cpus(shards) != 0)
+        return -1;
+    if (attach_cpu_steering(shard_sockets[0], shards) < 0) {
+        printf(YELLOW "Failed to attach CPU steering, packets will be spread by the flow hash.\n" RESET);
+    }
+
+    server_threads = (pthread_t *)calloc(shards, sizeof(pthread_t));
+    if (server_threads == NULL) {
+        printf(RED "Failed to allocate memory for shard threads.\n" RESET);
+        return -1;
+    }
+
+    for (int i = 0; i < shards; i++) {
+        if (pthread_create(&server_threads[i], NULL, thread_function, (void *)(intptr_t)i) != 0) {
+            printf(RED "Failed to create shard thread.\n" RESET);
+            return -1;
+        }
+        server_thread_count++;
+    }
+
+    printf(GREEN "Started %d SO_REUSEPORT receive shards.\n" RESET, shards);
+    return 0;
+}
+
+
+// Function to wait until every worker or shard finished its setup and remember the allocation count at that point
+// A shard that fails its setup sets stop_requested instead, and the server stops
+void wait_for_steady_state(int threads) {
+    while (atomic_load(&ready_threads) < threads && !stop_requested)
+        usleep(1000);
+
+    startup_allocations = alloc_counter_get();
+}
+
+
 // Function to generate a dynamic gateway IP based on the first IP of the range
 void generate_dynamic_gateway_ip(char *gateway_ip, size_t size) {
     // Get the dynamic gateway IP from the IP pool
@@ -204,86 +900,151 @@ void generate_dynamic_gateway_ip(char *gateway_ip, size_t size) {
 
 int main(int argc, char *argv[]) {
     srand(time(NULL));
-    struct sockaddr_in server_addr, client_addr;
-    char buffer[BUFFER_SIZE];
-    socklen_t client_addr_len = sizeof(client_addr);
 
     load_env_variables();
 
-    printf(GREEN "Subnet loaded: %s\n" RESET, global_subnet_mask);
-    printf(GREEN "Static DNS loaded: %s\n" RESET, global_dns_ip);
-
     signal(SIGINT, handle_signal_interrupt);
-    init_ip_pool();
+    signal(SIGHUP, handle_signal_reload);
+    if (init_ip_pool() != 0)
+        end_program();
 
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0)
-    {
-        printf(RED "Socket creation failed.\n" RESET);
-        exit(0);
-    }
-    printf(GREEN "Socket created successfully.\n" RESET);
+    char local_network[IP_ADDRESS_SIZE];
+    int_to_ip(local_scope->network, local_network);
+    printf(GREEN "Scopes loaded: %d, local scope %s/%d\n" RESET, scope_count, local_network, local_scope->prefix_length);
+
+    // Bring back the leases of the previous run before answering anyone
+    if (strlen(lease_journal) > 0 && lease_journal_open(lease_journal) != 0)
+        end_program();
+
+    // Reservations go last, they take their addresses back from any lease of the journal
+    if (load_reservations() != 0)
+        end_program();
+
+    // With a failover peer, the server first learns whether it is the active one or the standby
+    if (lease_replication_start() != 0)
+        end_program();
+
+    // Load balanced servers agree on who answers which clients by heartbeats
+    if (load_balancing_start() != 0)
+        end_program();
 
     // Generate the gateway IP dynamically
     generate_dynamic_gateway_ip(global_gateway_ip, sizeof(global_gateway_ip));
     printf(GREEN "Dynamic Gateway generated: %s\n" RESET, global_gateway_ip);
 
-    memset(&server_addr, 0, sizeof(server_addr));       // Zero out the structure
-    server_addr.sin_family = AF_INET;                   // IPv4
-    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);     // Bind to any address on the system
-    server_addr.sin_port = htons(port);                 // Convert port to network byte order
+    // Clients name the server by the address it listens on, a server on every address leaves option 54 out
+    if (inet_pton(AF_INET, server_ip, &server_identifier) != 1 || server_identifier == htonl(INADDR_ANY))
+        server_identifier = 0;
 
-    if (bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    // The options of each scope are encoded once, replies only copy them
+    if (build_reply_templates() != 0)
+        end_program();
+
+    int workers = worker_count > 0 ? worker_count : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int use_uring = strcmp(io_mode, "uring") == 0;
+
+    // Create a thread to check and release expired leases, with io_uring the first ring runs this timer itself
+    if (!use_uring)
     {
-        printf(RED "Socket bind failed.\n" RESET);
-        close(sockfd);
-        exit(0);
+        if (pthread_create(&lease_thread, NULL, check_and_release, NULL) != 0)
+        {
+            printf(RED "Failed to create leases thread.\n" RESET);
+            end_program();
+        }
+        lease_thread_started = 1;
+    }
+
+    // In reuseport and uring modes every shard receives and answers on its own, the main thread only waits for a signal
+    if (use_uring || strcmp(io_mode, "reuseport") == 0)
+    {
+        if (start_reuseport_shards(workers, use_uring ? uring_thread : shard_thread) != 0)
+        {
+            end_program();
+        }
+        printf(YELLOW "UDP server is running on %s:%d...\n" RESET, server_ip, port);
+        wait_for_steady_state(workers);
+
+        while (!stop_requested)
+        {
+            sleep(STOP_CHECK_SECONDS);
+        }
+        printf("\nSignal %d received.\n", SIGINT);
+        end_program();
     }
-    printf(GREEN "Socket bind successful.\n" RESET);
-    printf(YELLOW "UDP server is running on %s:%d...\n" RESET, server_ip, port);
 
-    // Create a thread to check and release expired leases
-    pthread_t lease_thread;
-    if (pthread_create(&lease_thread, NULL, check_and_release, NULL) != 0)
+    sockfd = open_server_socket(0);
+    if (sockfd < 0)
     {
-        printf(RED "Failed to create leases thread.\n" RESET);
         end_program();
     }
+    printf(GREEN "Socket created and bound successfully.\n" RESET);
+    printf(YELLOW "UDP server is running on %s:%d...\n" RESET, server_ip, port);
 
-    while (1)
+    // Start the workers that process the DHCP messages
+    if (start_worker_pool(workers) != 0)
     {
-        memset(buffer, 0, BUFFER_SIZE);
+        end_program();
+    }
+
+    wait_for_steady_state(workers);
+
+    client_data_t drop_slot; // Scratch slot used to read and discard packets while every slot is in use
+    client_data_t *held[MAX_BATCH_SIZE]; // Free slots the receiver is about to fill
+    int held_count = 0;
+    packet_batch_t batch;
 
-        int recv_len = recvfrom(sockfd, buffer, BUFFER_SIZE, 0, (struct sockaddr *)&client_addr, &client_addr_len);
-        if (recv_len < 0)
+    while (!stop_requested)
+    {
+        while (held_count < batch_size)
         {
-            printf(RED "Failed to receive data.\n" RESET);
-            continue;
+            client_data_t *slot = (client_data_t *)request_queue_pop(&free_slots);
+            if (slot == NULL)
+                break;
+            held[held_count++] = slot;
         }
 
-        client_data_t *client_data = (client_data_t *)malloc(sizeof(client_data_t));
-        if (!client_data)
+        if (held_count == 0)
         {
-            printf(RED "Failed to allocate memory for client data.\n" RESET);
+            drop_slot.client_addr_len = sizeof(drop_slot.client_addr);
+            if (recvfrom(sockfd, drop_slot.buffer, BUFFER_SIZE, 0, (struct sockaddr *)&drop_slot.client_addr, &drop_slot.client_addr_len) >= 0)
+                atomic_fetch_add(&dropped_packets, 1);
             continue;
         }
 
-        client_data->sockfd = sockfd;
-        memcpy(client_data->buffer, buffer, BUFFER_SIZE);
-        client_data->client_addr = client_addr;
-        client_data->client_addr_len = client_addr_len;
+        for (int i = 0; i < held_count; i++)
+        {
+            packet_batch_set(&batch, i, held[i]->buffer, BUFFER_SIZE, &held[i]->client_addr);
+        }
 
-        pthread_t thread_id;
-        if (pthread_create(&thread_id, NULL, process_client_connection, (void *)client_data) != 0)
+        int count = packet_batch_receive(sockfd, &batch, held_count, &receive_stats);
+        if (count < 0)
         {
-            printf(RED "Failed to create thread.\n" RESET);
-            free(client_data);
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                printf(RED "Failed to receive data.\n" RESET);
             continue;
         }
 
-        pthread_detach(thread_id);
+        for (int i = 0; i < count; i++)
+        {
+            client_data_t *slot = held[i];
+            slot->sockfd = sockfd;
+            slot->recv_len = batch.headers[i].msg_len;
+            slot->client_addr_len = batch.headers[i].msg_hdr.msg_namelen;
+
+            // Clear the part of the message that was not received so it does not keep data from the previous request
+            if (slot->recv_len < (ssize_t)sizeof(dhcp_message_t))
+                memset(slot->buffer + slot->recv_len, 0, sizeof(dhcp_message_t) - slot->recv_len);
+
+            request_queue_push(&pending_requests, slot);
+            sem_post(&pending_signal);
+        }
+
+        // Keep the slots that were not filled for the next call
+        held_count -= count;
+        memmove(held, held + count, held_count * sizeof(held[0]));
     }
 
+    printf("\nSignal %d received.\n", SIGINT);
     end_program();
     return 0;
 }
@@ -4,29 +4,87 @@
 #include <netinet/in.h>
 
 #include "./data/message.h"
+#include "./config/scope.h"
+#include "./utils/batch_io.h"
+#include "./utils/uring.h"
 
 #define MAX_CHARACTERS 360
 #define BUFFER_SIZE 1024 // Buffer size for incoming messages, maximum size of a DHCP message is 1024 bytes
 #define SOCKET_ADDRESS struct sockaddr // Define SOCKET_ADDRESS as struct sockaddr 
 #define MAX_CLIENTS 100 // Define the maximum number of clients
+#define REQUEST_QUEUE_SIZE 4096 // Number of preallocated request slots shared by the receiver and the workers
+#define STOP_CHECK_SECONDS 1 // Longest the main thread waits on a receive or a sleep before checking for SIGINT
+
+// io_uring backend
+#define URING_ENTRIES 512 // Submission ring size of every shard, room for every transmit slot, the receive and the timer
+#define URING_BUFFERS 256 // Provided receive buffers per ring, must be a power of two
+#define URING_BUFFER_GROUP 0
+#define URING_BUFFER_SIZE (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + BUFFER_SIZE) // Header, client address and payload
+#define URING_TX_SLOTS 256 // Replies that can be in flight per ring
+#define URING_RECV 1
+#define URING_SEND 2
+#define URING_TIMEOUT 3
+#define URING_USER_DATA(type, index) (((uint64_t)(type) << 32) | (uint32_t)(index)) // Tags each submission with its operation and slot
 
 // Structure to pass client information to threads
 typedef struct {
     int sockfd;
     struct sockaddr_in client_addr;
-    char buffer[BUFFER_SIZE];
+    _Alignas(8) char buffer[BUFFER_SIZE]; // Aligned so the DHCP message can be read in place
     socklen_t client_addr_len;
+    ssize_t recv_len; // Number of bytes received in the buffer
 } client_data_t;
 
+// Answer built by a handler, it is sent later together with the rest of its batch
+typedef struct {
+    dhcp_message_t message;
+    struct sockaddr_in client_addr;
+} dhcp_reply_t;
+
+// Slot of the io_uring transmit slab, the message header must live until the send completes
+typedef struct {
+    dhcp_reply_t reply;
+    struct msghdr msg;
+    struct iovec iov;
+} uring_tx_slot_t;
+
+// Datagrams of an io_uring shard waiting in their provided buffers to be answered together
+typedef struct {
+    const uint8_t *buffers[MAX_BATCH_SIZE];
+    size_t lengths[MAX_BATCH_SIZE];
+    const struct sockaddr_in *client_addrs[MAX_BATCH_SIZE];
+    uint16_t buffer_ids[MAX_BATCH_SIZE];   // Provided buffer of each datagram, recycled once the batch is answered
+    int count;
+} uring_receive_batch_t;
+
 
 // Function Declarations
+void stop_server_threads();
 void end_program();
 void handle_signal_interrupt(int signal) ;
-void send_dhcp_offer(int socket_fd, struct sockaddr_in *client_addr, dhcp_message_t *discover_message);
-void handle_dhcp_request(int sockfd, struct sockaddr_in *client_addr, dhcp_message_t *request_msg);
-void handle_dhcp_release(int sockfd, dhcp_message_t *release_msg);
-void *process_client_connection(void *arg);
+void handle_signal_reload(int signal);
+void run_lease_timer();
+int client_id_length(const dhcp_message_t *message);
+uint32_t find_scope_reservation(const scope_t *scope, const dhcp_message_t *message);
+void send_dhcp_offer(dhcp_reply_t *reply, const dhcp_message_t *discover_message, const scope_t *scope);
+int handle_dhcp_request(dhcp_reply_t *reply, const dhcp_message_t *request_msg, const dhcp_option_index_t *options, const scope_t *scope);
+void handle_dhcp_release(const dhcp_message_t *release_msg);
+int process_client_connection(const dhcp_packet_class_t *packet, const uint8_t *buffer, size_t recv_len, const struct sockaddr_in *client_addr, dhcp_reply_t *reply);
+int process_request_batch(const uint8_t *const *buffers, const size_t *lengths, const struct sockaddr_in *const *client_addrs, int count, dhcp_reply_t *const *replies);
+int process_client_batch(client_data_t *const *requests, int count, dhcp_reply_t *replies);
+void send_dhcp_replies(int fd, dhcp_reply_t *replies, int count, packet_batch_t *batch);
+void log_dhcp_reply(const dhcp_reply_t *reply, int sent);
 void *check_and_release(void *arg);
+void *worker_thread(void *arg);
+int start_worker_pool(int workers);
+int open_server_socket(int reuse_port);
+int assign_shard_cpus(int shards);
+int attach_cpu_steering(int fd, int shards);
+void pin_shard_to_cpu(int shard);
+void *shard_thread(void *arg);
+void *uring_thread(void *arg);
+int start_reuseport_shards(int shards, void *(*thread_function)(void *));
+void wait_for_steady_state(int threads);
 void generate_dynamic_gateway_ip(char *gateway_ip, size_t size);
 
 #endif
\ No newline at end of file
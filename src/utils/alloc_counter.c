@@ -0,0 +1,45 @@
+#include "./alloc_counter.h"
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#ifdef DEBUG_ALLOC_COUNTER
+
+// Allocator of the C library, the wrappers below forward to it
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static atomic_long allocations = 0;
+
+
+// The executable defines malloc, so every caller in the process (the C library included) goes through these wrappers
+void *malloc(size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+
+// Function to get the number of heap allocations made so far, returns -1 if the counter was not compiled in
+long alloc_counter_get() {
+    return atomic_load(&allocations);
+}
+
+#else
+
+// Function to get the number of heap allocations made so far, returns -1 if the counter was not compiled in
+long alloc_counter_get() {
+    return -1;
+}
+
+#endif
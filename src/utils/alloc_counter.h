@@ -0,0 +1,9 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+// Build with -DDEBUG_ALLOC_COUNTER to count every malloc, calloc and realloc made by the process (including the C library)
+
+// Function to get the number of heap allocations made so far, returns -1 if the counter was not compiled in
+long alloc_counter_get();
+
+#endif
@@ -0,0 +1,96 @@
+#define _GNU_SOURCE // For recvmmsg(), sendmmsg() and struct mmsghdr
+
+#include "./batch_io.h"
+#include "../config/env.h"
+
+#include <stdio.h>
+#include <errno.h>
+
+
+// Function to count a batch in the bucket of its fill level
+void record_batch_fill(batch_stats_t *stats, int count) {
+    if (stats == NULL || count <= 0)
+        return;
+
+    int bucket = 0;
+    while ((count >> (bucket + 1)) > 0 && bucket < BATCH_FILL_BUCKETS - 1)
+        bucket++;
+
+    atomic_fetch_add_explicit(&stats->calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->datagrams, count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->fill[bucket], 1, memory_order_relaxed);
+}
+
+
+// Function to point an entry of the batch at a buffer and the address of its peer
+void packet_batch_set(packet_batch_t *batch, int index, void *buffer, size_t length, struct sockaddr_in *addr) {
+    batch->iovecs[index].iov_base = buffer;
+    batch->iovecs[index].iov_len = length;
+
+    struct msghdr *header = &batch->headers[index].msg_hdr;
+    header->msg_name = addr;
+    header->msg_namelen = addr ? sizeof(*addr) : 0;
+    header->msg_iov = &batch->iovecs[index];
+    header->msg_iovlen = 1;
+    header->msg_control = NULL;
+    header->msg_controllen = 0;
+    header->msg_flags = 0;
+    batch->headers[index].msg_len = 0;
+}
+
+
+// Function to receive up to count datagrams, blocks until at least one arrives and returns how many were received
+int packet_batch_receive(int fd, packet_batch_t *batch, int count, batch_stats_t *stats) {
+    if (count > MAX_BATCH_SIZE)
+        count = MAX_BATCH_SIZE;
+
+    // The kernel overwrites the address length of every entry it fills, restore it first
+    for (int i = 0; i < count; i++) {
+        if (batch->headers[i].msg_hdr.msg_name)
+            batch->headers[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+
+    int received;
+    do {
+        received = recvmmsg(fd, batch->headers, count, MSG_WAITFORONE, NULL);
+    } while (received < 0 && errno == EINTR);
+
+    record_batch_fill(stats, received);
+    return received;
+}
+
+
+// Function to send the first count entries of the batch, returns how many were sent
+int packet_batch_send(int fd, packet_batch_t *batch, int count, batch_stats_t *stats) {
+    int sent = 0;
+
+    // sendmmsg may stop early, keep going from the first entry that was not sent
+    while (sent < count) {
+        int result = sendmmsg(fd, &batch->headers[sent], count - sent, 0);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            if (sent == 0)
+                return -1;
+            break;
+        }
+
+        record_batch_fill(stats, result);
+        sent += result;
+    }
+
+    return sent;
+}
+
+
+// Function to print the fill level counters of a batch direction
+void print_batch_stats(const char *label, batch_stats_t *stats) {
+    unsigned long calls = atomic_load(&stats->calls);
+    unsigned long datagrams = atomic_load(&stats->datagrams);
+
+    printf(CYAN "%s: %lu datagrams in %lu calls (%.2f per call)\n" RESET, label, datagrams, calls, calls ? (double)datagrams / calls : 0.0);
+    for (int i = 0; i < BATCH_FILL_BUCKETS - 1; i++) {
+        printf("  %2d-%-2d datagrams: %lu\n", 1 << i, (1 << (i + 1)) - 1, atomic_load(&stats->fill[i]));
+    }
+    printf("  %2d+   datagrams: %lu\n", 1 << (BATCH_FILL_BUCKETS - 1), atomic_load(&stats->fill[BATCH_FILL_BUCKETS - 1]));
+}
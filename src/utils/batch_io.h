@@ -0,0 +1,44 @@
+#ifndef BATCH_IO_H
+#define BATCH_IO_H
+
+// recvmmsg(), sendmmsg() and struct mmsghdr need _GNU_SOURCE defined before the first system include
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "../config/env.h" // For MAX_BATCH_SIZE
+
+#define BATCH_FILL_BUCKETS 7 // Fill levels are counted in power of two buckets: 1, 2-3, 4-7, 8-15, 16-31, 32-63, 64 or more
+
+
+// Counters of how full the batches were
+typedef struct {
+    atomic_ulong calls;     // Number of recvmmsg/sendmmsg calls
+    atomic_ulong datagrams; // Number of datagrams moved by those calls
+    atomic_ulong fill[BATCH_FILL_BUCKETS];
+} batch_stats_t;
+
+// Set of datagram headers pointing at buffers owned by the caller
+typedef struct {
+    struct mmsghdr headers[MAX_BATCH_SIZE];
+    struct iovec iovecs[MAX_BATCH_SIZE];
+} packet_batch_t;
+
+
+// Function to point an entry of the batch at a buffer and the address of its peer
+void packet_batch_set(packet_batch_t *batch, int index, void *buffer, size_t length, struct sockaddr_in *addr);
+
+// Function to receive up to count datagrams, blocks until at least one arrives and returns how many were received
+int packet_batch_receive(int fd, packet_batch_t *batch, int count, batch_stats_t *stats);
+
+// Function to send the first count entries of the batch, returns how many were sent
+int packet_batch_send(int fd, packet_batch_t *batch, int count, batch_stats_t *stats);
+
+// Function to count a batch in the bucket of its fill level
+void record_batch_fill(batch_stats_t *stats, int count);
+
+// Function to print the fill level counters of a batch direction
+void print_batch_stats(const char *label, batch_stats_t *stats);
+
+#endif
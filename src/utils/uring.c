@@ -0,0 +1,238 @@
+#include "./uring.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+// Raw system calls, the server talks to io_uring directly to avoid depending on liburing
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+// Function to create an io_uring instance with room for entries submissions
+int uring_init(uring_t *ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    // Only the owning thread submits, let the kernel skip the cross-thread work if it supports it
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    ring->fd = sys_io_uring_setup(entries, &params);
+    if (ring->fd < 0 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));
+        ring->fd = sys_io_uring_setup(entries, &params);
+    }
+    if (ring->fd < 0)
+        return -1;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring_ptr = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring_ptr == MAP_FAILED)
+        goto fail;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring_ptr = ring->sq_ring_ptr;
+    } else {
+        ring->cq_ring_ptr = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring_ptr == MAP_FAILED)
+            goto fail;
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto fail;
+
+    uint8_t *sq = (uint8_t *)ring->sq_ring_ptr;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = (unsigned *)(sq + params.sq_off.ring_entries);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sqe_tail = *ring->sq_tail;
+    ring->sqe_submitted = ring->sqe_tail;
+
+    uint8_t *cq = (uint8_t *)ring->cq_ring_ptr;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return 0;
+
+fail:
+    uring_destroy(ring);
+    return -1;
+}
+
+
+// Function to unmap and close an io_uring instance
+void uring_destroy(uring_t *ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring_ptr && ring->cq_ring_ptr != MAP_FAILED && ring->cq_ring_ptr != ring->sq_ring_ptr)
+        munmap(ring->cq_ring_ptr, ring->cq_ring_size);
+    if (ring->sq_ring_ptr && ring->sq_ring_ptr != MAP_FAILED)
+        munmap(ring->sq_ring_ptr, ring->sq_ring_size);
+    if (ring->fd >= 0)
+        close(ring->fd);
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+
+// Function to get an empty submission entry, returns NULL if the submission ring is full
+struct io_uring_sqe *uring_get_sqe(uring_t *ring) {
+    unsigned head = atomic_load_explicit((_Atomic unsigned *)ring->sq_head, memory_order_acquire);
+    if (ring->sqe_tail - head >= *ring->sq_entries)
+        return NULL;
+
+    unsigned index = ring->sqe_tail & *ring->sq_mask;
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+
+// Function to hand the prepared entries to the kernel and wait for at least wait_nr completions
+int uring_submit_and_wait(uring_t *ring, unsigned wait_nr) {
+    unsigned to_submit = ring->sqe_tail - ring->sqe_submitted;
+
+    // Publish the new tail so the kernel sees every prepared entry
+    atomic_store_explicit((_Atomic unsigned *)ring->sq_tail, ring->sqe_tail, memory_order_release);
+    ring->sqe_submitted = ring->sqe_tail;
+
+    int result;
+    do {
+        result = sys_io_uring_enter(ring->fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    } while (result < 0 && errno == EINTR);
+
+    return result;
+}
+
+
+// Function to get the next completion, returns NULL if there is none
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring) {
+    unsigned head = *ring->cq_head;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned *)ring->cq_tail, memory_order_acquire);
+    if (head == tail)
+        return NULL;
+
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+
+// Function to mark the completion returned by uring_peek_cqe as consumed
+void uring_cqe_seen(uring_t *ring) {
+    atomic_store_explicit((_Atomic unsigned *)ring->cq_head, *ring->cq_head + 1, memory_order_release);
+}
+
+
+// Function to register a ring of entries buffers of buffer_size bytes under the given group
+int uring_setup_buffer_ring(uring_t *ring, uring_buffer_ring_t *buffer_ring, uint16_t group, unsigned entries, size_t buffer_size) {
+    memset(buffer_ring, 0, sizeof(*buffer_ring));
+
+    // The ring itself must be page aligned, mmap gives us that
+    size_t ring_size = entries * sizeof(struct io_uring_buf);
+    void *memory = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return -1;
+
+    buffer_ring->buffers = (uint8_t *)mmap(NULL, entries * buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer_ring->buffers == MAP_FAILED) {
+        munmap(memory, ring_size);
+        return -1;
+    }
+
+    buffer_ring->ring = (struct io_uring_buf_ring *)memory;
+    buffer_ring->buffer_size = buffer_size;
+    buffer_ring->entries = entries;
+    buffer_ring->group = group;
+
+    struct io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = (uint64_t)(uintptr_t)memory;
+    registration.ring_entries = entries;
+    registration.bgid = group;
+
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+        return -1;
+
+    for (unsigned i = 0; i < entries; i++)
+        uring_buffer_ring_recycle(buffer_ring, (uint16_t)i);
+
+    return 0;
+}
+
+
+// Function to give a provided buffer back to the kernel
+void uring_buffer_ring_recycle(uring_buffer_ring_t *buffer_ring, uint16_t buffer_id) {
+    struct io_uring_buf *buffer = &buffer_ring->ring->bufs[buffer_ring->tail & (buffer_ring->entries - 1)];
+    buffer->addr = (uint64_t)(uintptr_t)uring_buffer_ring_get(buffer_ring, buffer_id);
+    buffer->len = (uint32_t)buffer_ring->buffer_size;
+    buffer->bid = buffer_id;
+
+    buffer_ring->tail++;
+    atomic_store_explicit((_Atomic uint16_t *)&buffer_ring->ring->tail, buffer_ring->tail, memory_order_release);
+}
+
+
+// Function to get the address of a provided buffer
+uint8_t *uring_buffer_ring_get(uring_buffer_ring_t *buffer_ring, uint16_t buffer_id) {
+    return buffer_ring->buffers + (size_t)buffer_id * buffer_ring->buffer_size;
+}
+
+
+// Function to post a receive that keeps completing, one datagram per completion, into buffers of the given group
+void uring_prep_recvmsg_multishot(struct io_uring_sqe *sqe, int fd, struct msghdr *msg, uint16_t group) {
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+}
+
+
+// Function to prepare the send of one datagram described by msg
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg) {
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+}
+
+
+// Function to prepare a timer that completes with -ETIME after timeout
+void uring_prep_timeout(struct io_uring_sqe *sqe, struct __kernel_timespec *timeout) {
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)timeout;
+    sqe->len = 1;
+    sqe->off = 0; // Pure timer, not waiting for a number of completions
+}
@@ -0,0 +1,84 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h> // For struct __kernel_timespec
+
+#define URING_CQE_BUFFER_ID(cqe) ((uint16_t)((cqe)->flags >> IORING_CQE_BUFFER_SHIFT)) // Provided buffer used by a completion
+
+
+// io_uring instance with its submission and completion rings mapped in memory
+typedef struct {
+    int fd;
+
+    // Submission ring
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_tail;      // Entries prepared by the application
+    unsigned sqe_submitted; // Entries already handed to the kernel
+
+    // Completion ring
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // Mappings to release on exit
+    void *sq_ring_ptr;
+    size_t sq_ring_size;
+    void *cq_ring_ptr;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring_t;
+
+// Ring of buffers the kernel picks from when a receive completes
+typedef struct {
+    struct io_uring_buf_ring *ring;
+    uint8_t *buffers;
+    size_t buffer_size;
+    unsigned entries; // Always a power of two
+    uint16_t group;
+    uint16_t tail;
+} uring_buffer_ring_t;
+
+
+// Function to create an io_uring instance with room for entries submissions
+int uring_init(uring_t *ring, unsigned entries);
+
+// Function to unmap and close an io_uring instance
+void uring_destroy(uring_t *ring);
+
+// Function to get an empty submission entry, returns NULL if the submission ring is full
+struct io_uring_sqe *uring_get_sqe(uring_t *ring);
+
+// Function to hand the prepared entries to the kernel and wait for at least wait_nr completions
+int uring_submit_and_wait(uring_t *ring, unsigned wait_nr);
+
+// Function to get the next completion, returns NULL if there is none
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring);
+
+// Function to mark the completion returned by uring_peek_cqe as consumed
+void uring_cqe_seen(uring_t *ring);
+
+// Function to register a ring of entries buffers of buffer_size bytes under the given group
+int uring_setup_buffer_ring(uring_t *ring, uring_buffer_ring_t *buffer_ring, uint16_t group, unsigned entries, size_t buffer_size);
+
+// Function to give a provided buffer back to the kernel
+void uring_buffer_ring_recycle(uring_buffer_ring_t *buffer_ring, uint16_t buffer_id);
+
+// Function to get the address of a provided buffer
+uint8_t *uring_buffer_ring_get(uring_buffer_ring_t *buffer_ring, uint16_t buffer_id);
+
+// Functions to prepare the operations used by the server
+void uring_prep_recvmsg_multishot(struct io_uring_sqe *sqe, int fd, struct msghdr *msg, uint16_t group);
+void uring_prep_sendmsg(struct io_uring_sqe *sqe, int fd, const struct msghdr *msg);
+void uring_prep_timeout(struct io_uring_sqe *sqe, struct __kernel_timespec *timeout);
+
+#endif
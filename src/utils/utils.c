@@ -91,4 +91,17 @@ int get_mac_address(uint8_t *mac, const char *iface) {
     memcpy(mac, ifr.ifr_hwaddr.sa_data, 6); // 6 bytes de la dirección MAC
     return 0;
 #endif
-}
\ No newline at end of file
+}
+
+
+// Function to convert an IP in text format to an integer
+unsigned int ip_to_int(const char* ip) {
+    unsigned int a, b, c, d;
+    sscanf(ip, "%u.%u.%u.%u", &a, &b, &c, &d);
+    return (a << 24) | (b << 16) | (c << 8) | d;
+}
+
+// Function to convert an integer to an IP in text format
+void int_to_ip(unsigned int ip, char* buffer) {
+    sprintf(buffer, "%u.%u.%u.%u", (ip >> 24) & 0xFF, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF);
+}
@@ -6,4 +6,8 @@
 // Function to get the MAC address of a network interface
 int get_mac_address(uint8_t *mac, const char *iface);
 
+// Function declarations to convert IP to integer and vice versa
+unsigned int ip_to_int(const char* ip);
+void int_to_ip(unsigned int ip, char* buffer);
+
 #endif
\ No newline at end of file